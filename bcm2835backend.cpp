@@ -0,0 +1,92 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "bcm2835backend.h"
+#include "gpiolinereader.h"
+#include "logging.h"
+
+#include <QDebug>
+
+#include <bcm2835.h>
+
+class Bcm2835BackendPrivate {
+public:
+    Bcm2835BackendPrivate() {}
+    ~Bcm2835BackendPrivate() {
+        if (isInitialized && bcm2835_close()) {
+            qCDebug(RELAYBOARD_GPIO) << "Successfully shut down the relay connection";
+        }
+    }
+    QString gpioChip;
+    bool isInitialized{false};
+    GpioLineReader *lineReader{nullptr};
+};
+
+Bcm2835Backend::Bcm2835Backend(const GpioBankDefinition &bank, QObject *parent)
+    : GpioBackend(parent)
+    , d(new Bcm2835BackendPrivate)
+{
+    d->gpioChip = bank.gpioChip;
+}
+
+Bcm2835Backend::~Bcm2835Backend() = default;
+
+bool Bcm2835Backend::initialize(const QList<int> &outputLines, const QList<int> &inputLines)
+{
+    if (!bcm2835_init()) {
+        qCWarning(RELAYBOARD_GPIO) << "Failed to initialise the bcm2835 library - are we running as root on a Raspberry Pi?";
+        return false;
+    }
+    d->isInitialized = true;
+    uint32_t outputMask{0};
+    for (int line : outputLines) {
+        if (line < 0 || line > 31) {
+            qCWarning(RELAYBOARD_GPIO) << "The bcm2835 backend can only drive lines in the first GPIO bank, not" << line;
+            return false;
+        }
+        outputMask |= (1u << line);
+    }
+    // Make sure the relays start out released before the lines become outputs
+    bcm2835_gpio_set_multi(outputMask);
+    for (int line : outputLines) {
+        bcm2835_gpio_fsel(uint8_t(line), BCM2835_GPIO_FSEL_OUTP);
+    }
+
+    // The inputs are read through the GPIO character device, which gives us
+    // kernel timestamped edges, rather than polling the levels ourselves
+    d->lineReader = new GpioLineReader(d->gpioChip, this);
+    connect(d->lineReader, &GpioLineReader::lineChanged, this, &GpioBackend::inputChanged);
+    connect(d->lineReader, &GpioLineReader::eventsLost, this, &GpioBackend::inputEventsLost);
+    if (!inputLines.isEmpty() && !d->lineReader->requestLines(inputLines)) {
+        qCWarning(RELAYBOARD_GPIO) << "Failed to set up the input lines on" << d->gpioChip;
+        return false;
+    }
+    return true;
+}
+
+void Bcm2835Backend::writeOutputs(quint64 levels, quint64 mask)
+{
+    // Setting and clearing are separate registers, so this is safe to do from
+    // the GPIO worker without any locking
+    bcm2835_gpio_write_mask(uint32_t(levels), uint32_t(mask));
+}
+
+bool Bcm2835Backend::inputLevel(int line) const
+{
+    return d->lineReader && d->lineReader->lineLevel(line);
+}
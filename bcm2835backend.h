@@ -0,0 +1,49 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BCM2835BACKEND_H
+#define BCM2835BACKEND_H
+
+#include "gpiobackend.h"
+
+#include <memory>
+
+class Bcm2835BackendPrivate;
+/**
+ * The GPIO backend for a real Raspberry Pi
+ *
+ * The relays are driven through the bcm2835 library's direct register access,
+ * which lets us change any number of them in a single GPSET/GPCLR write, and
+ * the inputs are read through the GPIO character device (see GpioLineReader).
+ * This requires running as root.
+ */
+class Bcm2835Backend : public GpioBackend
+{
+    Q_OBJECT
+public:
+    explicit Bcm2835Backend(const GpioBankDefinition &bank, QObject *parent = nullptr);
+    ~Bcm2835Backend() override;
+
+    bool initialize(const QList<int> &outputLines, const QList<int> &inputLines) override;
+    void writeOutputs(quint64 levels, quint64 mask) override;
+    bool inputLevel(int line) const override;
+private:
+    std::unique_ptr<Bcm2835BackendPrivate> d;
+};
+
+#endif//BCM2835BACKEND_H
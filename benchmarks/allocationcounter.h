@@ -0,0 +1,34 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+#include <QtGlobal>
+
+/**
+ * The number of allocations made through operator new since the process started
+ *
+ * Linking allocationcounter.cpp into a benchmark replaces the global operator
+ * new and delete with ones which keep count, so comparing this before and
+ * after some work gives the number of allocations it made.
+ */
+quint64 allocationCount();
+
+#endif//ALLOCATIONCOUNTER_H
@@ -0,0 +1,64 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "benchmarkreport.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QFile>
+#include <QJsonDocument>
+
+#include <algorithm>
+#include <cstdio>
+
+void BenchmarkReport::report(const QString &benchmark, const QString &measurement, const QJsonObject &values)
+{
+    QJsonObject result{values};
+    result.insert(QStringLiteral("benchmark"), benchmark);
+    result.insert(QStringLiteral("measurement"), measurement);
+    result.insert(QStringLiteral("version"), QStringLiteral(RELAYBOARD_VERSION));
+    result.insert(QStringLiteral("timestamp"), QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+    const QByteArray line{QJsonDocument(result).toJson(QJsonDocument::Compact) + '\n'};
+    const QString reportFile{qEnvironmentVariable("RELAYBOARD_BENCHMARK_REPORT")};
+    if (reportFile.isEmpty()) {
+        fputs(line.constData(), stdout);
+        fflush(stdout);
+        return;
+    }
+    QFile file(reportFile);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append) || file.write(line) < 0) {
+        qWarning() << "Failed to write the benchmark results to" << reportFile << ":" << file.errorString();
+    }
+}
+
+void BenchmarkReport::addPercentiles(QJsonObject &values, QVector<quint64> latenciesNs)
+{
+    if (latenciesNs.isEmpty()) {
+        return;
+    }
+    std::sort(latenciesNs.begin(), latenciesNs.end());
+    const auto percentileUs = [&latenciesNs](double percentile) {
+        const int index{qBound(0, int(percentile * latenciesNs.count() + 0.5) - 1, latenciesNs.count() - 1)};
+        return double(latenciesNs.at(index)) / 1000.0;
+    };
+    values.insert(QStringLiteral("samples"), latenciesNs.count());
+    values.insert(QStringLiteral("p50Us"), percentileUs(0.5));
+    values.insert(QStringLiteral("p99Us"), percentileUs(0.99));
+    values.insert(QStringLiteral("maxUs"), double(latenciesNs.last()) / 1000.0);
+}
@@ -0,0 +1,54 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef BENCHMARKREPORT_H
+#define BENCHMARKREPORT_H
+
+#include <QJsonObject>
+#include <QString>
+#include <QVector>
+
+/**
+ * Machine-readable results, to follow the hot paths across releases
+ *
+ * Each result is a single line of JSON, naming the benchmark and the
+ * measurement, along with the version of the service it was taken from.
+ * The lines are appended to the file named by the RELAYBOARD_BENCHMARK_REPORT
+ * environment variable, or written to standard output if it is not set.
+ * (The timings taken by QBENCHMARK come out through QtTest's own reporting,
+ * which can also be machine-readable, for example with -csv or -o file,xml.)
+ */
+namespace BenchmarkReport
+{
+/**
+ * Write out a single result
+ * @param benchmark The name of the benchmark
+ * @param measurement The name of what was measured
+ * @param values The results, such as p50Us, p99Us and allocationsPerOperation
+ */
+void report(const QString &benchmark, const QString &measurement, const QJsonObject &values);
+/**
+ * Add the median, 99th percentile and maximum of a set of latencies to a result
+ * @param values The result to add the latencies to
+ * @param latenciesNs The latencies, in nanoseconds, in any order
+ */
+void addPercentiles(QJsonObject &values, QVector<quint64> latenciesNs);
+}
+
+#endif//BENCHMARKREPORT_H
@@ -0,0 +1,280 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "brokerstandin.h"
+#include "topicrouter.h"
+
+#include <QHash>
+#include <QHostAddress>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QVector>
+
+namespace {
+enum PacketType {
+    Connect = 1,
+    ConnAck = 2,
+    Publish = 3,
+    PubAck = 4,
+    PubRec = 5,
+    PubRel = 6,
+    PubComp = 7,
+    Subscribe = 8,
+    SubAck = 9,
+    Unsubscribe = 10,
+    UnsubAck = 11,
+    PingReq = 12,
+    PingResp = 13,
+    Disconnect = 14,
+};
+
+QByteArray packet(quint8 header, const QByteArray &body)
+{
+    QByteArray data;
+    data.reserve(body.size() + 5);
+    data += char(header);
+    // The remaining length, seven bits at a time, with the top bit set when more follow
+    int length{body.size()};
+    do {
+        quint8 byte{quint8(length % 128)};
+        length /= 128;
+        if (length > 0) {
+            byte |= 0x80;
+        }
+        data += char(byte);
+    } while (length > 0);
+    return data + body;
+}
+
+QByteArray packetId(quint16 id)
+{
+    QByteArray data;
+    data += char(id >> 8);
+    data += char(id & 0xff);
+    return data;
+}
+
+QByteArray string(const QByteArray &text)
+{
+    return packetId(quint16(text.size())) + text;
+}
+
+struct Subscription {
+    QString filter;
+    quint8 qos;
+};
+
+struct Client {
+    QTcpSocket *socket{nullptr};
+    QByteArray buffer;
+    QVector<Subscription> subscriptions;
+    quint16 nextPacketId{1};
+};
+}
+
+class BrokerStandInPrivate {
+public:
+    BrokerStandInPrivate() {}
+    QTcpServer *server{nullptr};
+    QHash<QTcpSocket*, Client> clients;
+    QHash<QString, QByteArray> retained;
+    quint64 publishCount{0};
+
+    void deliver(Client &client, const QString &topic, const QByteArray &payload, quint8 qos, bool retain) {
+        QByteArray body{string(topic.toUtf8())};
+        if (qos > 0) {
+            body += packetId(client.nextPacketId);
+            client.nextPacketId = client.nextPacketId == 0xffff ? 1 : client.nextPacketId + 1;
+        }
+        body += payload;
+        client.socket->write(packet(quint8((Publish << 4) | (qos << 1) | (retain ? 1 : 0)), body));
+    }
+    void publish(const QString &topic, const QByteArray &payload, quint8 qos, bool retain) {
+        ++publishCount;
+        if (retain) {
+            if (payload.isEmpty()) {
+                retained.remove(topic);
+            } else {
+                retained.insert(topic, payload);
+            }
+        }
+        for (Client &client : clients) {
+            // Each client gets a message once, at the highest QoS of the subscriptions it matches
+            int deliveryQos{-1};
+            for (const Subscription &subscription : qAsConst(client.subscriptions)) {
+                if (TopicRouter::filterMatches(subscription.filter, topic)) {
+                    deliveryQos = qMax(deliveryQos, int(qMin(qos, subscription.qos)));
+                }
+            }
+            if (deliveryQos > -1) {
+                deliver(client, topic, payload, quint8(deliveryQos), false);
+            }
+        }
+    }
+    /**
+     * Handle a single packet
+     * @return False if the client should be disconnected
+     */
+    bool handlePacket(Client &client, quint8 header, const QByteArray &body) {
+        const auto readId = [&body](int position) {
+            return quint16((quint8(body.at(position)) << 8) | quint8(body.at(position + 1)));
+        };
+        switch (header >> 4) {
+            case Connect:
+                client.socket->write(packet(ConnAck << 4, QByteArray("\x00\x00", 2)));
+                return true;
+            case Publish: {
+                const quint8 qos{quint8((header >> 1) & 0x03)};
+                const int topicLength{readId(0)};
+                const QString topic{QString::fromUtf8(body.mid(2, topicLength))};
+                int position{2 + topicLength};
+                if (qos > 0) {
+                    const quint16 id{readId(position)};
+                    position += 2;
+                    client.socket->write(packet(quint8((qos == 1 ? PubAck : PubRec) << 4), packetId(id)));
+                }
+                publish(topic, body.mid(position), qMin(qos, quint8(1)), header & 0x01);
+                return true;
+            }
+            case PubRel:
+                client.socket->write(packet(PubComp << 4, body.left(2)));
+                return true;
+            case PubAck:
+            case PubComp:
+                return true;
+            case Subscribe: {
+                const quint16 id{readId(0)};
+                QByteArray granted;
+                QVector<QString> newFilters;
+                for (int position = 2; position + 2 < body.size();) {
+                    const int length{readId(position)};
+                    const QString filter{QString::fromUtf8(body.mid(position + 2, length))};
+                    const quint8 qos{qMin(quint8(body.at(position + 2 + length)), quint8(1))};
+                    position += 3 + length;
+                    bool replaced{false};
+                    for (Subscription &subscription : client.subscriptions) {
+                        if (subscription.filter == filter) {
+                            subscription.qos = qos;
+                            replaced = true;
+                        }
+                    }
+                    if (!replaced) {
+                        client.subscriptions << Subscription{filter, qos};
+                    }
+                    newFilters << filter;
+                    granted += char(qos);
+                }
+                client.socket->write(packet(quint8((SubAck << 4)), packetId(id) + granted));
+                for (auto it = retained.constBegin(); it != retained.constEnd(); ++it) {
+                    for (const QString &filter : qAsConst(newFilters)) {
+                        if (TopicRouter::filterMatches(filter, it.key())) {
+                            deliver(client, it.key(), it.value(), 0, true);
+                            break;
+                        }
+                    }
+                }
+                return true;
+            }
+            case Unsubscribe: {
+                for (int position = 2; position + 2 <= body.size();) {
+                    const int length{readId(position)};
+                    const QString filter{QString::fromUtf8(body.mid(position + 2, length))};
+                    position += 2 + length;
+                    for (int index = client.subscriptions.count() - 1; index > -1; --index) {
+                        if (client.subscriptions.at(index).filter == filter) {
+                            client.subscriptions.remove(index);
+                        }
+                    }
+                }
+                client.socket->write(packet(UnsubAck << 4, body.left(2)));
+                return true;
+            }
+            case PingReq:
+                client.socket->write(packet(PingResp << 4, QByteArray{}));
+                return true;
+            case Disconnect:
+            default:
+                return false;
+        }
+    }
+    void handleReadyRead(QTcpSocket *socket) {
+        Client &client{clients[socket]};
+        client.buffer += socket->readAll();
+        while (client.buffer.size() >= 2) {
+            int length{0};
+            int multiplier{1};
+            int position{1};
+            bool complete{false};
+            while (position < client.buffer.size() && position < 5) {
+                const quint8 byte{quint8(client.buffer.at(position++))};
+                length += (byte & 0x7f) * multiplier;
+                multiplier *= 128;
+                if (!(byte & 0x80)) {
+                    complete = true;
+                    break;
+                }
+            }
+            if (!complete || client.buffer.size() < position + length) {
+                return;
+            }
+            const quint8 header{quint8(client.buffer.at(0))};
+            const QByteArray body{client.buffer.mid(position, length)};
+            client.buffer.remove(0, position + length);
+            if (!handlePacket(client, header, body)) {
+                socket->disconnectFromHost();
+                return;
+            }
+        }
+    }
+};
+
+BrokerStandIn::BrokerStandIn(QObject *parent)
+    : QObject(parent)
+    , d(new BrokerStandInPrivate)
+{
+    d->server = new QTcpServer(this);
+    connect(d->server, &QTcpServer::newConnection, this, [this](){
+        while (QTcpSocket *socket = d->server->nextPendingConnection()) {
+            socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+            d->clients[socket].socket = socket;
+            connect(socket, &QTcpSocket::readyRead, this, [this, socket](){ d->handleReadyRead(socket); });
+            connect(socket, &QTcpSocket::disconnected, this, [this, socket](){
+                d->clients.remove(socket);
+                socket->deleteLater();
+            });
+        }
+    });
+}
+
+BrokerStandIn::~BrokerStandIn() = default;
+
+bool BrokerStandIn::listen()
+{
+    return d->server->listen(QHostAddress::LocalHost);
+}
+
+quint16 BrokerStandIn::port() const
+{
+    return d->server->serverPort();
+}
+
+quint64 BrokerStandIn::publishCount() const
+{
+    return d->publishCount;
+}
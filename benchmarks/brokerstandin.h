@@ -0,0 +1,61 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef BROKERSTANDIN_H
+#define BROKERSTANDIN_H
+
+#include <QObject>
+#include <memory>
+
+class BrokerStandInPrivate;
+/**
+ * Just enough of an MQTT 3.1.1 broker to run the service against
+ *
+ * This listens on the loopback interface, on a port picked by the system, and
+ * handles connecting, subscribing (with wildcards), publishing with QoS 0 and
+ * 1, retained messages and keeping the connection alive. Everything is passed
+ * on at QoS 0 or 1, whatever was asked for, and sessions are not kept once a
+ * client disconnects. That is all the benchmarks need, and it keeps the
+ * measurements free of whatever a real broker might be doing.
+ */
+class BrokerStandIn : public QObject
+{
+    Q_OBJECT
+public:
+    explicit BrokerStandIn(QObject *parent = nullptr);
+    ~BrokerStandIn() override;
+
+    /**
+     * Start listening
+     * @return True if the broker is listening
+     */
+    bool listen();
+    /**
+     * The port the broker is listening on
+     */
+    quint16 port() const;
+    /**
+     * How many messages have been published to the broker
+     */
+    quint64 publishCount() const;
+private:
+    std::unique_ptr<BrokerStandInPrivate> d;
+};
+
+#endif//BROKERSTANDIN_H
@@ -0,0 +1,96 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "allocationcounter.h"
+#include "benchmarkreport.h"
+#include "config.h"
+
+#include <QLoggingCategory>
+#include <QTemporaryDir>
+#include <QtTest>
+
+/**
+ * Measures reading the configuration, which is where every topic for every
+ * channel gets put together. This happens at startup and on every reload,
+ * for the largest configuration the service supports.
+ */
+class ConfigBenchmark : public QObject
+{
+    Q_OBJECT
+private:
+    QTemporaryDir directory;
+    QString configFile;
+
+private Q_SLOTS:
+    void initTestCase() {
+        // Reading the configuration logs what it found, which is not what is being measured
+        QLoggingCategory::setFilterRules(QStringLiteral("relayboard.*=false"));
+        QVERIFY(directory.isValid());
+        configFile = directory.filePath(QStringLiteral("relayboard-control.rc"));
+        QFile file(configFile);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        QByteArray contents{"[General]\nmqttHost=localhost\ngpioBackend=simulated\nbatchTopic=home/relays/batch\n"
+                            "[Topics]\ntopicBase=home/relays\n"};
+        for (int bank = 1; bank < 4; ++bank) {
+            contents += "[Bank " + QByteArray::number(bank) + "]\nbackend=simulated\n";
+        }
+        for (int channel = 0; channel < ChannelDefinition::MaxChannels; ++channel) {
+            const QByteArray number{QByteArray::number(channel + 1)};
+            contents += "[Channel " + number + "]\n";
+            if (channel >= 16) {
+                contents += "bank=" + QByteArray::number(channel / 16) + '\n';
+            }
+            contents += "relayLine=" + QByteArray::number(channel % 16) + "\ninputLine=" + QByteArray::number(16 + channel % 16)
+                + "\ntopic=room-" + QByteArray::number(channel / 8) + "/light-" + number + '\n';
+        }
+        for (int scene = 0; scene < 8; ++scene) {
+            contents += "[Scene " + QByteArray::number(scene) + "]\non=1,2,3\noff=4,5,6\ntoggle=7\n";
+        }
+        QVERIFY(file.write(contents) == contents.size());
+    }
+
+    void parse() {
+        QBENCHMARK {
+            Config config(configFile);
+            QVERIFY(config.isValid());
+        }
+    }
+
+    void reload() {
+        Config config(configFile);
+        QBENCHMARK {
+            config.reload();
+        }
+    }
+
+    void allocationsPerParse() {
+        const int rounds{100};
+        const quint64 before{allocationCount()};
+        for (int round = 0; round < rounds; ++round) {
+            Config config(configFile);
+        }
+        const double allocations{double(allocationCount() - before) / rounds};
+        qInfo() << "Allocations per parse of" << ChannelDefinition::MaxChannels << "channels:" << allocations;
+        BenchmarkReport::report(QStringLiteral("config"), QStringLiteral("parse"), {{QStringLiteral("allocationsPerOperation"), allocations}});
+    }
+};
+
+QTEST_GUILESS_MAIN(ConfigBenchmark)
+
+#include "configbenchmark.moc"
@@ -0,0 +1,129 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "allocationcounter.h"
+#include "benchmarkreport.h"
+#include "commandadmission.h"
+#include "monotonicclock.h"
+#include "topicrouter.h"
+
+#include <QtTest>
+
+/**
+ * Measures what happens to a message from the broker before it turns into a
+ * relay pulse: finding the channel and command for its topic, and deciding
+ * whether it is a duplicate or over the rate limit. This is the same work
+ * MqttClient does for every message its subscriptions receive.
+ */
+class DispatchBenchmark : public QObject
+{
+    Q_OBJECT
+private:
+    TopicRouter router;
+    QStringList toggleTopics;
+    QStringList unroutedTopics;
+    // Somewhere for the results to go, so the compiler cannot throw the work away
+    int sink{0};
+
+    void dispatch(const QString &topic, CommandAdmission &admission, quint64 nowNs) {
+        const TopicRouter::Route route{router.route(topic)};
+        if (route.isValid() && admission.admit(route.channel, 0, false, QByteArray{}, nowNs) == CommandAdmission::Accepted) {
+            sink += route.channel + 1;
+        }
+    }
+
+private Q_SLOTS:
+    void initTestCase() {
+        QStringList statusTopics;
+        for (int channel = 0; channel < ChannelDefinition::MaxChannels; ++channel) {
+            const QString base{QStringLiteral("home/room-%1/light-%2/").arg(channel / 8).arg(channel + 1)};
+            toggleTopics << base + QStringLiteral("toggle");
+            statusTopics << base + QStringLiteral("status");
+            unroutedTopics << base + QStringLiteral("brightness");
+            router.addRoute(toggleTopics.last(), channel, TopicRouter::ToggleCommand);
+            router.addRoute(base + QStringLiteral("set"), channel, TopicRouter::SetCommand);
+        }
+        router.addRoute(QStringLiteral("home/batch"), -1, TopicRouter::BatchCommand);
+        router.addReservedTopics(statusTopics);
+        QVERIFY(!router.subscriptionFilters().isEmpty());
+    }
+
+    void route() {
+        QBENCHMARK {
+            for (const QString &topic : qAsConst(toggleTopics)) {
+                sink += router.route(topic).channel;
+            }
+        }
+    }
+
+    void routeUnknown() {
+        QBENCHMARK {
+            for (const QString &topic : qAsConst(unroutedTopics)) {
+                sink += router.route(topic).channel;
+            }
+        }
+    }
+
+    void admit() {
+        CommandAdmission admission;
+        admission.setRateLimit(0, 1);
+        quint64 nowNs{monotonicNowNs()};
+        quint16 packetId{0};
+        QBENCHMARK {
+            for (int channel = 0; channel < ChannelDefinition::MaxChannels; ++channel) {
+                sink += admission.admit(channel, ++packetId, false, QByteArray{}, ++nowNs);
+            }
+        }
+    }
+
+    void admitRateLimited() {
+        // The default limits, with the clock moving on fast enough that nothing is actually limited
+        CommandAdmission admission;
+        admission.setRateLimit(5.0, 10);
+        quint64 nowNs{monotonicNowNs()};
+        QBENCHMARK {
+            for (int channel = 0; channel < ChannelDefinition::MaxChannels; ++channel) {
+                nowNs += 1000000000ULL;
+                sink += admission.admit(channel, 0, false, QByteArray{}, nowNs);
+            }
+        }
+    }
+
+    void allocationsPerDispatch() {
+        CommandAdmission admission;
+        admission.setRateLimit(5.0, 10);
+        const int rounds{1000};
+        quint64 nowNs{monotonicNowNs()};
+        const quint64 before{allocationCount()};
+        for (int round = 0; round < rounds; ++round) {
+            nowNs += 1000000000ULL;
+            for (const QString &topic : qAsConst(toggleTopics)) {
+                dispatch(topic, admission, nowNs);
+            }
+        }
+        const double allocations{double(allocationCount() - before) / (rounds * toggleTopics.count())};
+        qInfo() << "Allocations per dispatched command:" << allocations;
+        BenchmarkReport::report(QStringLiteral("dispatch"), QStringLiteral("toggle"), {{QStringLiteral("allocationsPerOperation"), allocations}});
+        QVERIFY(sink > 0);
+    }
+};
+
+QTEST_GUILESS_MAIN(DispatchBenchmark)
+
+#include "dispatchbenchmark.moc"
@@ -0,0 +1,159 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "allocationcounter.h"
+#include "benchmarkreport.h"
+#include "brokerstandin.h"
+#include "config.h"
+#include "inputhandler.h"
+#include "metrics.h"
+#include "monotonicclock.h"
+#include "mqttclient.h"
+
+#include <QLoggingCategory>
+#include <QTemporaryDir>
+#include <QtMqtt>
+#include <QtTest>
+
+/**
+ * Runs the whole service against a broker stand-in and the simulated relay
+ * board, and measures how long it takes from a toggle being published to the
+ * channel's new state arriving back from the broker. The simulated relays
+ * switch the moment they are energised, and nothing is debounced or batched,
+ * so what is left is the time spent in the service and on the loopback.
+ */
+class EndToEndBenchmark : public QObject
+{
+    Q_OBJECT
+private:
+    static constexpr int ChannelCount{8};
+    static constexpr int RoundTrips{2000};
+    QTemporaryDir directory;
+    BrokerStandIn broker;
+    Config *config{nullptr};
+    InputHandler *inputHandler{nullptr};
+    MqttClient *mqttClient{nullptr};
+    QMqttClient *harness{nullptr};
+    QMqttTopicName toggleTopics[ChannelCount];
+    QString statusTopics[ChannelCount];
+
+    /**
+     * Toggle a channel, and wait for its new state to be published
+     * @return How long it took in nanoseconds, or 0 if the state never arrived
+     */
+    quint64 roundTrip(int channel) {
+        QEventLoop loop;
+        quint64 arrivedNs{0};
+        const QMetaObject::Connection connection{connect(harness, &QMqttClient::messageReceived, &loop, [&](const QByteArray &, const QMqttTopicName &topic){
+            if (topic.name() == statusTopics[channel]) {
+                arrivedNs = monotonicNowNs();
+                loop.quit();
+            }
+        })};
+        QTimer::singleShot(1000, &loop, &QEventLoop::quit);
+        const quint64 sentNs{monotonicNowNs()};
+        harness->publish(toggleTopics[channel], QByteArrayLiteral("toggle"));
+        loop.exec();
+        disconnect(connection);
+        return arrivedNs > 0 ? arrivedNs - sentNs : 0;
+    }
+
+private Q_SLOTS:
+    void initTestCase() {
+        QLoggingCategory::setFilterRules(QStringLiteral("relayboard.*.debug=false"));
+        QVERIFY(directory.isValid());
+        QVERIFY(broker.listen());
+        const QString configFile{directory.filePath(QStringLiteral("relayboard-control.rc"))};
+        QFile file(configFile);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        QByteArray contents{"[General]\nmqttHost=127.0.0.1\nmqttPort=" + QByteArray::number(broker.port()) + "\n"
+                            "mqttClientId=relayboard-benchmark\ngpioBackend=simulated\n"
+                            "debounceMode=none\npublishBatchWindow=0\ncommandRate=0\npulseWidth=1\nrestTime=1\n"
+                            "stateFile=\ncontrolSocket=\n"
+                            "[Simulation]\nrelayDelay=0\n"
+                            "[Topics]\ntopicBase=benchmark\n"};
+        for (int channel = 0; channel < ChannelCount; ++channel) {
+            contents += "topic-" + QByteArray::number(channel + 1) + "=light-" + QByteArray::number(channel + 1) + '\n';
+            toggleTopics[channel] = QMqttTopicName{QStringLiteral("benchmark/light-%1/toggle").arg(channel + 1)};
+            statusTopics[channel] = QStringLiteral("benchmark/light-%1/status").arg(channel + 1);
+        }
+        QVERIFY(file.write(contents) == contents.size());
+        file.close();
+
+        config = new Config(configFile, this);
+        QVERIFY(config->isValid());
+        inputHandler = new InputHandler(config, this);
+        QVERIFY(inputHandler->isReady());
+        mqttClient = new MqttClient(config, inputHandler);
+        mqttClient->start();
+
+        harness = new QMqttClient(this);
+        harness->setHostname(QStringLiteral("127.0.0.1"));
+        harness->setPort(broker.port());
+        harness->connectToHost();
+        QTRY_COMPARE(harness->state(), QMqttClient::Connected);
+        QVERIFY(harness->subscribe(QMqttTopicFilter{QStringLiteral("benchmark/+/status")}, 0));
+        // Give the service time to subscribe, and the retained states time to arrive
+        QTest::qWait(500);
+    }
+
+    void cleanupTestCase() {
+        mqttClient->stop();
+        harness->disconnectFromHost();
+    }
+
+    void toggleRoundTrip() {
+        // Get everything warmed up, including the allocations QtMqtt makes on first use
+        for (int round = 0; round < 100; ++round) {
+            QVERIFY(roundTrip(round % ChannelCount) > 0);
+        }
+        QVector<quint64> latencies;
+        latencies.reserve(RoundTrips);
+        const quint64 commandsBefore{Metrics::instance().histogram(Metrics::CommandToRelay).count()};
+        const quint64 allocationsBefore{allocationCount()};
+        for (int round = 0; round < RoundTrips; ++round) {
+            const quint64 latency{roundTrip(round % ChannelCount)};
+            QVERIFY2(latency > 0, "The state of a toggled channel was never published");
+            latencies << latency;
+        }
+        // This includes the allocations made by the harness publishing and receiving
+        const double allocations{double(allocationCount() - allocationsBefore) / RoundTrips};
+
+        QJsonObject roundTrips{{QStringLiteral("allocationsPerOperation"), allocations}};
+        BenchmarkReport::addPercentiles(roundTrips, latencies);
+        BenchmarkReport::report(QStringLiteral("endtoend"), QStringLiteral("toggleRoundTrip"), roundTrips);
+        // From the service's own histograms, which only have the resolution of their buckets
+        const LatencyHistogram &commandToRelay{Metrics::instance().histogram(Metrics::CommandToRelay)};
+        const LatencyHistogram &edgeToPublish{Metrics::instance().histogram(Metrics::EdgeToPublish)};
+        BenchmarkReport::report(QStringLiteral("endtoend"), QStringLiteral("messageToPulse"), {
+            {QStringLiteral("samples"), double(commandToRelay.count() - commandsBefore)},
+            {QStringLiteral("p50Us"), double(commandToRelay.quantileUs(0.5))},
+            {QStringLiteral("p99Us"), double(commandToRelay.quantileUs(0.99))},
+        });
+        BenchmarkReport::report(QStringLiteral("endtoend"), QStringLiteral("edgeToPublish"), {
+            {QStringLiteral("p50Us"), double(edgeToPublish.quantileUs(0.5))},
+            {QStringLiteral("p99Us"), double(edgeToPublish.quantileUs(0.99))},
+        });
+        QCOMPARE(Metrics::instance().counter(Metrics::PublishFailures), quint64(0));
+    }
+};
+
+QTEST_GUILESS_MAIN(EndToEndBenchmark)
+
+#include "endtoendbenchmark.moc"
@@ -0,0 +1,615 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "benchmarkreport.h"
+#include "brokerstandin.h"
+#include "config.h"
+#include "inputhandler.h"
+#include "metrics.h"
+#include "monotonicclock.h"
+#include "mqttclient.h"
+#include "trafficrecording.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QFile>
+#include <QJsonDocument>
+#include <QLoggingCategory>
+#include <QRandomGenerator>
+#include <QTemporaryDir>
+#include <QTimer>
+#include <QtMath>
+#include <QtMqtt>
+
+#include <KConfig>
+#include <KConfigGroup>
+
+#include <algorithm>
+#include <deque>
+#include <unistd.h>
+
+/**
+ * What the load generator was asked to do, from the command line
+ */
+struct LoadOptions {
+    enum Mode {
+        RecordMode,
+        ReplayMode,
+        SynthesiseMode,
+    };
+    Mode mode{SynthesiseMode};
+    QString file;
+    QString configFile;
+    QString host{QStringLiteral("localhost")};
+    quint16 port{1883};
+    bool inProcess{false};
+    bool mqtt5{false};
+    int messageExpiryS{0};
+    QStringList filters;
+    double rate{10};
+    QString distribution{QStringLiteral("uniform")};
+    double zipfExponent{1.0};
+    double batchRatio{0};
+    double speed{1};
+    bool loop{false};
+    int qos{1};
+    int durationS{60};
+    int reportIntervalS{10};
+    int statusTimeoutMs{5000};
+    QString statsTopic;
+    qint64 pid{0};
+};
+
+/**
+ * Drives the service with recorded or synthesised commands, and measures how it copes
+ *
+ * Every toggle sent is matched up with the next state published for the same
+ * channel, which gives the latency from command to published state. A toggle
+ * which sees no state within the timeout is counted as unanswered, which is
+ * expected when toggles on a channel arrive faster than the batch window,
+ * as changes which cancel out are never published. Whether the service
+ * actually dropped or duplicated anything is worked out from its own pulse
+ * counters, read directly when it runs in-process, or from its stats topic.
+ *
+ * With MQTT 5, every command carries the time it was sent as both its ID and
+ * its timestamp, and the service hands the ID back with the state it caused,
+ * so the latency is exact rather than matched up in order.
+ */
+class LoadGenerator : public QObject
+{
+    Q_OBJECT
+public:
+    explicit LoadGenerator(const LoadOptions &options, QObject *parent = nullptr)
+        : QObject(parent)
+        , options(options)
+    {}
+
+    bool start() {
+        if (!options.configFile.isEmpty() && !loadTopics()) {
+            return false;
+        }
+        if (options.mqtt5 && options.inProcess) {
+            qWarning() << "The broker stand-in only speaks MQTT 3.1.1, so MQTT 5 needs a real broker";
+            return false;
+        }
+#ifndef HAVE_MQTT5
+        if (options.mqtt5) {
+            qWarning() << "MQTT 5 needs QtMqtt 5.12 or later, which this was not built with";
+            return false;
+        }
+#endif
+        if (options.inProcess && !startService()) {
+            return false;
+        }
+        if (options.mode == LoadOptions::RecordMode) {
+            if (!recorder.open(options.file)) {
+                qWarning() << "Failed to open" << options.file << "for recording:" << recorder.errorString();
+                return false;
+            }
+        } else if (options.mode == LoadOptions::ReplayMode) {
+            if (!reader.open(options.file)) {
+                qWarning() << "Failed to open the recording" << options.file << ":" << reader.errorString();
+                return false;
+            }
+        } else if (toggleTopics.isEmpty()) {
+            qWarning() << "Synthesising traffic needs a configuration file to take the topics from";
+            return false;
+        }
+
+        client = new QMqttClient(this);
+        client->setHostname(options.host);
+        client->setPort(options.port);
+        client->setClientId(QStringLiteral("relayboard-loadgen-%1").arg(getpid()));
+#ifdef HAVE_MQTT5
+        if (options.mqtt5) {
+            client->setProtocolVersion(QMqttClient::MQTT_5_0);
+        }
+#endif
+        connect(client, &QMqttClient::connected, this, [this](){ handleConnected(); });
+        connect(client, &QMqttClient::disconnected, this, [](){
+            qWarning() << "Lost the connection to the broker";
+        });
+        client->connectToHost();
+        return true;
+    }
+
+private:
+    LoadOptions options;
+    QTemporaryDir serviceDirectory;
+    BrokerStandIn *broker{nullptr};
+    Config *serviceConfig{nullptr};
+    InputHandler *inputHandler{nullptr};
+    MqttClient *mqttClient{nullptr};
+    QMqttClient *client{nullptr};
+
+    // The channels, as the service sees them
+    QVector<QMqttTopicName> toggleTopics;
+    QHash<QString, int> statusChannels;
+    QMqttTopicName batchTopic;
+    QVector<double> cumulativeWeights;
+
+    // When each toggle still waiting for its state to be published was sent
+    std::deque<quint64> pendingToggles[ChannelDefinition::MaxChannels];
+    quint64 startNs{0};
+    quint64 commandsSent{0};
+    quint64 togglesSent{0};
+    quint64 statesReceived{0};
+    quint64 unanswered{0};
+    LatencyHistogram latencies;
+    QVector<quint64> intervalLatencies;
+    bool finishing{false};
+
+    // The service's own counters, when it was started, and the latest ones
+    QJsonObject firstStats;
+    QJsonObject lastStats;
+
+    TrafficRecorder recorder;
+    quint64 recorded{0};
+    TrafficReader reader;
+    RecordedMessage nextMessage;
+    bool hasNextMessage{false};
+    quint64 replayStartNs{0};
+    quint64 replayOffsetUs{0};
+
+    QTimer *sendTimer{nullptr};
+
+    bool loadTopics() {
+        const Config config(options.configFile);
+        const QList<ChannelDefinition> channels{config.channels()};
+        for (int channel = 0; channel < channels.count(); ++channel) {
+            toggleTopics << QMqttTopicName{channels.at(channel).toggleTopic};
+            statusChannels.insert(channels.at(channel).statusTopic, channel);
+        }
+        batchTopic = QMqttTopicName{config.batchTopic()};
+        if (options.statsTopic.isEmpty()) {
+            options.statsTopic = config.statsTopic();
+        }
+        // Picking a channel is a binary search through the cumulative weights
+        double total{0};
+        for (int channel = 0; channel < channels.count(); ++channel) {
+            total += options.distribution == QLatin1String("zipf") ? 1.0 / qPow(channel + 1, options.zipfExponent) : 1.0;
+            cumulativeWeights << total;
+        }
+        return true;
+    }
+    bool startService() {
+        if (options.configFile.isEmpty()) {
+            qWarning() << "Running the service in-process needs a configuration file";
+            return false;
+        }
+        broker = new BrokerStandIn(this);
+        if (!broker->listen()) {
+            qWarning() << "Failed to start the broker stand-in";
+            return false;
+        }
+        options.host = QStringLiteral("127.0.0.1");
+        options.port = broker->port();
+        // The service gets a copy of the configuration, pointed at the stand-in and the simulated board
+        const QString configFile{serviceDirectory.filePath(QStringLiteral("relayboard-control.rc"))};
+        QFile::copy(options.configFile, configFile);
+        QFile::setPermissions(configFile, QFile::ReadOwner | QFile::WriteOwner);
+        {
+            KConfig configWriter(configFile, KConfig::SimpleConfig);
+            KConfigGroup general{configWriter.group("General")};
+            general.writeEntry("mqttHost", options.host);
+            general.writeEntry("mqttPort", int(options.port));
+            general.writeEntry("gpioBackend", "simulated");
+            general.writeEntry("stateFile", QString{});
+            general.writeEntry("controlSocket", QString{});
+            general.writeEntry("mqttVersion", "3.1.1");
+            for (const QString &groupName : configWriter.groupList()) {
+                if (groupName.startsWith(QLatin1String("Bank "))) {
+                    configWriter.group(groupName).writeEntry("backend", "simulated");
+                }
+            }
+            configWriter.sync();
+        }
+        serviceConfig = new Config(configFile, this);
+        inputHandler = new InputHandler(serviceConfig, this);
+        if (!serviceConfig->isValid() || !inputHandler->isReady()) {
+            qWarning() << "Failed to start the service with the configuration from" << options.configFile;
+            return false;
+        }
+        mqttClient = new MqttClient(serviceConfig, inputHandler);
+        mqttClient->start();
+        firstStats = Metrics::instance().summary();
+        return true;
+    }
+
+    void handleConnected() {
+        if (startNs > 0) {
+            return;
+        }
+        startNs = monotonicNowNs();
+        if (options.mode == LoadOptions::RecordMode) {
+            const QStringList filters{options.filters.isEmpty() ? QStringList{QStringLiteral("#")} : options.filters};
+            for (const QString &filter : filters) {
+                QMqttSubscription *subscription{client->subscribe(QMqttTopicFilter{filter}, quint8(options.qos))};
+                connect(subscription, &QMqttSubscription::messageReceived, this, [this](const QMqttMessage &message){
+                    recorder.write(RecordedMessage{(monotonicNowNs() - startNs) / 1000, message.topic().name(), message.payload(), message.qos(), message.retain()});
+                    ++recorded;
+                });
+            }
+            qInfo() << "Recording" << filters << "to" << options.file;
+        } else {
+            for (auto it = statusChannels.constBegin(); it != statusChannels.constEnd(); ++it) {
+                QMqttSubscription *subscription{client->subscribe(QMqttTopicFilter{it.key()}, 0)};
+                connect(subscription, &QMqttSubscription::messageReceived, this, [this](const QMqttMessage &message){
+                    // Retained states are from before we started
+                    if (!message.retain()) {
+                        handleState(statusChannels.value(message.topic().name(), -1), commandId(message));
+                    }
+                });
+            }
+            if (!options.statsTopic.isEmpty() && !options.inProcess) {
+                QMqttSubscription *subscription{client->subscribe(QMqttTopicFilter{options.statsTopic}, 0)};
+                connect(subscription, &QMqttSubscription::messageReceived, this, [this](const QMqttMessage &message){
+                    lastStats = QJsonDocument::fromJson(message.payload()).object();
+                    if (firstStats.isEmpty()) {
+                        firstStats = lastStats;
+                    }
+                });
+            }
+            sendTimer = new QTimer(this);
+            sendTimer->setTimerType(Qt::PreciseTimer);
+            if (options.mode == LoadOptions::ReplayMode) {
+                sendTimer->setSingleShot(true);
+                connect(sendTimer, &QTimer::timeout, this, [this](){ replay(); });
+                replayStartNs = monotonicNowNs();
+                hasNextMessage = reader.read(nextMessage);
+                replay();
+            } else {
+                connect(sendTimer, &QTimer::timeout, this, [this](){ synthesise(); });
+                sendTimer->start(1);
+            }
+        }
+
+        QTimer *reportTimer{new QTimer(this)};
+        connect(reportTimer, &QTimer::timeout, this, [this](){ report(QStringLiteral("interval")); });
+        reportTimer->start(options.reportIntervalS * 1000);
+        if (options.durationS > 0) {
+            QTimer::singleShot(options.durationS * 1000, this, [this](){ finish(); });
+        }
+    }
+
+    int pickChannel() {
+        const double pick{QRandomGenerator::global()->generateDouble() * cumulativeWeights.last()};
+        return int(std::upper_bound(cumulativeWeights.constBegin(), cumulativeWeights.constEnd(), pick) - cumulativeWeights.constBegin());
+    }
+    void sendToggle(int channel) {
+        if (channel < 0 || channel >= toggleTopics.count() || !toggleTopics.at(channel).isValid()) {
+            return;
+        }
+        const quint64 sentNs{monotonicNowNs()};
+        publishCommand(toggleTopics.at(channel), QByteArrayLiteral("toggle"), sentNs);
+        pendingToggles[channel].push_back(sentNs);
+        ++commandsSent;
+        ++togglesSent;
+    }
+    void sendBatch() {
+        // Two channels toggled together, which may turn out to be the same one
+        const int first{pickChannel()};
+        const int second{pickChannel()};
+        QJsonObject changes;
+        changes.insert(QString::number(first + 1), QStringLiteral("toggle"));
+        changes.insert(QString::number(second + 1), QStringLiteral("toggle"));
+        const quint64 sentNs{monotonicNowNs()};
+        publishCommand(batchTopic, QJsonDocument(changes).toJson(QJsonDocument::Compact), sentNs);
+        ++commandsSent;
+        for (int channel : changes.keys().count() == 1 ? QVector<int>{first} : QVector<int>{first, second}) {
+            pendingToggles[channel].push_back(sentNs);
+            ++togglesSent;
+        }
+    }
+    void synthesise() {
+        if (finishing) {
+            return;
+        }
+        // However late the timer fires, the rate works out right over time
+        const quint64 due{quint64(double(monotonicNowNs() - startNs) / 1e9 * options.rate)};
+        while (commandsSent < due) {
+            if (batchTopic.isValid() && QRandomGenerator::global()->generateDouble() < options.batchRatio) {
+                sendBatch();
+            } else {
+                sendToggle(pickChannel());
+            }
+        }
+    }
+    void replay() {
+        while (hasNextMessage && !finishing) {
+            const quint64 dueNs{replayStartNs + quint64(double(nextMessage.timeUs - replayOffsetUs) * 1000.0 / options.speed)};
+            const quint64 nowNs{monotonicNowNs()};
+            if (dueNs > nowNs) {
+                sendTimer->start(int((dueNs - nowNs) / 1000000));
+                return;
+            }
+            // The states the service publishes are its business, and retained messages were there before the recording
+            if (!nextMessage.retain && !statusChannels.contains(nextMessage.topic)) {
+                const int channel{toggleTopics.indexOf(QMqttTopicName{nextMessage.topic})};
+                if (channel > -1) {
+                    sendToggle(channel);
+                } else {
+                    publishCommand(QMqttTopicName{nextMessage.topic}, nextMessage.payload, monotonicNowNs());
+                    ++commandsSent;
+                }
+            }
+            hasNextMessage = reader.read(nextMessage);
+            if (!hasNextMessage && options.loop) {
+                reader.rewind();
+                replayStartNs = monotonicNowNs();
+                replayOffsetUs = 0;
+                hasNextMessage = reader.read(nextMessage);
+                if (hasNextMessage) {
+                    replayOffsetUs = nextMessage.timeUs;
+                }
+            }
+        }
+        if (!hasNextMessage && !finishing) {
+            qInfo() << "Reached the end of the recording";
+            finish();
+        }
+    }
+    void publishCommand(const QMqttTopicName &topic, const QByteArray &payload, quint64 sentNs) {
+#ifdef HAVE_MQTT5
+        if (options.mqtt5) {
+            QMqttPublishProperties properties;
+            QMqttUserProperties userProperties;
+            userProperties.append(QMqttStringPair(QStringLiteral("id"), QString::number(sentNs)));
+            userProperties.append(QMqttStringPair(QStringLiteral("timestamp"), QString::number(QDateTime::currentMSecsSinceEpoch())));
+            properties.setUserProperties(userProperties);
+            if (options.messageExpiryS > 0) {
+                properties.setMessageExpiryInterval(quint32(options.messageExpiryS));
+            }
+            client->publish(topic, properties, payload, quint8(options.qos));
+            return;
+        }
+#endif
+        client->publish(topic, payload, quint8(options.qos));
+    }
+    /**
+     * The ID of the command which caused a state, which is when it was sent, or 0 if the service did not say
+     */
+    static quint64 commandId(const QMqttMessage &message) {
+#ifdef HAVE_MQTT5
+        const QMqttUserProperties userProperties{message.publishProperties().userProperties()};
+        for (const QMqttStringPair &property : userProperties) {
+            if (property.name() == QLatin1String("commandId")) {
+                return property.value().toULongLong();
+            }
+        }
+#else
+        Q_UNUSED(message)
+#endif
+        return 0;
+    }
+    void handleState(int channel, quint64 sentNs) {
+        if (channel < 0) {
+            return;
+        }
+        ++statesReceived;
+        const quint64 nowNs{monotonicNowNs()};
+        std::deque<quint64> &pending{pendingToggles[channel]};
+        expire(pending, nowNs);
+        if (sentNs > 0 && std::find(pending.begin(), pending.end(), sentNs) != pending.end()) {
+            // The toggles before the one the state came from were folded into it
+            while (pending.front() != sentNs) {
+                pending.pop_front();
+                ++unanswered;
+            }
+        }
+        if (!pending.empty()) {
+            const quint64 latencyNs{nowNs - pending.front()};
+            pending.pop_front();
+            latencies.record(latencyNs);
+            intervalLatencies << latencyNs;
+        }
+    }
+    void expire(std::deque<quint64> &pending, quint64 nowNs) {
+        const quint64 timeoutNs{quint64(options.statusTimeoutMs) * 1000000ULL};
+        while (!pending.empty() && nowNs - pending.front() > timeoutNs) {
+            pending.pop_front();
+            ++unanswered;
+        }
+    }
+    static qint64 rssKb(qint64 pid) {
+        QFile status(pid > 0 ? QStringLiteral("/proc/%1/status").arg(pid) : QStringLiteral("/proc/self/status"));
+        if (status.open(QIODevice::ReadOnly)) {
+            for (const QByteArray &line : status.readAll().split('\n')) {
+                if (line.startsWith("VmRSS:")) {
+                    return line.mid(6).trimmed().split(' ').first().toLongLong();
+                }
+            }
+        }
+        return -1;
+    }
+    void addServiceCounters(QJsonObject &values) {
+        if (options.inProcess) {
+            lastStats = Metrics::instance().summary();
+        }
+        if (firstStats.isEmpty() || lastStats.isEmpty()) {
+            return;
+        }
+        const auto delta = [this](const char *name) {
+            const QString key{QString::fromLatin1(name)};
+            return qint64(lastStats.value(key).toDouble() - firstStats.value(key).toDouble());
+        };
+        const qint64 pulses{delta("pulses_scheduled")};
+        const qint64 rateLimited{delta("rate_limited_commands")};
+        const qint64 duplicates{delta("duplicate_commands")};
+        // Toggles still on their way are neither dropped nor duplicated
+        qint64 inFlight{0};
+        for (const std::deque<quint64> &pending : pendingToggles) {
+            inFlight += qint64(pending.size());
+        }
+        const qint64 accountedFor{pulses + rateLimited + duplicates};
+        values.insert(QStringLiteral("pulses"), double(pulses));
+        values.insert(QStringLiteral("rateLimited"), double(rateLimited));
+        values.insert(QStringLiteral("duplicates"), double(duplicates));
+        values.insert(QStringLiteral("dropped"), double(qMax(qint64(0), qint64(togglesSent) - accountedFor - inFlight)));
+        values.insert(QStringLiteral("duplicated"), double(qMax(qint64(0), accountedFor - qint64(togglesSent))));
+    }
+    void report(const QString &measurement) {
+        const double elapsedS{double(monotonicNowNs() - startNs) / 1e9};
+        QJsonObject values;
+        values.insert(QStringLiteral("elapsedS"), elapsedS);
+        values.insert(QStringLiteral("rssKb"), double(rssKb(options.inProcess ? 0 : options.pid)));
+        if (options.mode == LoadOptions::RecordMode) {
+            recorder.flush();
+            values.insert(QStringLiteral("recorded"), double(recorded));
+        } else {
+            const quint64 nowNs{monotonicNowNs()};
+            for (std::deque<quint64> &pending : pendingToggles) {
+                expire(pending, nowNs);
+            }
+            values.insert(QStringLiteral("commandsSent"), double(commandsSent));
+            values.insert(QStringLiteral("commandsPerSecond"), elapsedS > 0 ? double(commandsSent) / elapsedS : 0.0);
+            values.insert(QStringLiteral("statesReceived"), double(statesReceived));
+            values.insert(QStringLiteral("unanswered"), double(unanswered));
+            if (measurement == QLatin1String("summary")) {
+                values.insert(QStringLiteral("samples"), double(latencies.count()));
+                values.insert(QStringLiteral("p50Us"), double(latencies.quantileUs(0.5)));
+                values.insert(QStringLiteral("p99Us"), double(latencies.quantileUs(0.99)));
+            } else {
+                BenchmarkReport::addPercentiles(values, intervalLatencies);
+                intervalLatencies.clear();
+            }
+            addServiceCounters(values);
+        }
+        BenchmarkReport::report(QStringLiteral("loadgen"), measurement, values);
+    }
+    void finish() {
+        if (finishing) {
+            return;
+        }
+        finishing = true;
+        if (sendTimer) {
+            sendTimer->stop();
+        }
+        // Give the last few states time to come back before totting everything up
+        QTimer::singleShot(options.mode == LoadOptions::RecordMode ? 0 : options.statusTimeoutMs, this, [this](){
+            report(QStringLiteral("summary"));
+            if (mqttClient) {
+                mqttClient->stop();
+            }
+            client->disconnectFromHost();
+            qApp->quit();
+        });
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("relayboard-loadgen"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Records, replays and synthesises MQTT traffic for relayboard-control, and measures how the service copes with it"));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("mode"), QStringLiteral("record, replay or synthesise"));
+    parser.addPositionalArgument(QStringLiteral("file"), QStringLiteral("The recording to write or replay"), QStringLiteral("[file]"));
+    const QCommandLineOption configOption{QStringLiteral("config"), QStringLiteral("The service's configuration file, to take the topics from"), QStringLiteral("file")};
+    const QCommandLineOption hostOption{QStringLiteral("host"), QStringLiteral("The broker to connect to"), QStringLiteral("host"), QStringLiteral("localhost")};
+    const QCommandLineOption portOption{QStringLiteral("port"), QStringLiteral("The port of the broker"), QStringLiteral("port"), QStringLiteral("1883")};
+    const QCommandLineOption inProcessOption{QStringLiteral("in-process"), QStringLiteral("Run the service in this process, against a broker stand-in and the simulated relay board")};
+    const QCommandLineOption filterOption{QStringLiteral("filter"), QStringLiteral("A topic filter to record (can be given more than once, default #)"), QStringLiteral("filter")};
+    const QCommandLineOption rateOption{QStringLiteral("rate"), QStringLiteral("Commands per second to synthesise"), QStringLiteral("rate"), QStringLiteral("10")};
+    const QCommandLineOption distributionOption{QStringLiteral("distribution"), QStringLiteral("How commands are spread across the channels: uniform or zipf"), QStringLiteral("name"), QStringLiteral("uniform")};
+    const QCommandLineOption zipfOption{QStringLiteral("zipf-exponent"), QStringLiteral("The exponent of the zipf distribution"), QStringLiteral("exponent"), QStringLiteral("1.0")};
+    const QCommandLineOption batchOption{QStringLiteral("batch-ratio"), QStringLiteral("The share of synthesised commands sent to the batch topic, between 0 and 1"), QStringLiteral("ratio"), QStringLiteral("0")};
+    const QCommandLineOption speedOption{QStringLiteral("speed"), QStringLiteral("How much faster than recorded to replay"), QStringLiteral("factor"), QStringLiteral("1")};
+    const QCommandLineOption loopOption{QStringLiteral("loop"), QStringLiteral("Start the recording over when it runs out")};
+    const QCommandLineOption qosOption{QStringLiteral("qos"), QStringLiteral("The QoS to publish and record with"), QStringLiteral("qos"), QStringLiteral("1")};
+    const QCommandLineOption durationOption{QStringLiteral("duration"), QStringLiteral("How long to run for in seconds, or 0 until stopped"), QStringLiteral("seconds"), QStringLiteral("60")};
+    const QCommandLineOption reportOption{QStringLiteral("report-interval"), QStringLiteral("How often to report, in seconds"), QStringLiteral("seconds"), QStringLiteral("10")};
+    const QCommandLineOption timeoutOption{QStringLiteral("status-timeout"), QStringLiteral("How long to wait for a toggled channel's state, in milliseconds"), QStringLiteral("ms"), QStringLiteral("5000")};
+    const QCommandLineOption statsOption{QStringLiteral("stats-topic"), QStringLiteral("The service's stats topic, to count its pulses (default from the configuration)"), QStringLiteral("topic")};
+    const QCommandLineOption mqtt5Option{QStringLiteral("mqtt5"), QStringLiteral("Use MQTT 5, sending every command with its ID and the time it was sent")};
+    const QCommandLineOption expiryOption{QStringLiteral("message-expiry"), QStringLiteral("With MQTT 5, how long the broker holds on to a command before dropping it, in seconds"), QStringLiteral("seconds"), QStringLiteral("0")};
+    const QCommandLineOption pidOption{QStringLiteral("pid"), QStringLiteral("The process ID of the service, to follow its memory use"), QStringLiteral("pid")};
+    parser.addOptions({configOption, hostOption, portOption, inProcessOption, filterOption, rateOption, distributionOption, zipfOption,
+                       batchOption, speedOption, loopOption, qosOption, durationOption, reportOption, timeoutOption, statsOption, mqtt5Option, expiryOption, pidOption});
+    parser.process(app);
+
+    LoadOptions options;
+    const QStringList arguments{parser.positionalArguments()};
+    const QString mode{arguments.value(0)};
+    if (mode == QLatin1String("record")) {
+        options.mode = LoadOptions::RecordMode;
+    } else if (mode == QLatin1String("replay")) {
+        options.mode = LoadOptions::ReplayMode;
+    } else if (mode == QLatin1String("synthesise")) {
+        options.mode = LoadOptions::SynthesiseMode;
+    } else {
+        parser.showHelp(1);
+    }
+    options.file = arguments.value(1);
+    if (options.mode != LoadOptions::SynthesiseMode && options.file.isEmpty()) {
+        parser.showHelp(1);
+    }
+    options.configFile = parser.value(configOption);
+    options.host = parser.value(hostOption);
+    options.port = quint16(parser.value(portOption).toUInt());
+    options.inProcess = parser.isSet(inProcessOption);
+    options.filters = parser.values(filterOption);
+    options.rate = qMax(0.0, parser.value(rateOption).toDouble());
+    options.distribution = parser.value(distributionOption);
+    options.zipfExponent = parser.value(zipfOption).toDouble();
+    options.batchRatio = qBound(0.0, parser.value(batchOption).toDouble(), 1.0);
+    options.speed = qMax(0.001, parser.value(speedOption).toDouble());
+    options.loop = parser.isSet(loopOption);
+    options.qos = qBound(0, parser.value(qosOption).toInt(), 2);
+    options.durationS = qMax(0, parser.value(durationOption).toInt());
+    options.reportIntervalS = qMax(1, parser.value(reportOption).toInt());
+    options.statusTimeoutMs = qMax(1, parser.value(timeoutOption).toInt());
+    options.statsTopic = parser.value(statsOption);
+    options.mqtt5 = parser.isSet(mqtt5Option);
+    options.messageExpiryS = qMax(0, parser.value(expiryOption).toInt());
+    options.pid = parser.value(pidOption).toLongLong();
+
+    // The in-process service's informational messages would drown out the reports
+    QLoggingCategory::setFilterRules(QStringLiteral("relayboard.*.info=false\nrelayboard.*.debug=false"));
+    LoadGenerator generator(options);
+    if (!generator.start()) {
+        return 1;
+    }
+    return app.exec();
+}
+
+#include "loadgenerator.moc"
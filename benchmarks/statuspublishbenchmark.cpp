@@ -0,0 +1,195 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "allocationcounter.h"
+#include "benchmarkreport.h"
+#include "channelstatetable.h"
+#include "logging.h"
+#include "statuspublishtable.h"
+
+#include <QMetaEnum>
+#include <QtTest>
+
+/**
+ * Compares the status publish path from before the publish table (which worked
+ * out the topic and payload from scratch for every state change) with the
+ * table lookup which replaced it, and then the whole of what the client does
+ * to get a batch of changes ready to publish. The publish itself is left out,
+ * as that is QtMqtt's business, so this measures only what happens on our
+ * side of it, including the debug logging the client does along the way.
+ */
+class StatusPublishBenchmark : public QObject
+{
+    Q_OBJECT
+public:
+    // The same values as InputHandler::InputChannel, as the old path depended on the names
+    enum InputChannel {
+        InputChannelInvalid = 0,
+        InputChannel1 = 2,
+        InputChannel2 = 3,
+        InputChannel3 = 4,
+        InputChannel4 = 17,
+        InputChannel5 = 27,
+        InputChannel6 = 22,
+        InputChannel7 = 10,
+        InputChannel8 = 9,
+    };
+    Q_ENUM(InputChannel)
+
+private:
+    const QList<InputChannel> channels{InputChannel1, InputChannel2, InputChannel3, InputChannel4,
+                                       InputChannel5, InputChannel6, InputChannel7, InputChannel8};
+    QStringList statusTopics;
+    StatusPublishTable table;
+    int channelIndex[64]{};
+    const QString onState{QStringLiteral("on")};
+    const QString offState{QStringLiteral("off")};
+    ChannelStateTable states;
+    // What the broker was last told, as MqttClient keeps track of it
+    quint64 publishedStates{0};
+    quint64 publishedKnown{0};
+    // Somewhere for the results to go, so the compiler cannot throw the work away
+    quint64 sink{0};
+
+    void publish(const QMqttTopicName &topic, const QByteArray &payload) {
+        sink += quint64(topic.name().size() + payload.size());
+    }
+
+    void legacyStateChange(InputChannel channel, const QString &updatedState) {
+        static const QMetaEnum theEnum = QMetaEnum::fromType<InputChannel>();
+        QString theKey{QString::fromLatin1(theEnum.valueToKey(channel))};
+        theKey = theKey.remove(0, 12);
+        int channelNumber = theKey.toInt();
+        if (channelNumber > 0 && channelNumber <= statusTopics.count()) {
+            const QString topicToUpdate{statusTopics.value(channelNumber - 1)};
+            publish(QMqttTopicName{topicToUpdate}, updatedState.toLatin1());
+        }
+    }
+
+    void tableStateChange(InputChannel channel, const QString &updatedState) {
+        // Channels are now reported by their position, rather than their input line
+        const QMqttTopicName &topic{table.topic(channelIndex[channel])};
+        if (topic.isValid()) {
+            publish(topic, StatusPublishTable::payload(updatedState == onState));
+            qCDebug(RELAYBOARD_MQTT) << "Published the states of" << 1 << "channels";
+        }
+    }
+
+    /**
+     * MqttClient's flush of the pending channels, up to the publish: a snapshot
+     * of the state table, and then the same StatusPublishTable::publishChanged
+     * the client goes through to pick out and publish the channels which differ
+     */
+    void flushPending(quint64 pendingChannels) {
+        ChannelStateSnapshot snapshot;
+        states.snapshot(snapshot, channels.count());
+        int published{0};
+        table.publishChanged(snapshot, pendingChannels, publishedStates, publishedKnown, [this, &published](int, const QMqttTopicName &topic, bool on){
+            publish(topic, StatusPublishTable::payload(on));
+            ++published;
+            return true;
+        });
+        if (published > 0) {
+            qCDebug(RELAYBOARD_MQTT) << "Published the states of" << published << "channels";
+        }
+    }
+
+    template<typename Function>
+    quint64 countAllocations(Function function) {
+        const quint64 before{allocationCount()};
+        for (int round = 0; round < 1000; ++round) {
+            for (InputChannel channel : channels) {
+                function(channel, (round % 2) ? onState : offState);
+            }
+        }
+        return allocationCount() - before;
+    }
+
+    static void discardMessage(QtMsgType, const QMessageLogContext &, const QString &) {}
+
+private Q_SLOTS:
+    void initTestCase() {
+        // Logging as the service does by default, where the debug messages are filtered out
+        AsyncLogSink::setFilter(QStringLiteral("info"), QString{});
+        for (int index = 0; index < channels.count(); ++index) {
+            statusTopics << QStringLiteral("some/mqtt/topic/channel-%1/status").arg(index + 1);
+            table.setTopic(index, statusTopics.last());
+            channelIndex[channels.at(index)] = index;
+        }
+    }
+
+    void legacyPublish() {
+        QBENCHMARK {
+            for (InputChannel channel : channels) {
+                legacyStateChange(channel, onState);
+            }
+        }
+    }
+
+    void tablePublish() {
+        QBENCHMARK {
+            for (InputChannel channel : channels) {
+                tableStateChange(channel, onState);
+            }
+        }
+    }
+
+    void flushPublish() {
+        quint64 round{0};
+        QBENCHMARK {
+            // Every channel flips, so every one of them gets published
+            ++round;
+            for (int channel = 0; channel < channels.count(); ++channel) {
+                states.update(channel, round % 2, round);
+            }
+            flushPending(~quint64(0));
+        }
+    }
+
+    void allocationsPerPublish() {
+        const int publishCount{1000 * channels.count()};
+        const quint64 legacyAllocations{countAllocations([this](InputChannel channel, const QString &state){ legacyStateChange(channel, state); })};
+        const quint64 tableAllocations{countAllocations([this](InputChannel channel, const QString &state){ tableStateChange(channel, state); })};
+        const quint64 flushAllocations{countAllocations([this](InputChannel channel, const QString &state){
+            const int index{channelIndex[channel]};
+            states.update(index, state == onState, 1);
+            flushPending(quint64(1) << index);
+        })};
+        // With the debug messages turned on, formatting them allocates, which is
+        // only reported, as that is the price of asking for them
+        AsyncLogSink::setFilter(QStringLiteral("debug"), QString{});
+        const QtMessageHandler previousHandler{qInstallMessageHandler(discardMessage)};
+        const quint64 debugAllocations{countAllocations([this](InputChannel channel, const QString &state){ tableStateChange(channel, state); })};
+        qInstallMessageHandler(previousHandler);
+        AsyncLogSink::setFilter(QStringLiteral("info"), QString{});
+        qInfo() << "Allocations per publish before:" << double(legacyAllocations) / publishCount;
+        qInfo() << "Allocations per publish now:" << double(tableAllocations) / publishCount;
+        qInfo() << "Allocations per publish now, with debug logging:" << double(debugAllocations) / publishCount;
+        BenchmarkReport::report(QStringLiteral("statuspublish"), QStringLiteral("legacyPublish"), {{QStringLiteral("allocationsPerOperation"), double(legacyAllocations) / publishCount}});
+        BenchmarkReport::report(QStringLiteral("statuspublish"), QStringLiteral("tablePublish"), {{QStringLiteral("allocationsPerOperation"), double(tableAllocations) / publishCount}});
+        BenchmarkReport::report(QStringLiteral("statuspublish"), QStringLiteral("flushPublish"), {{QStringLiteral("allocationsPerOperation"), double(flushAllocations) / publishCount}});
+        BenchmarkReport::report(QStringLiteral("statuspublish"), QStringLiteral("tablePublishDebugLogging"), {{QStringLiteral("allocationsPerOperation"), double(debugAllocations) / publishCount}});
+        QVERIFY(sink > 0);
+        QCOMPARE(tableAllocations, quint64(0));
+        QCOMPARE(flushAllocations, quint64(0));
+    }
+};
+
+QTEST_GUILESS_MAIN(StatusPublishBenchmark)
+
+#include "statuspublishbenchmark.moc"
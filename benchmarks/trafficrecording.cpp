@@ -0,0 +1,138 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "trafficrecording.h"
+
+#include <cstring>
+
+namespace {
+const char RecordingMagic[4]{'R', 'B', 'T', 'R'};
+constexpr quint8 RecordingVersion{1};
+// The record types, each of which starts with one of these
+enum RecordType : quint8 {
+    TopicRecord = 1,
+    MessageRecord = 2,
+};
+constexpr int HeaderSize{int(sizeof(RecordingMagic)) + 1};
+}
+
+bool TrafficRecorder::open(const QString &fileName)
+{
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+    m_stream.setDevice(&m_file);
+    m_stream.writeRawData(RecordingMagic, sizeof(RecordingMagic));
+    m_stream << RecordingVersion;
+    m_topicIndices.clear();
+    m_lastTimeUs = 0;
+    return m_stream.status() == QDataStream::Ok;
+}
+
+void TrafficRecorder::write(const RecordedMessage &message)
+{
+    auto topicIndex = m_topicIndices.constFind(message.topic);
+    if (topicIndex == m_topicIndices.constEnd()) {
+        topicIndex = m_topicIndices.insert(message.topic, quint16(m_topicIndices.count()));
+        m_stream << quint8(TopicRecord) << message.topic.toUtf8();
+    }
+    const quint64 timeUs{qMax(message.timeUs, m_lastTimeUs)};
+    const quint8 flags{quint8((message.qos & 0x03) | (message.retain ? 0x04 : 0))};
+    m_stream << quint8(MessageRecord) << quint32(qMin(timeUs - m_lastTimeUs, quint64(0xffffffff))) << topicIndex.value() << flags << message.payload;
+    m_lastTimeUs = timeUs;
+}
+
+void TrafficRecorder::flush()
+{
+    m_file.flush();
+}
+
+QString TrafficRecorder::errorString() const
+{
+    return m_file.errorString();
+}
+
+bool TrafficReader::open(const QString &fileName)
+{
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        m_errorString = m_file.errorString();
+        return false;
+    }
+    m_stream.setDevice(&m_file);
+    char magic[sizeof(RecordingMagic)];
+    quint8 version{0};
+    if (m_stream.readRawData(magic, sizeof(magic)) != int(sizeof(magic)) || memcmp(magic, RecordingMagic, sizeof(magic)) != 0) {
+        m_file.close();
+        m_errorString = QStringLiteral("not a traffic recording");
+        return false;
+    }
+    m_stream >> version;
+    if (version != RecordingVersion) {
+        m_file.close();
+        m_errorString = QStringLiteral("recording version %1 is not supported").arg(version);
+        return false;
+    }
+    return true;
+}
+
+bool TrafficReader::read(RecordedMessage &message)
+{
+    while (!m_stream.atEnd()) {
+        quint8 type{0};
+        m_stream >> type;
+        if (type == TopicRecord) {
+            QByteArray topic;
+            m_stream >> topic;
+            m_topics << QString::fromUtf8(topic);
+        } else if (type == MessageRecord) {
+            quint32 deltaUs{0};
+            quint16 topicIndex{0};
+            quint8 flags{0};
+            m_stream >> deltaUs >> topicIndex >> flags >> message.payload;
+            if (m_stream.status() != QDataStream::Ok) {
+                // A recording which was cut short ends with the last whole message
+                return false;
+            }
+            m_timeUs += deltaUs;
+            message.timeUs = m_timeUs;
+            message.topic = m_topics.value(topicIndex);
+            message.qos = flags & 0x03;
+            message.retain = flags & 0x04;
+            return true;
+        } else {
+            return false;
+        }
+    }
+    return false;
+}
+
+void TrafficReader::rewind()
+{
+    m_file.seek(HeaderSize);
+    m_stream.resetStatus();
+    m_topics.clear();
+    m_timeUs = 0;
+}
+
+QString TrafficReader::errorString() const
+{
+    return m_errorString;
+}
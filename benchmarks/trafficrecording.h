@@ -0,0 +1,101 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef TRAFFICRECORDING_H
+#define TRAFFICRECORDING_H
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QFile>
+#include <QHash>
+#include <QString>
+#include <QStringList>
+
+/**
+ * A single message from a traffic recording
+ */
+struct RecordedMessage {
+    // When the message arrived, counted from the start of the recording
+    quint64 timeUs{0};
+    QString topic;
+    QByteArray payload;
+    quint8 qos{0};
+    bool retain{false};
+};
+
+/**
+ * Writes MQTT traffic to a compact recording
+ *
+ * Each topic is written out in full only the first time it turns up, and is
+ * referred to by a number after that, so a recording of the same few topics
+ * going back and forth stays small however long it runs for. The timing of
+ * each message is kept as the time since the one before it.
+ */
+class TrafficRecorder
+{
+public:
+    TrafficRecorder() = default;
+    /**
+     * Start a new recording, replacing anything in the file already
+     * @return True if the file could be opened
+     */
+    bool open(const QString &fileName);
+    void write(const RecordedMessage &message);
+    /**
+     * Make sure everything written so far is in the file
+     */
+    void flush();
+    QString errorString() const;
+private:
+    QFile m_file;
+    QDataStream m_stream;
+    QHash<QString, quint16> m_topicIndices;
+    quint64 m_lastTimeUs{0};
+};
+
+/**
+ * Reads back a recording made by TrafficRecorder
+ */
+class TrafficReader
+{
+public:
+    TrafficReader() = default;
+    /**
+     * @return True if the file could be opened, and is a recording
+     */
+    bool open(const QString &fileName);
+    /**
+     * Read the next message
+     * @return False once there are no more messages
+     */
+    bool read(RecordedMessage &message);
+    /**
+     * Go back to the first message
+     */
+    void rewind();
+    QString errorString() const;
+private:
+    QFile m_file;
+    QDataStream m_stream;
+    QStringList m_topics;
+    quint64 m_timeUs{0};
+    QString m_errorString;
+};
+
+#endif//TRAFFICRECORDING_H
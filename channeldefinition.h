@@ -0,0 +1,87 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CHANNELDEFINITION_H
+#define CHANNELDEFINITION_H
+
+#include <QString>
+
+/**
+ * A set of GPIO lines driven through a single backend, such as the Pi's own
+ * GPIO controller, or an I/O expander exposed as a gpiochip
+ */
+struct GpioBankDefinition {
+    static constexpr int MaxBanks{8};
+    // Lines are identified by their offset in the bank, and written as 64 bit masks
+    static constexpr int MaxLines{64};
+
+    QString name;
+    // The type of backend, as passed to GpioBackend::create
+    QString backend;
+    // The GPIO character device used by the backends which need one
+    QString gpioChip;
+};
+
+/**
+ * A single channel, that is one relay and the input which reads its state back
+ */
+struct ChannelDefinition {
+    static constexpr int MaxChannels{64};
+
+    enum InputMode {
+        // The input reads back the state of the relay
+        StateInput = 0,
+        // The input counts the pulses of a meter, such as an S0 output
+        CounterInput,
+    };
+    enum CounterEdge {
+        FallingEdge = 0,
+        RisingEdge,
+        BothEdges,
+    };
+
+    // The position of the bank in Config::gpioBanks()
+    int bank{0};
+    // The line the relay is driven through, or -1 for none
+    int relayLine{-1};
+    // The line the state is read from, or -1 for none
+    int inputLine{-1};
+    QString toggleTopic;
+    QString statusTopic;
+    // Where commands to set the channel to on or off are sent
+    QString setTopic;
+    // How long the relay is energised for, and how long it rests afterwards, in milliseconds
+    int pulseWidth{50};
+    int restTime{50};
+    InputMode inputMode{StateInput};
+    // Which edges a counter input counts, and how long after one it ignores any others, in milliseconds
+    CounterEdge counterEdge{FallingEdge};
+    int counterHoldoff{0};
+};
+
+/**
+ * A named set of changes to make to the channels all at once, such as
+ * switching on the lights for a room, with bit n for the channel at index n
+ */
+struct SceneDefinition {
+    quint64 on{0};
+    quint64 off{0};
+    quint64 toggle{0};
+};
+
+#endif//CHANNELDEFINITION_H
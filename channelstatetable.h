@@ -0,0 +1,152 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CHANNELSTATETABLE_H
+#define CHANNELSTATETABLE_H
+
+#include <QtGlobal>
+#include <atomic>
+
+/**
+ * The last edge seen on a single channel
+ */
+struct ChannelEdgeInfo {
+    // The kernel's CLOCK_MONOTONIC timestamp of the most recent edge
+    quint64 lastEdgeNs{0};
+    // How many edges have been seen on the channel since startup
+    quint32 edgeCount{0};
+};
+
+/**
+ * A consistent copy of the state of every channel, taken at a single instant
+ */
+struct ChannelStateSnapshot {
+    static constexpr int MaxChannels{64};
+    // Bit n is set if channel n is on
+    quint64 states{0};
+    // Bit n is set if channel n has reported a state at all
+    quint64 knownStates{0};
+    ChannelEdgeInfo channels[MaxChannels];
+
+    bool isOn(int channel) const {
+        return states & (quint64(1) << channel);
+    }
+    bool isKnown(int channel) const {
+        return knownStates & (quint64(1) << channel);
+    }
+};
+
+/**
+ * A lock-free table holding the most recent state of all the input channels
+ *
+ * The on/off states of every channel are kept as a single bitmask, so all
+ * channels live in the same cache line and reading just the states is a
+ * single atomic load. The per-channel edge information is protected by a
+ * sequence lock, which lets any thread take a torn-free snapshot of the whole
+ * table without taking a lock or allocating anything.
+ *
+ * There must only ever be a single writer (the thread handling the input
+ * lines), but there can be any number of readers.
+ */
+class ChannelStateTable
+{
+public:
+    static constexpr int MaxChannels{ChannelStateSnapshot::MaxChannels};
+
+    ChannelStateTable() = default;
+    ChannelStateTable(const ChannelStateTable &) = delete;
+    ChannelStateTable &operator=(const ChannelStateTable &) = delete;
+
+    /**
+     * Record a new state for a channel. Only call this from the writer thread.
+     * @param channel The zero-based channel index
+     * @param on Whether the channel is now on
+     * @param timestampNs The time at which the edge happened
+     */
+    void update(int channel, bool on, quint64 timestampNs) {
+        if (channel < 0 || channel >= MaxChannels) {
+            return;
+        }
+        const quint64 bit{quint64(1) << channel};
+        const quint32 sequence{m_sequence.load(std::memory_order_relaxed)};
+        m_sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        const quint64 states{m_states.load(std::memory_order_relaxed)};
+        m_states.store(on ? (states | bit) : (states & ~bit), std::memory_order_relaxed);
+        m_knownStates.store(m_knownStates.load(std::memory_order_relaxed) | bit, std::memory_order_relaxed);
+        m_lastEdgeNs[channel].store(timestampNs, std::memory_order_relaxed);
+        m_edgeCount[channel].store(m_edgeCount[channel].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        m_sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    /**
+     * The on/off state of all channels at a single instant, as a bitmask
+     * @return A bitmask where bit n is set if channel n is on
+     */
+    quint64 states() const {
+        return m_states.load(std::memory_order_acquire);
+    }
+    /**
+     * Which channels have reported a state at all, as a bitmask
+     */
+    quint64 knownStates() const {
+        return m_knownStates.load(std::memory_order_acquire);
+    }
+    bool isOn(int channel) const {
+        return states() & (quint64(1) << channel);
+    }
+    bool isKnown(int channel) const {
+        return knownStates() & (quint64(1) << channel);
+    }
+
+    /**
+     * Take a consistent copy of the whole table
+     * @param snapshot The snapshot to fill out (for the first channelCount channels)
+     * @param channelCount The number of channels to copy the edge information for
+     */
+    void snapshot(ChannelStateSnapshot &snapshot, int channelCount = MaxChannels) const {
+        channelCount = qBound(0, channelCount, int(MaxChannels));
+        quint32 before{0};
+        quint32 after{0};
+        do {
+            before = m_sequence.load(std::memory_order_acquire);
+            if (before & 1) {
+                // The writer is in the middle of an update, try again
+                continue;
+            }
+            snapshot.states = m_states.load(std::memory_order_relaxed);
+            snapshot.knownStates = m_knownStates.load(std::memory_order_relaxed);
+            for (int channel = 0; channel < channelCount; ++channel) {
+                snapshot.channels[channel].lastEdgeNs = m_lastEdgeNs[channel].load(std::memory_order_relaxed);
+                snapshot.channels[channel].edgeCount = m_edgeCount[channel].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = m_sequence.load(std::memory_order_relaxed);
+        } while ((before & 1) || before != after);
+    }
+private:
+    // The hot part of the table, which is all most readers ever touch
+    alignas(64) std::atomic<quint32> m_sequence{0};
+    std::atomic<quint64> m_states{0};
+    std::atomic<quint64> m_knownStates{0};
+    // The per-channel edge information, starting on its own cache line
+    alignas(64) std::atomic<quint64> m_lastEdgeNs[MaxChannels]{};
+    std::atomic<quint32> m_edgeCount[MaxChannels]{};
+};
+
+#endif//CHANNELSTATETABLE_H
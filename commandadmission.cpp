@@ -0,0 +1,140 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "commandadmission.h"
+
+#include <QJsonDocument>
+#include <QJsonObject>
+
+// Packet identifiers get reused once a delivery has been acknowledged, so a
+// redelivery is only matched against the packets from the last little while
+static constexpr quint64 RedeliveryWindowNs{60ULL * 1000000000ULL};
+
+CommandAdmission::CommandAdmission() = default;
+
+void CommandAdmission::setCommandIdWindow(int windowMs)
+{
+    m_commandIdWindowNs = quint64(qMax(0, windowMs)) * 1000000ULL;
+    m_commandIds.clear();
+}
+
+void CommandAdmission::setRateLimit(double commandsPerSecond, int burst)
+{
+    m_tokensPerNs = qMax(0.0, commandsPerSecond) / 1000000000.0;
+    m_burst = qMax(1, burst);
+    for (TokenBucket &bucket : m_buckets) {
+        bucket = TokenBucket{};
+    }
+}
+
+void CommandAdmission::setMaxAge(int maxAgeMs)
+{
+    m_maxAgeMs = qMax(0, maxAgeMs);
+}
+
+QByteArray CommandAdmission::commandId(const QByteArray &payload)
+{
+    // Plain toggle payloads are left alone, without going near the JSON parser
+    if (!payload.startsWith('{')) {
+        return QByteArray{};
+    }
+    const QJsonObject command{QJsonDocument::fromJson(payload).object()};
+    return command.value(QStringLiteral("id")).toVariant().toString().toUtf8();
+}
+
+bool CommandAdmission::takeToken(int channel, quint64 nowNs)
+{
+    TokenBucket &bucket{m_buckets[channel]};
+    if (bucket.tokens < 0) {
+        bucket.tokens = m_burst;
+    } else {
+        bucket.tokens = qMin(double(m_burst), bucket.tokens + double(nowNs - bucket.updatedNs) * m_tokensPerNs);
+    }
+    bucket.updatedNs = nowNs;
+    if (bucket.tokens < 1) {
+        return false;
+    }
+    bucket.tokens -= 1;
+    return true;
+}
+
+CommandAdmission::Verdict CommandAdmission::admit(int channel, quint16 packetId, bool duplicate, const QByteArray &payload, quint64 nowNs,
+                                                  const QByteArray &givenId, qint64 ageMs)
+{
+    if (packetId != 0) {
+        if (duplicate) {
+            for (const RecentPacket &packet : m_recentPackets) {
+                if (packet.packetId == packetId && packet.seenNs > 0 && nowNs - packet.seenNs < RedeliveryWindowNs) {
+                    return DuplicateDelivery;
+                }
+            }
+        }
+        // Remember it, whatever happens below, as a redelivery should meet the same fate
+        m_recentPackets[m_nextPacket] = RecentPacket{packetId, nowNs};
+        m_nextPacket = (m_nextPacket + 1) % RecentPacketCount;
+    }
+
+    if (m_maxAgeMs > 0 && ageMs > m_maxAgeMs) {
+        return Expired;
+    }
+
+    QByteArray id;
+    if (m_commandIdWindowNs > 0) {
+        id = givenId.isEmpty() ? commandId(payload) : givenId;
+        const quint64 seenNs{id.isEmpty() ? 0 : m_commandIds.value(id, 0)};
+        if (seenNs > 0 && nowNs - seenNs < m_commandIdWindowNs) {
+            return DuplicateCommand;
+        }
+    }
+
+    if (m_tokensPerNs > 0 && channel > -1 && channel < ChannelDefinition::MaxChannels && !takeToken(channel, nowNs)) {
+        return RateLimited;
+    }
+
+    // Only commands which were carried out count as seen, so one which was
+    // rate limited can be sent again
+    if (!id.isEmpty()) {
+        // Forget the expired IDs once in a while, rather than on every command
+        if (m_commandIds.count() >= 256) {
+            for (auto it = m_commandIds.begin(); it != m_commandIds.end();) {
+                if (nowNs - it.value() >= m_commandIdWindowNs) {
+                    it = m_commandIds.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        m_commandIds.insert(id, nowNs);
+    }
+    return Accepted;
+}
+
+quint64 CommandAdmission::admitChannels(quint64 channels, quint64 nowNs)
+{
+    if (m_tokensPerNs <= 0) {
+        return channels;
+    }
+    quint64 allowed{0};
+    for (quint64 remaining = channels; remaining != 0; remaining &= remaining - 1) {
+        const int channel{__builtin_ctzll(remaining)};
+        if (takeToken(channel, nowNs)) {
+            allowed |= quint64(1) << channel;
+        }
+    }
+    return allowed;
+}
@@ -0,0 +1,115 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef COMMANDADMISSION_H
+#define COMMANDADMISSION_H
+
+#include <QByteArray>
+#include <QHash>
+
+#include "channeldefinition.h"
+
+/**
+ * Decides whether a command received from the broker should be carried out
+ *
+ * Toggling a latching relay twice leaves it where it started, so a command
+ * which arrives twice is as bad as one which does not arrive at all. This
+ * turns away:
+ * - QoS 1 redeliveries (with the DUP flag set) of a packet we have already handled
+ * - commands carrying an ID (as {"id":"..."} in the payload) which has been
+ *   seen within the command ID window
+ * - commands beyond a per-channel rate limit, using a token bucket, so a
+ *   flapping automation cannot wear out the relays
+ * - commands which are older than the maximum age, going by the timestamp
+ *   their sender gave them, so toggles which sat at the broker through an
+ *   outage are not carried out long after anybody wanted them
+ */
+class CommandAdmission
+{
+public:
+    enum Verdict {
+        Accepted = 0,
+        DuplicateDelivery,
+        DuplicateCommand,
+        RateLimited,
+        Expired,
+    };
+
+    CommandAdmission();
+
+    /**
+     * Set how long command IDs are remembered for
+     * @param windowMs The window in milliseconds, or 0 to not look for command IDs
+     */
+    void setCommandIdWindow(int windowMs);
+    /**
+     * Set the rate limit for each channel
+     * @param commandsPerSecond How quickly the allowance refills, or 0 for no limit
+     * @param burst How many commands can be accepted in quick succession
+     */
+    void setRateLimit(double commandsPerSecond, int burst);
+    /**
+     * Set how old a command may be when it arrives
+     * @param maxAgeMs The age in milliseconds, or 0 to accept commands however old they are
+     */
+    void setMaxAge(int maxAgeMs);
+
+    /**
+     * Decide whether to carry out a command
+     * @param channel The zero-based index of the channel the command is for
+     * @param packetId The MQTT packet identifier (0 for QoS 0 messages, which have none)
+     * @param duplicate Whether the broker marked the message as a redelivery
+     * @param payload The payload of the message
+     * @param nowNs The current CLOCK_MONOTONIC time
+     * @param givenId The command's ID, if it came separately from the payload (as an MQTT 5 user property)
+     * @param ageMs How long ago the sender sent the command, or -1 if it did not say
+     * @return Accepted if the command should be carried out, or the reason it should not
+     */
+    Verdict admit(int channel, quint16 packetId, bool duplicate, const QByteArray &payload, quint64 nowNs,
+                  const QByteArray &givenId = QByteArray{}, qint64 ageMs = -1);
+    /**
+     * Charge the rate limit of each of a set of channels, for a command which
+     * changes several at once (admit() only charges the channel it is given)
+     * @param channels A mask of the channels the command changes, with bit n for channel n
+     * @param nowNs The current CLOCK_MONOTONIC time
+     * @return The channels which are within their rate limit, and so may be changed
+     */
+    quint64 admitChannels(quint64 channels, quint64 nowNs);
+private:
+    static constexpr int RecentPacketCount{128};
+    struct RecentPacket {
+        quint16 packetId{0};
+        quint64 seenNs{0};
+    };
+    struct TokenBucket {
+        double tokens{-1};
+        quint64 updatedNs{0};
+    };
+    static QByteArray commandId(const QByteArray &payload);
+    bool takeToken(int channel, quint64 nowNs);
+    RecentPacket m_recentPackets[RecentPacketCount];
+    int m_nextPacket{0};
+    quint64 m_commandIdWindowNs{0};
+    QHash<QByteArray, quint64> m_commandIds;
+    double m_tokensPerNs{0};
+    int m_burst{1};
+    qint64 m_maxAgeMs{0};
+    TokenBucket m_buckets[ChannelDefinition::MaxChannels];
+};
+
+#endif//COMMANDADMISSION_H
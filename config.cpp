@@ -17,21 +17,16 @@
 */
 
 #include "config.h"
+#include "logging.h"
 
 #include <QDebug>
+#include <QSysInfo>
 #include <KConfig>
 #include <KConfigGroup>
 
-static const QHash<int, char> positionTranslator{
-    {0, '1'},
-    {1, '2'},
-    {2, '3'},
-    {3, '4'},
-    {4, '5'},
-    {5, '6'},
-    {6, '7'},
-    {7, '8'}
-};
+// The relay and input lines of the Waveshare board, which is what we get if no channels are configured
+static const int defaultRelayLines[]{5, 6, 13, 16, 19, 20, 21, 26};
+static const int defaultInputLines[]{2, 3, 4, 17, 27, 22, 10, 9};
 
 class ConfigPrivate
 {
@@ -41,93 +36,361 @@ public:
     bool isValid{false};
     QStringList toggleTopics;
     QStringList statusTopics;
+    QStringList setTopics;
+    // The position of each toggle topic, so looking them up does not mean searching the list
     QString mqttHost;
     int mqttPort{1883};
     QString mqttUsername;
     QString mqttPassword;
-};
+    QString mqttClientId;
+    int mqttReconnectDelay{1000};
+    int mqttMaxReconnectDelay{60000};
+    bool mqtt5{false};
+    int mqttSessionExpiry{3600};
+    int publishBatchWindow{10};
+    QString aggregateTopic;
+    QString aggregateFormat{"bitmask"};
+    int metricsPort{0};
+    QString metricsAddress{"127.0.0.1"};
+    QString metricsFile;
+    int metricsInterval{10000};
+    QString statsTopic;
+    QString logLevel{"info"};
+    QString logRules;
+    int setVerifyTimeout{500};
+    int setRetries{2};
+    QString errorTopic;
+    int commandIdWindow{10000};
+    double commandRate{5};
+    int commandBurst{10};
+    int commandMaxAge{0};
+    QString gpioBackend;
+    QString gpioChip{"/dev/gpiochip0"};
+    int maxSimultaneousRelays{0};
+    int realtimePriority{0};
+    QString debounceMode{"stable"};
+    int debounceTime{20};
+    int debounceSamples{5};
+    int simulatedRelayDelay{20};
+    int simulatedBounceCount{0};
+    int simulatedBounceInterval{1};
+    QString simulatedNoiseScript;
+    int pulseWidth{50};
+    int restTime{50};
+    QList<GpioBankDefinition> gpioBanks;
+    QList<ChannelDefinition> channels;
+    QString batchTopic;
+    bool reloadOnChange{true};
+    QString stateFile{"/var/lib/relayboard-control/state"};
+    bool publishChangedStatesOnly{false};
+    QString controlSocket{"/run/relayboard-control/control"};
+    QString journalFile{"/var/lib/relayboard-control/journal"};
+    int journalSize{65536};
+    int counterInterval{10};
+    QList<int> counterRateWindows{60, 900};
+    QHash<QString, SceneDefinition> scenes;
 
-Config::Config(const QString &configFile, QObject *parent)
-    : QObject(parent)
-    , d(new ConfigPrivate)
-{
-    d->configFile = configFile;
-    KConfig configReader(configFile, KConfig::SimpleConfig);
-    qDebug() << "Reading config from" << configFile;
-    if (configReader.hasGroup("General")) {
-        const KConfigGroup generalGroup = configReader.group("General");
-        if (generalGroup.hasKey("toggleTopics")) {
-            d->toggleTopics = generalGroup.readEntry("toggleTopics", QStringList{});
-            qDebug() << "Found toggle topics in the configuration, now set to:" << d->toggleTopics;
+    int bankByName(const QString &name) const {
+        for (int bank = 0; bank < gpioBanks.count(); ++bank) {
+            if (gpioBanks.at(bank).name == name) {
+                return bank;
+            }
         }
-        if (generalGroup.hasKey("statusTopics")) {
-            d->statusTopics = generalGroup.readEntry("statusTopics", QStringList{});
-            qDebug() << "Found status topics in the configuration, now set to:" << d->statusTopics;
+        return -1;
+    }
+
+    void readBanks(const KConfig &configReader) {
+        // The bank set up in the General group is always there, as the first one
+        gpioBanks << GpioBankDefinition{QStringLiteral("default"), gpioBackend, gpioChip};
+        static const QLatin1String bankPrefix{"Bank "};
+        QStringList groups{configReader.groupList()};
+        groups.sort();
+        for (const QString &groupName : qAsConst(groups)) {
+            if (!groupName.startsWith(bankPrefix)) {
+                continue;
+            }
+            if (gpioBanks.count() == GpioBankDefinition::MaxBanks) {
+                qCWarning(RELAYBOARD_CONFIG) << "Only" << GpioBankDefinition::MaxBanks << "GPIO banks are supported, ignoring" << groupName;
+                continue;
+            }
+            const KConfigGroup bankGroup = configReader.group(groupName);
+            GpioBankDefinition bank;
+            bank.name = groupName.mid(bankPrefix.size());
+            bank.backend = bankGroup.readEntry("backend", gpioBackend);
+            bank.gpioChip = bankGroup.readEntry("gpioChip", gpioChip);
+            gpioBanks << bank;
         }
-        d->mqttHost = generalGroup.readEntry("mqttHost", QString{});
-        d->mqttPort = generalGroup.readEntry("mqttPort", 1883);
-        d->mqttUsername = generalGroup.readEntry("mqttUsername", QString{});
-        d->mqttPassword = generalGroup.readEntry("mqttPassword", QString{});
-        qDebug() << "Our MQTT host is" << d->mqttHost << d->mqttPort;
-
-        // Now read from the Topics group
-        if (configReader.hasGroup("Topics")) {
-            static const QLatin1String pathSeparator{"/"};
-            const KConfigGroup topicsGroup = configReader.group("Topics");
-            QString topicBase = topicsGroup.readEntry("topicBase", QString());
-            if (!topicBase.isEmpty() && !topicBase.endsWith(pathSeparator)) {
-                topicBase += pathSeparator;
-            }
-            QString toggleEndpoint = topicsGroup.readEntry("toggleEndpoint", QString("toggle"));
-            if (!toggleEndpoint.isEmpty() && !toggleEndpoint.startsWith(pathSeparator)) {
-                toggleEndpoint = pathSeparator + toggleEndpoint;
-            }
-            QString statusEndpoint = topicsGroup.readEntry("statusEndpoint", QString("status"));
-            if (!statusEndpoint.isEmpty() && !statusEndpoint.startsWith(pathSeparator)) {
-                statusEndpoint = pathSeparator + statusEndpoint;
-            }
-            for (int i = 1; i < 9; ++i) {
-                const QString topic = topicsGroup.readEntry(QString("topic-%1").arg(QString::number(i)), QString());
-                if (topic.isEmpty()) {
-                    break;
+    }
+
+    static quint64 channelMask(const QStringList &channelNumbers) {
+        quint64 mask{0};
+        for (const QString &number : channelNumbers) {
+            const int channel{number.trimmed().toInt() - 1};
+            if (channel > -1 && channel < ChannelDefinition::MaxChannels) {
+                mask |= quint64(1) << channel;
+            }
+        }
+        return mask;
+    }
+
+    void readScenes(const KConfig &configReader) {
+        static const QLatin1String scenePrefix{"Scene "};
+        for (const QString &groupName : configReader.groupList()) {
+            if (groupName.startsWith(scenePrefix)) {
+                const KConfigGroup sceneGroup = configReader.group(groupName);
+                SceneDefinition scene;
+                scene.on = channelMask(sceneGroup.readEntry("on", QStringList{}));
+                scene.off = channelMask(sceneGroup.readEntry("off", QStringList{}));
+                scene.toggle = channelMask(sceneGroup.readEntry("toggle", QStringList{}));
+                scenes.insert(groupName.mid(scenePrefix.size()), scene);
+            }
+        }
+    }
+
+    void readChannels(const KConfig &configReader, const QString &topicBase, const QString &toggleEndpoint, const QString &statusEndpoint, const QString &setEndpoint) {
+        // Channels are listed in order, 1-indexed, and just like the topics a hole ends the list
+        for (int number = 1; configReader.hasGroup(QString("Channel %1").arg(number)); ++number) {
+            if (number > ChannelDefinition::MaxChannels) {
+                qCWarning(RELAYBOARD_CONFIG) << "Only" << ChannelDefinition::MaxChannels << "channels are supported, ignoring the rest";
+                break;
+            }
+            const KConfigGroup channelGroup = configReader.group(QString("Channel %1").arg(number));
+            ChannelDefinition channel;
+            const QString bankName = channelGroup.readEntry("bank", QString{});
+            channel.bank = bankName.isEmpty() ? 0 : bankByName(bankName);
+            if (channel.bank < 0) {
+                qCWarning(RELAYBOARD_CONFIG) << "Channel" << number << "uses the bank" << bankName << "which is not configured, using the default bank instead";
+                channel.bank = 0;
+            }
+            channel.relayLine = channelGroup.readEntry("relayLine", -1);
+            channel.inputLine = channelGroup.readEntry("inputLine", -1);
+            const QString topic = channelGroup.readEntry("topic", QString{});
+            if (!topic.isEmpty()) {
+                channel.toggleTopic = QString("%1%2%3").arg(topicBase).arg(topic).arg(toggleEndpoint);
+                channel.statusTopic = QString("%1%2%3").arg(topicBase).arg(topic).arg(statusEndpoint);
+                if (!setEndpoint.isEmpty()) {
+                    channel.setTopic = QString("%1%2%3").arg(topicBase).arg(topic).arg(setEndpoint);
                 }
-                d->toggleTopics << QString("%1%2%3").arg(topicBase).arg(topic).arg(toggleEndpoint);
-                d->statusTopics << QString("%1%2%3").arg(topicBase).arg(topic).arg(statusEndpoint);
             }
-            qDebug() << "Topic section found, set topics to:";
-            qDebug() << d->toggleTopics;
-            qDebug() << d->statusTopics;
+            channel.toggleTopic = channelGroup.readEntry("toggleTopic", channel.toggleTopic);
+            channel.statusTopic = channelGroup.readEntry("statusTopic", channel.statusTopic);
+            channel.setTopic = channelGroup.readEntry("setTopic", channel.setTopic);
+            channel.pulseWidth = channelGroup.readEntry("pulseWidth", pulseWidth);
+            channel.restTime = channelGroup.readEntry("restTime", restTime);
+            const QString inputMode{channelGroup.readEntry("inputMode", QString{"state"})};
+            if (inputMode == QLatin1String("counter")) {
+                channel.inputMode = ChannelDefinition::CounterInput;
+            } else if (inputMode != QLatin1String("state")) {
+                qCWarning(RELAYBOARD_CONFIG) << "Channel" << number << "has the unknown input mode" << inputMode << "- reading its state instead";
+            }
+            const QString counterEdge{channelGroup.readEntry("counterEdge", QString{"falling"})};
+            if (counterEdge == QLatin1String("rising")) {
+                channel.counterEdge = ChannelDefinition::RisingEdge;
+            } else if (counterEdge == QLatin1String("both")) {
+                channel.counterEdge = ChannelDefinition::BothEdges;
+            } else if (counterEdge != QLatin1String("falling")) {
+                qCWarning(RELAYBOARD_CONFIG) << "Channel" << number << "has the unknown counter edge" << counterEdge << "- counting falling edges instead";
+            }
+            channel.counterHoldoff = qMax(0, channelGroup.readEntry("counterHoldoff", 0));
+            channels << channel;
+        }
+        if (channels.isEmpty()) {
+            for (int index = 0; index < int(sizeof(defaultRelayLines) / sizeof(defaultRelayLines[0])); ++index) {
+                ChannelDefinition channel;
+                channel.relayLine = defaultRelayLines[index];
+                channel.inputLine = defaultInputLines[index];
+                channel.pulseWidth = pulseWidth;
+                channel.restTime = restTime;
+                channels << channel;
+            }
+        }
+        // Any channel without topics of its own takes them from the lists, by position
+        for (int index = 0; index < channels.count(); ++index) {
+            ChannelDefinition &channel = channels[index];
+            if (channel.toggleTopic.isEmpty()) {
+                channel.toggleTopic = toggleTopics.value(index);
+            }
+            if (channel.statusTopic.isEmpty()) {
+                channel.statusTopic = statusTopics.value(index);
+            }
+            if (channel.setTopic.isEmpty()) {
+                channel.setTopic = setTopics.value(index);
+            }
+        }
+    }
+    /**
+     * Read everything from the configuration file, which should be done only once for each instance
+     */
+    void load() {
+        KConfig configReader(configFile, KConfig::SimpleConfig);
+        qCDebug(RELAYBOARD_CONFIG) << "Reading config from" << configFile;
+        static const QLatin1String pathSeparator{"/"};
+        QString topicBase;
+        QString toggleEndpoint{"/toggle"};
+        QString statusEndpoint{"/status"};
+        QString setEndpoint{"/set"};
+        if (configReader.hasGroup("General")) {
+            const KConfigGroup generalGroup = configReader.group("General");
+            if (generalGroup.hasKey("toggleTopics")) {
+                toggleTopics = generalGroup.readEntry("toggleTopics", QStringList{});
+                qCDebug(RELAYBOARD_CONFIG) << "Found toggle topics in the configuration, now set to:" << toggleTopics;
+            }
+            if (generalGroup.hasKey("statusTopics")) {
+                statusTopics = generalGroup.readEntry("statusTopics", QStringList{});
+                qCDebug(RELAYBOARD_CONFIG) << "Found status topics in the configuration, now set to:" << statusTopics;
+            }
+            mqttHost = generalGroup.readEntry("mqttHost", QString{});
+            mqttPort = generalGroup.readEntry("mqttPort", 1883);
+            mqttUsername = generalGroup.readEntry("mqttUsername", QString{});
+            mqttPassword = generalGroup.readEntry("mqttPassword", QString{});
+            // The client ID needs to stay the same between runs for the broker to keep our session
+            mqttClientId = generalGroup.readEntry("mqttClientId", QString("relayboard-control-%1").arg(QSysInfo::machineHostName()));
+            mqttReconnectDelay = generalGroup.readEntry("mqttReconnectDelay", mqttReconnectDelay);
+            mqttMaxReconnectDelay = generalGroup.readEntry("mqttMaxReconnectDelay", mqttMaxReconnectDelay);
+            const QString mqttVersion{generalGroup.readEntry("mqttVersion", QString{"3.1.1"})};
+            mqtt5 = mqttVersion == QLatin1String("5") || mqttVersion == QLatin1String("5.0");
+            if (!mqtt5 && mqttVersion != QLatin1String("3.1.1")) {
+                qCWarning(RELAYBOARD_CONFIG) << "Unknown MQTT version" << mqttVersion << "- using 3.1.1 instead";
+            }
+            mqttSessionExpiry = generalGroup.readEntry("mqttSessionExpiry", mqttSessionExpiry);
+            qCDebug(RELAYBOARD_CONFIG) << "Our MQTT host is" << mqttHost << mqttPort;
+            publishBatchWindow = generalGroup.readEntry("publishBatchWindow", publishBatchWindow);
+            aggregateTopic = generalGroup.readEntry("aggregateTopic", QString{});
+            aggregateFormat = generalGroup.readEntry("aggregateFormat", aggregateFormat);
+            metricsPort = generalGroup.readEntry("metricsPort", metricsPort);
+            metricsAddress = generalGroup.readEntry("metricsAddress", metricsAddress);
+            metricsFile = generalGroup.readEntry("metricsFile", QString{});
+            metricsInterval = generalGroup.readEntry("metricsInterval", metricsInterval);
+            statsTopic = generalGroup.readEntry("statsTopic", QString{});
+            logLevel = generalGroup.readEntry("logLevel", logLevel);
+            logRules = generalGroup.readEntry("logRules", QString{});
+            commandIdWindow = generalGroup.readEntry("commandIdWindow", commandIdWindow);
+            commandRate = generalGroup.readEntry("commandRate", commandRate);
+            commandBurst = generalGroup.readEntry("commandBurst", commandBurst);
+            commandMaxAge = generalGroup.readEntry("commandMaxAge", commandMaxAge);
+            setVerifyTimeout = generalGroup.readEntry("setVerifyTimeout", setVerifyTimeout);
+            setRetries = generalGroup.readEntry("setRetries", setRetries);
+            errorTopic = generalGroup.readEntry("errorTopic", QString{});
+            batchTopic = generalGroup.readEntry("batchTopic", QString{});
+            reloadOnChange = generalGroup.readEntry("reloadOnChange", reloadOnChange);
+            stateFile = generalGroup.readEntry("stateFile", stateFile);
+            publishChangedStatesOnly = generalGroup.readEntry("publishChangedStatesOnly", publishChangedStatesOnly);
+            controlSocket = generalGroup.readEntry("controlSocket", controlSocket);
+            journalFile = generalGroup.readEntry("journalFile", journalFile);
+            journalSize = generalGroup.readEntry("journalSize", journalSize);
+            counterInterval = generalGroup.readEntry("counterInterval", counterInterval);
+            counterRateWindows = generalGroup.readEntry("counterRateWindows", counterRateWindows);
+            gpioBackend = generalGroup.readEntry("gpioBackend", QString{});
+            gpioChip = generalGroup.readEntry("gpioChip", gpioChip);
+            maxSimultaneousRelays = generalGroup.readEntry("maxSimultaneousRelays", 0);
+            realtimePriority = generalGroup.readEntry("realtimePriority", realtimePriority);
+            debounceMode = generalGroup.readEntry("debounceMode", debounceMode);
+            debounceTime = generalGroup.readEntry("debounceTime", debounceTime);
+            debounceSamples = generalGroup.readEntry("debounceSamples", debounceSamples);
+            pulseWidth = generalGroup.readEntry("pulseWidth", pulseWidth);
+            restTime = generalGroup.readEntry("restTime", restTime);
+
+            // Now read from the Topics group
+            if (configReader.hasGroup("Topics")) {
+                const KConfigGroup topicsGroup = configReader.group("Topics");
+                topicBase = topicsGroup.readEntry("topicBase", QString());
+                if (!topicBase.isEmpty() && !topicBase.endsWith(pathSeparator)) {
+                    topicBase += pathSeparator;
+                }
+                toggleEndpoint = topicsGroup.readEntry("toggleEndpoint", QString("toggle"));
+                if (!toggleEndpoint.isEmpty() && !toggleEndpoint.startsWith(pathSeparator)) {
+                    toggleEndpoint = pathSeparator + toggleEndpoint;
+                }
+                statusEndpoint = topicsGroup.readEntry("statusEndpoint", QString("status"));
+                if (!statusEndpoint.isEmpty() && !statusEndpoint.startsWith(pathSeparator)) {
+                    statusEndpoint = pathSeparator + statusEndpoint;
+                }
+                // Set topics are only there for topicBase style configurations, so an empty endpoint turns them off
+                setEndpoint = topicsGroup.readEntry("setEndpoint", QString("set"));
+                if (!setEndpoint.isEmpty() && !setEndpoint.startsWith(pathSeparator)) {
+                    setEndpoint = pathSeparator + setEndpoint;
+                }
+                for (int i = 1; ; ++i) {
+                    const QString topic = topicsGroup.readEntry(QString("topic-%1").arg(QString::number(i)), QString());
+                    if (topic.isEmpty()) {
+                        break;
+                    }
+                    toggleTopics << QString("%1%2%3").arg(topicBase).arg(topic).arg(toggleEndpoint);
+                    statusTopics << QString("%1%2%3").arg(topicBase).arg(topic).arg(statusEndpoint);
+                    if (!setEndpoint.isEmpty()) {
+                        setTopics << QString("%1%2%3").arg(topicBase).arg(topic).arg(setEndpoint);
+                    }
+                }
+                qCDebug(RELAYBOARD_CONFIG) << "Topic section found, set topics to:";
+                qCDebug(RELAYBOARD_CONFIG) << toggleTopics;
+                qCDebug(RELAYBOARD_CONFIG) << statusTopics;
+            }
+
+            // Settings for the simulated relay board, only used by the simulated backend
+            if (configReader.hasGroup("Simulation")) {
+                const KConfigGroup simulationGroup = configReader.group("Simulation");
+                simulatedRelayDelay = simulationGroup.readEntry("relayDelay", simulatedRelayDelay);
+                simulatedBounceCount = simulationGroup.readEntry("bounceCount", simulatedBounceCount);
+                simulatedBounceInterval = simulationGroup.readEntry("bounceInterval", simulatedBounceInterval);
+                simulatedNoiseScript = simulationGroup.readEntry("noiseScript", QString{});
+            }
+        }
+
+        // The channels are needed even without a usable configuration, so the
+        // relays can still be operated by hand
+        readBanks(configReader);
+        readChannels(configReader, topicBase, toggleEndpoint, statusEndpoint, setEndpoint);
+        readScenes(configReader);
+        bool hasCommandTopics{false};
+        for (int index = 0; index < channels.count(); ++index) {
+            if (!channels.at(index).toggleTopic.isEmpty() || !channels.at(index).setTopic.isEmpty()) {
+                hasCommandTopics = true;
+            }
         }
+        if (!batchTopic.isEmpty()) {
+            hasCommandTopics = true;
+        }
+        qCInfo(RELAYBOARD_CONFIG) << "Set up" << channels.count() << "channels across" << gpioBanks.count() << "GPIO banks";
 
         // Sanity check time - make sure we've got everything filled out that we want filled out
-        if (d->toggleTopics.count() > 0 && !d->mqttHost.isEmpty()) {
-            d->isValid = true;
+        if (hasCommandTopics && !mqttHost.isEmpty()) {
+            isValid = true;
         }
     }
-}
+};
 
-Config::~Config()
+Config::Config(const QString &configFile, QObject *parent)
+    : QObject(parent)
+    , d(new ConfigPrivate)
 {
+    d->configFile = configFile;
+    d->load();
 }
 
-QStringList Config::toggleTopics() const
+bool Config::reload()
 {
-    return d->toggleTopics;
+    // Everything is read into a new snapshot first, so a broken file leaves
+    // the current configuration alone, and the switch happens all in one go
+    std::unique_ptr<ConfigPrivate> snapshot{new ConfigPrivate};
+    snapshot->configFile = d->configFile;
+    snapshot->load();
+    if (!snapshot->isValid) {
+        qCWarning(RELAYBOARD_CONFIG) << "The configuration in" << d->configFile << "is not usable, keeping the current configuration";
+        return false;
+    }
+    d.swap(snapshot);
+    qCInfo(RELAYBOARD_CONFIG) << "Reloaded the configuration from" << d->configFile;
+    Q_EMIT reloaded();
+    return true;
 }
 
-char Config::charForTopic(const QString &topic) const
+QString Config::configFile() const
 {
-    char result{0};
-    const int index = d->toggleTopics.indexOf(topic);
-    if (index > -1 && index < positionTranslator.count()) {
-        result = positionTranslator.value(index);
-    }
-    return result;
+    return d->configFile;
 }
 
-QStringList Config::statusTopics() const
+Config::~Config()
 {
-    return d->statusTopics;
 }
 
 bool Config::isValid() const
@@ -154,3 +417,228 @@ QString Config::mqttPassword() const
 {
     return d->mqttPassword;
 }
+
+QString Config::mqttClientId() const
+{
+    return d->mqttClientId;
+}
+
+int Config::mqttReconnectDelay() const
+{
+    return d->mqttReconnectDelay;
+}
+
+int Config::mqttMaxReconnectDelay() const
+{
+    return d->mqttMaxReconnectDelay;
+}
+
+bool Config::mqtt5() const
+{
+    return d->mqtt5;
+}
+
+int Config::mqttSessionExpiry() const
+{
+    return d->mqttSessionExpiry;
+}
+
+int Config::publishBatchWindow() const
+{
+    return d->publishBatchWindow;
+}
+
+QString Config::aggregateTopic() const
+{
+    return d->aggregateTopic;
+}
+
+QString Config::aggregateFormat() const
+{
+    return d->aggregateFormat;
+}
+
+int Config::metricsPort() const
+{
+    return d->metricsPort;
+}
+
+QString Config::metricsAddress() const
+{
+    return d->metricsAddress;
+}
+
+QString Config::metricsFile() const
+{
+    return d->metricsFile;
+}
+
+int Config::metricsInterval() const
+{
+    return d->metricsInterval;
+}
+
+QString Config::statsTopic() const
+{
+    return d->statsTopic;
+}
+
+QString Config::logLevel() const
+{
+    return d->logLevel;
+}
+
+QString Config::logRules() const
+{
+    return d->logRules;
+}
+
+int Config::commandIdWindow() const
+{
+    return d->commandIdWindow;
+}
+
+double Config::commandRate() const
+{
+    return d->commandRate;
+}
+
+int Config::commandBurst() const
+{
+    return d->commandBurst;
+}
+
+int Config::commandMaxAge() const
+{
+    return d->commandMaxAge;
+}
+
+int Config::setVerifyTimeout() const
+{
+    return d->setVerifyTimeout;
+}
+
+int Config::setRetries() const
+{
+    return d->setRetries;
+}
+
+QString Config::errorTopic() const
+{
+    return d->errorTopic;
+}
+
+bool Config::reloadOnChange() const
+{
+    return d->reloadOnChange;
+}
+
+QString Config::stateFile() const
+{
+    return d->stateFile;
+}
+
+bool Config::publishChangedStatesOnly() const
+{
+    return d->publishChangedStatesOnly;
+}
+
+QString Config::controlSocket() const
+{
+    return d->controlSocket;
+}
+
+QString Config::journalFile() const
+{
+    return d->journalFile;
+}
+
+int Config::journalSize() const
+{
+    return d->journalSize;
+}
+
+int Config::counterInterval() const
+{
+    return d->counterInterval;
+}
+
+QList<int> Config::counterRateWindows() const
+{
+    return d->counterRateWindows;
+}
+
+QString Config::batchTopic() const
+{
+    return d->batchTopic;
+}
+
+QHash<QString, SceneDefinition> Config::scenes() const
+{
+    return d->scenes;
+}
+
+QString Config::gpioBackend() const
+{
+    return d->gpioBackend;
+}
+
+QString Config::gpioChip() const
+{
+    return d->gpioChip;
+}
+
+int Config::maxSimultaneousRelays() const
+{
+    return d->maxSimultaneousRelays;
+}
+
+int Config::realtimePriority() const
+{
+    return d->realtimePriority;
+}
+
+QList<GpioBankDefinition> Config::gpioBanks() const
+{
+    return d->gpioBanks;
+}
+
+QList<ChannelDefinition> Config::channels() const
+{
+    return d->channels;
+}
+
+QString Config::debounceMode() const
+{
+    return d->debounceMode;
+}
+
+int Config::debounceTime() const
+{
+    return d->debounceTime;
+}
+
+int Config::debounceSamples() const
+{
+    return d->debounceSamples;
+}
+
+int Config::simulatedRelayDelay() const
+{
+    return d->simulatedRelayDelay;
+}
+
+int Config::simulatedBounceCount() const
+{
+    return d->simulatedBounceCount;
+}
+
+int Config::simulatedBounceInterval() const
+{
+    return d->simulatedBounceInterval;
+}
+
+QString Config::simulatedNoiseScript() const
+{
+    return d->simulatedNoiseScript;
+}
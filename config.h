@@ -19,9 +19,12 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <QHash>
 #include <QObject>
 #include <memory>
 
+#include "channeldefinition.h"
+
 class ConfigPrivate;
 class Config : public QObject
 {
@@ -31,15 +34,234 @@ public:
     ~Config() override;
 
     bool isValid() const;
-
-    QStringList toggleTopics() const;
-    char charForTopic(const QString &topic) const;
-    QStringList statusTopics() const;
+    /**
+     * The file the configuration is read from
+     */
+    QString configFile() const;
+    /**
+     * Read the configuration file again. If the new configuration is usable,
+     * it replaces the current one, and reloaded is emitted.
+     * @return True if the configuration was replaced
+     */
+    Q_SLOT bool reload();
+    /**
+     * Emitted when the configuration has been replaced with a newly read one
+     */
+    Q_SIGNAL void reloaded();
 
     QString mqttHost() const;
     int mqttPort() const;
     QString mqttUsername() const;
     QString mqttPassword() const;
+    /**
+     * The client ID we connect to the MQTT broker with, which identifies our persistent session
+     * @return The client ID (by default relayboard-control-<hostname>)
+     */
+    QString mqttClientId() const;
+    /**
+     * How long to wait before the first attempt to reconnect to the MQTT broker, in milliseconds
+     */
+    int mqttReconnectDelay() const;
+    /**
+     * The longest we will wait between attempts to reconnect to the MQTT broker, in milliseconds
+     */
+    int mqttMaxReconnectDelay() const;
+    /**
+     * Whether to speak MQTT 5 to the broker, rather than MQTT 3.1.1
+     */
+    bool mqtt5() const;
+    /**
+     * How long the broker keeps our session after we disconnect, in seconds (MQTT 5 only)
+     */
+    int mqttSessionExpiry() const;
+    /**
+     * How long to gather up state changes for before publishing them together, in milliseconds
+     * @return The batch window, or 0 to publish every change straight away
+     */
+    int publishBatchWindow() const;
+    /**
+     * The topic the states of all the channels are published to together
+     * @return The aggregate topic, or an empty string for none
+     */
+    QString aggregateTopic() const;
+    /**
+     * How the aggregate states are published
+     * @return Either bitmask or json
+     */
+    QString aggregateFormat() const;
+    /**
+     * The port the metrics are served on over HTTP, for Prometheus to scrape
+     * @return The port, or 0 to not serve the metrics
+     */
+    int metricsPort() const;
+    /**
+     * The address the metrics are served on (by default only locally)
+     */
+    QString metricsAddress() const;
+    /**
+     * The file the metrics are written to, for the node exporter's textfile collector
+     * @return The file name, or an empty string to not write the metrics out
+     */
+    QString metricsFile() const;
+    /**
+     * How often the metrics file and the stats topic are updated, in milliseconds
+     */
+    int metricsInterval() const;
+    /**
+     * The topic a summary of the metrics is published to
+     * @return The stats topic, or an empty string for none
+     */
+    QString statsTopic() const;
+    /**
+     * The lowest level of log message to write out
+     * @return One of debug, info, warning or critical
+     */
+    QString logLevel() const;
+    /**
+     * Further filter rules for the log categories, separated by semicolons
+     */
+    QString logRules() const;
+    /**
+     * How long a command ID is remembered for, so a command sent twice is only carried out once
+     * @return The window in milliseconds, or 0 to ignore command IDs
+     */
+    int commandIdWindow() const;
+    /**
+     * How many commands per second each channel will accept, once the burst allowance is used up
+     * @return The rate, or 0 for no limit
+     */
+    double commandRate() const;
+    /**
+     * How many commands each channel will accept in quick succession
+     */
+    int commandBurst() const;
+    /**
+     * How old a command may be when it arrives, going by the timestamp its
+     * sender gave it (which only MQTT 5 can carry), in milliseconds
+     * @return The maximum age, or 0 to carry out commands however old they are
+     */
+    int commandMaxAge() const;
+    /**
+     * How long the input gets to report the new state after a pulse for a set command, in milliseconds
+     */
+    int setVerifyTimeout() const;
+    /**
+     * How many more times the relay is pulsed when a set command does not take
+     */
+    int setRetries() const;
+    /**
+     * The topic failures to carry out commands are reported on
+     * @return The error topic, or an empty string for none
+     */
+    QString errorTopic() const;
+    /**
+     * The topic for commands which change several channels at once
+     * @return The batch topic, or an empty string for none
+     */
+    QString batchTopic() const;
+    /**
+     * Whether to reload the configuration when the file changes
+     */
+    bool reloadOnChange() const;
+    /**
+     * The file the last known channel states are kept in between runs
+     * @return The state file, or an empty string to not keep one
+     */
+    QString stateFile() const;
+    /**
+     * Whether to only publish the states which differ from what the state file
+     * says the broker was last told, when first connecting, rather than every
+     * known state
+     */
+    bool publishChangedStatesOnly() const;
+    /**
+     * The Unix domain socket local programs can control the relays through
+     * @return The path of the control socket, or an empty string for none
+     */
+    QString controlSocket() const;
+    /**
+     * The file the binary event journal is kept in
+     * @return The journal file, or an empty string to not keep one
+     */
+    QString journalFile() const;
+    /**
+     * How many events the journal keeps before overwriting the oldest ones
+     */
+    int journalSize() const;
+    /**
+     * How often the totals and rates of the counter inputs are published, in seconds
+     */
+    int counterInterval() const;
+    /**
+     * The windows the rates of the counter inputs are worked out over, in seconds
+     */
+    QList<int> counterRateWindows() const;
+    /**
+     * The scenes which can be switched to through the batch topic, by name
+     */
+    QHash<QString, SceneDefinition> scenes() const;
+
+    /**
+     * The GPIO backend used to drive the relays and read the inputs
+     * @return The name of the backend (bcm2835 or simulated), or an empty string for the default
+     */
+    QString gpioBackend() const;
+    /**
+     * The GPIO character device the input lines are read from
+     * @return The path to the gpiochip device (by default /dev/gpiochip0)
+     */
+    QString gpioChip() const;
+    /**
+     * The maximum number of relays which may be energised at the same time
+     * @return The maximum number of relays, or 0 for no limit
+     */
+    int maxSimultaneousRelays() const;
+    /**
+     * The SCHED_FIFO priority the relay pulse worker runs at
+     * @return The real-time priority (1 to 99), or 0 to run it as a normal thread
+     */
+    int realtimePriority() const;
+    /**
+     * The GPIO banks the channels are spread across. The first bank is always
+     * the one described by gpioBackend and gpioChip.
+     */
+    QList<GpioBankDefinition> gpioBanks() const;
+    /**
+     * All the channels, in order. Without any channels in the configuration,
+     * this is the eight channels of the Waveshare relay board.
+     */
+    QList<ChannelDefinition> channels() const;
+    /**
+     * How the input lines are debounced
+     * @return The name of the debounce mode (none, stable, integrator or majority)
+     */
+    QString debounceMode() const;
+    /**
+     * How long an input must settle for before a change is accepted, in milliseconds
+     */
+    int debounceTime() const;
+    /**
+     * How many times an input is sampled while settling, for the integrator and majority modes
+     */
+    int debounceSamples() const;
+
+    /**
+     * How long the simulated latching relays take to switch, in milliseconds
+     */
+    int simulatedRelayDelay() const;
+    /**
+     * How many times the simulated relay contacts bounce when switching
+     */
+    int simulatedBounceCount() const;
+    /**
+     * The time between each bounce of the simulated relay contacts, in milliseconds
+     */
+    int simulatedBounceInterval() const;
+    /**
+     * A script of input changes to play back on the simulated board
+     * @return The path to the script, or an empty string for none
+     */
+    QString simulatedNoiseScript() const;
 private:
     std::unique_ptr<ConfigPrivate> d;
 };
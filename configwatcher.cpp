@@ -0,0 +1,123 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "configwatcher.h"
+#include "logging.h"
+
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QSocketNotifier>
+#include <QTimer>
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+// The signal handler can do next to nothing, so it just pokes the event loop through a socket
+int sighupFds[2]{-1, -1};
+
+void handleSighup(int)
+{
+    const char poke{1};
+    const int savedErrno{errno};
+    if (write(sighupFds[0], &poke, sizeof(poke)) < 0) {
+        // Nothing useful can be done about it from in here
+    }
+    errno = savedErrno;
+}
+}
+
+class ConfigWatcherPrivate {
+public:
+    ConfigWatcherPrivate() {}
+    Config *config{nullptr};
+    QFileSystemWatcher *watcher{nullptr};
+    QSocketNotifier *sighupNotifier{nullptr};
+    QTimer *reloadTimer{nullptr};
+
+    void watchFile() {
+        const QString configFile{config->configFile()};
+        if (QFileInfo::exists(configFile) && !watcher->files().contains(configFile)) {
+            watcher->addPath(configFile);
+        }
+    }
+};
+
+ConfigWatcher::ConfigWatcher(Config *config, QObject *parent)
+    : QObject(parent)
+    , d(new ConfigWatcherPrivate)
+{
+    d->config = config;
+    d->reloadTimer = new QTimer(this);
+    d->reloadTimer->setSingleShot(true);
+    d->reloadTimer->setInterval(250);
+    connect(d->reloadTimer, &QTimer::timeout, config, &Config::reload);
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0, sighupFds) == 0) {
+        d->sighupNotifier = new QSocketNotifier(sighupFds[1], QSocketNotifier::Read, this);
+        connect(d->sighupNotifier, &QSocketNotifier::activated, this, [this](){
+            char poke[16];
+            while (read(sighupFds[1], poke, sizeof(poke)) > 0) {}
+            qCInfo(RELAYBOARD_CONFIG) << "Received SIGHUP, reloading the configuration";
+            d->reloadTimer->stop();
+            d->config->reload();
+        });
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = handleSighup;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGHUP, &action, nullptr);
+    } else {
+        qCWarning(RELAYBOARD_CONFIG) << "Failed to set up reloading the configuration on SIGHUP:" << strerror(errno);
+    }
+
+    if (config->reloadOnChange()) {
+        d->watcher = new QFileSystemWatcher(this);
+        // Many editors save by writing a new file and renaming it over the old
+        // one, after which the file itself is no longer being watched, so the
+        // directory is watched for it turning up again
+        d->watcher->addPath(QFileInfo(config->configFile()).absolutePath());
+        d->watchFile();
+        connect(d->watcher, &QFileSystemWatcher::fileChanged, this, [this](){
+            d->watchFile();
+            d->reloadTimer->start();
+        });
+        connect(d->watcher, &QFileSystemWatcher::directoryChanged, this, [this](){
+            if (!d->watcher->files().contains(d->config->configFile())) {
+                d->watchFile();
+                if (d->watcher->files().contains(d->config->configFile())) {
+                    d->reloadTimer->start();
+                }
+            }
+        });
+    }
+}
+
+ConfigWatcher::~ConfigWatcher()
+{
+    if (d->sighupNotifier) {
+        signal(SIGHUP, SIG_DFL);
+        close(sighupFds[0]);
+        close(sighupFds[1]);
+        sighupFds[0] = sighupFds[1] = -1;
+    }
+}
@@ -0,0 +1,47 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CONFIGWATCHER_H
+#define CONFIGWATCHER_H
+
+#include <QObject>
+#include <memory>
+
+#include "config.h"
+
+class ConfigWatcherPrivate;
+/**
+ * Reloads the configuration when asked to, or when the file changes
+ *
+ * The service reloads its configuration on SIGHUP (so systemctl reload works),
+ * and, unless reloadOnChange is turned off, whenever the configuration file
+ * is changed. Editors which save by replacing the file are handled as well, by
+ * watching the directory the file lives in. A burst of changes, such as an
+ * editor writing the file out in several steps, results in a single reload.
+ */
+class ConfigWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ConfigWatcher(Config *config, QObject *parent = nullptr);
+    ~ConfigWatcher() override;
+private:
+    std::unique_ptr<ConfigWatcherPrivate> d;
+};
+
+#endif//CONFIGWATCHER_H
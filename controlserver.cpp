@@ -0,0 +1,258 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "controlserver.h"
+#include "config.h"
+#include "inputhandler.h"
+#include "logging.h"
+#include "metrics.h"
+#include "statecontroller.h"
+
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QSet>
+
+#include <algorithm>
+
+// Nothing we understand comes anywhere near this long
+static constexpr qint64 MaxLineLength{1024};
+// A watcher this far behind is not reading, and is cut off rather than buffered for
+static constexpr qint64 MaxWatcherBacklog{64 * 1024};
+
+class ControlServerPrivate {
+public:
+    ControlServerPrivate() {}
+    Config *config{nullptr};
+    InputHandler *inputHandler{nullptr};
+    StateController *stateController{nullptr};
+    QLocalServer *server{nullptr};
+    QString socketPath;
+    QSet<QLocalSocket*> clients;
+    // The clients which want to hear about every change
+    QSet<QLocalSocket*> watchers;
+    // The clients which sent an overlong line, the rest of which is dropped
+    QSet<QLocalSocket*> discarding;
+
+    /**
+     * Read a 1-based channel number, as used everywhere outside the code
+     * @return The zero-based index of the channel, or -1 if it is not a channel
+     */
+    int parseChannel(const QByteArray &text) const {
+        bool ok{false};
+        const int channel{text.toInt(&ok) - 1};
+        return ok && channel > -1 && channel < inputHandler->channelCount() ? channel : -1;
+    }
+    bool parseChannels(const QByteArray &list, quint64 &mask) const {
+        for (const QByteArray &text : list.split(',')) {
+            const int channel{parseChannel(text)};
+            if (channel < 0) {
+                return false;
+            }
+            mask |= quint64(1) << channel;
+        }
+        return true;
+    }
+    QByteArray handleCommand(QLocalSocket *client, const QByteArray &line) {
+        const QList<QByteArray> words{line.simplified().split(' ')};
+        const QByteArray &command{words.first()};
+        if (command == "ping") {
+            return QByteArrayLiteral("pong");
+        } else if (command == "pulse") {
+            QList<int> channels;
+            for (int index = 1; index < words.count(); ++index) {
+                const int channel{parseChannel(words.at(index))};
+                if (channel < 0 || inputHandler->channel(channel).relayLine < 0) {
+                    return "error no relay on channel " + words.at(index);
+                }
+                channels << channel;
+            }
+            if (channels.isEmpty()) {
+                return QByteArrayLiteral("error no channels to pulse");
+            }
+            const quint64 pulseId{channels.count() == 1 ? inputHandler->pulseRelay(channels.first()) : inputHandler->pulseRelays(channels)};
+            return pulseId ? "ok " + QByteArray::number(pulseId) : QByteArrayLiteral("error the relays could not be pulsed");
+        } else if (command == "set") {
+            const int channel{words.count() == 3 ? parseChannel(words.at(1)) : -1};
+            if (channel < 0 || (words.at(2) != "on" && words.at(2) != "off")) {
+                return QByteArrayLiteral("error expected set <channel> on|off");
+            }
+            stateController->setState(channel, words.at(2) == "on");
+            return QByteArrayLiteral("ok");
+        } else if (command == "batch") {
+            quint64 masks[3]{};
+            static const QByteArray actions[3]{"on", "off", "toggle"};
+            for (int index = 1; index < words.count(); ++index) {
+                const int separator{words.at(index).indexOf('=')};
+                const int action{separator > 0 ? int(std::find(actions, actions + 3, words.at(index).left(separator)) - actions) : 3};
+                if (action > 2 || !parseChannels(words.at(index).mid(separator + 1), masks[action])) {
+                    return QByteArrayLiteral("error expected batch [on=<channels>] [off=<channels>] [toggle=<channels>]");
+                }
+            }
+            stateController->setStates(masks[0], masks[1], masks[2]);
+            return QByteArrayLiteral("ok");
+        } else if (command == "scene") {
+            // Scene names can have spaces in them, so take everything after the command
+            const QString name{QString::fromUtf8(line.simplified().mid(6))};
+            const QHash<QString, SceneDefinition> scenes{config->scenes()};
+            if (!scenes.contains(name)) {
+                return "error no scene called " + name.toUtf8();
+            }
+            const SceneDefinition scene{scenes.value(name)};
+            stateController->setStates(scene.on, scene.off, scene.toggle);
+            return QByteArrayLiteral("ok");
+        } else if (command == "state") {
+            const ChannelStateTable &states{inputHandler->channelStates()};
+            if (words.count() == 1) {
+                return "state " + QByteArray::number(states.states() & states.knownStates(), 16) + ' ' + QByteArray::number(states.knownStates(), 16);
+            }
+            const int channel{parseChannel(words.at(1))};
+            if (channel < 0) {
+                return "error no channel " + words.at(1);
+            }
+            return "state " + words.at(1) + ' ' + (states.isKnown(channel) ? InputHandler::stateName(states.isOn(channel)).toLatin1() : QByteArrayLiteral("unknown"));
+        } else if (command == "watch") {
+            watchers << client;
+            return QByteArrayLiteral("ok");
+        } else if (command == "unwatch") {
+            watchers.remove(client);
+            return QByteArrayLiteral("ok");
+        }
+        return "error unknown command " + command;
+    }
+    void handleReadyRead(QLocalSocket *client) {
+        while (client->bytesAvailable() > 0) {
+            // Wait for the rest of a line, unless it is already too long to be one of ours
+            if (!discarding.contains(client) && !client->canReadLine() && client->bytesAvailable() < MaxLineLength) {
+                break;
+            }
+            const QByteArray chunk{client->readLine(MaxLineLength + 1)};
+            const bool complete{chunk.endsWith('\n')};
+            if (discarding.contains(client)) {
+                if (complete) {
+                    discarding.remove(client);
+                }
+                continue;
+            }
+            if (!complete) {
+                // Running the pieces of the line as commands of their own could do anything
+                qCWarning(RELAYBOARD_CONTROL) << "Discarding an overlong line from a control client";
+                discarding << client;
+                client->write(QByteArrayLiteral("error line too long\n"));
+                continue;
+            }
+            const QByteArray line{chunk.trimmed()};
+            if (line.isEmpty()) {
+                continue;
+            }
+            Metrics::instance().increment(Metrics::ControlCommands);
+            qCDebug(RELAYBOARD_CONTROL) << "Received control command" << line;
+            client->write(handleCommand(client, line) + '\n');
+        }
+    }
+    void handleStateChanged(int channel, const QString &state) {
+        if (watchers.isEmpty()) {
+            return;
+        }
+        const QByteArray event{"changed " + QByteArray::number(channel + 1) + ' ' + state.toLatin1() + '\n'};
+        QList<QLocalSocket*> stalled;
+        for (QLocalSocket *client : qAsConst(watchers)) {
+            if (client->bytesToWrite() > MaxWatcherBacklog) {
+                stalled << client;
+            } else {
+                client->write(event);
+            }
+        }
+        // Aborting removes the client from the watchers, so not while going through them
+        for (QLocalSocket *client : qAsConst(stalled)) {
+            qCWarning(RELAYBOARD_CONTROL) << "Disconnecting a control client which is not keeping up with the changes it is watching";
+            client->abort();
+        }
+    }
+};
+
+ControlServer::ControlServer(Config *config, InputHandler *inputHandler, StateController *stateController, QObject *parent)
+    : QObject(parent)
+    , d(new ControlServerPrivate)
+{
+    d->config = config;
+    d->inputHandler = inputHandler;
+    d->stateController = stateController;
+    connect(inputHandler, &InputHandler::inputChannelStateChanged, this, [this](int channel, const QString &state){
+        d->handleStateChanged(channel, state);
+    });
+}
+
+ControlServer::~ControlServer()
+{
+    stop();
+}
+
+void ControlServer::start()
+{
+    d->socketPath = d->config->controlSocket();
+    if (d->socketPath.isEmpty() || d->server) {
+        return;
+    }
+    d->server = new QLocalServer(this);
+    d->server->setSocketOptions(QLocalServer::UserAccessOption | QLocalServer::GroupAccessOption);
+    connect(d->server, &QLocalServer::newConnection, this, [this](){
+        while (QLocalSocket *client = d->server->nextPendingConnection()) {
+            d->clients << client;
+            connect(client, &QLocalSocket::readyRead, this, [this, client](){ d->handleReadyRead(client); });
+            connect(client, &QLocalSocket::disconnected, this, [this, client](){
+                d->clients.remove(client);
+                d->watchers.remove(client);
+                d->discarding.remove(client);
+                client->deleteLater();
+            });
+        }
+    });
+    // A socket left behind by a previous run which did not get to clean up would stop us listening
+    QLocalServer::removeServer(d->socketPath);
+    if (d->server->listen(d->socketPath)) {
+        qCInfo(RELAYBOARD_CONTROL) << "Listening for control commands on" << d->socketPath;
+    } else {
+        qCWarning(RELAYBOARD_CONTROL) << "Failed to listen for control commands on" << d->socketPath << ":" << d->server->errorString();
+    }
+}
+
+void ControlServer::stop()
+{
+    for (QLocalSocket *client : qAsConst(d->clients)) {
+        client->disconnect(this);
+        client->abort();
+        client->deleteLater();
+    }
+    d->clients.clear();
+    d->watchers.clear();
+    d->discarding.clear();
+    if (d->server) {
+        d->server->close();
+        d->server->deleteLater();
+        d->server = nullptr;
+    }
+}
+
+void ControlServer::reloadConfig()
+{
+    if (d->config->controlSocket() != d->socketPath) {
+        stop();
+        start();
+    }
+}
@@ -0,0 +1,73 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef CONTROLSERVER_H
+#define CONTROLSERVER_H
+
+#include <QObject>
+#include <memory>
+
+class Config;
+class InputHandler;
+class StateController;
+class ControlServerPrivate;
+/**
+ * Lets local programs drive the relays through a Unix domain socket
+ *
+ * This is for things running on the same machine (automation scripts, health
+ * checks, tests) which want to switch relays without going through the
+ * broker. Any number of clients can be connected at once, and each of them
+ * sends commands as lines of text, each getting a single line in reply:
+ *
+ * - `pulse <channel> [<channel>...]` pulses the relays together, replying `ok <pulse id>`
+ * - `set <channel> on|off` sets a channel to a state, pulsing it only if needed
+ * - `batch [on=<channels>] [off=<channels>] [toggle=<channels>]` with comma separated channels
+ * - `scene <name>` switches to one of the configured scenes
+ * - `state` replies `state <on mask> <known mask>`, in hexadecimal
+ * - `state <channel>` replies `state <channel> on|off|unknown`
+ * - `watch` and `unwatch` turn on and off `changed <channel> on|off` lines for every change
+ * - `ping` replies `pong`
+ *
+ * Channels are numbered from 1, as in the configuration, and anything which
+ * cannot be done is replied to with `error <reason>`.
+ */
+class ControlServer : public QObject
+{
+    Q_OBJECT
+public:
+    ControlServer(Config *config, InputHandler *inputHandler, StateController *stateController, QObject *parent = nullptr);
+    ~ControlServer() override;
+
+    /**
+     * Start listening on the configured socket (if there is one)
+     */
+    Q_SLOT void start();
+    /**
+     * Stop listening, and disconnect all the clients
+     */
+    Q_SLOT void stop();
+    /**
+     * Pick up the changes from a reloaded configuration, moving the socket if its path has changed
+     */
+    Q_SLOT void reloadConfig();
+private:
+    std::unique_ptr<ControlServerPrivate> d;
+};
+
+#endif//CONTROLSERVER_H
@@ -0,0 +1,202 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "eventjournal.h"
+#include "logging.h"
+
+#include <QFile>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+EventJournal &EventJournal::instance()
+{
+    static EventJournal journal;
+    return journal;
+}
+
+EventJournal::~EventJournal()
+{
+    EventJournalHeader *header{m_header.exchange(nullptr)};
+    if (header) {
+        msync(header, m_size, MS_SYNC);
+        munmap(header, m_size);
+    }
+}
+
+bool EventJournal::open(const QString &fileName, int recordCount)
+{
+    if (isOpen()) {
+        qCWarning(RELAYBOARD_METRICS) << "The event journal is already open";
+        return false;
+    }
+    quint32 count{64};
+    while (count < quint32(recordCount) && count < (1u << 24)) {
+        count <<= 1;
+    }
+    const size_t size{sizeof(EventJournalHeader) + size_t(count) * sizeof(EventRecord)};
+    const int fd{::open(QFile::encodeName(fileName).constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0644)};
+    if (fd < 0) {
+        qCWarning(RELAYBOARD_METRICS) << "Failed to open the event journal" << fileName << ":" << strerror(errno);
+        return false;
+    }
+    struct stat fileStat;
+    const bool rightSize{fstat(fd, &fileStat) == 0 && fileStat.st_size == off_t(size)};
+    if (!rightSize && ftruncate(fd, off_t(size)) < 0) {
+        qCWarning(RELAYBOARD_METRICS) << "Failed to size the event journal" << fileName << ":" << strerror(errno);
+        ::close(fd);
+        return false;
+    }
+    void *mapping{mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)};
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        qCWarning(RELAYBOARD_METRICS) << "Failed to map the event journal" << fileName << ":" << strerror(errno);
+        return false;
+    }
+    EventJournalHeader *header{static_cast<EventJournalHeader*>(mapping)};
+    EventRecord *records{reinterpret_cast<EventRecord*>(static_cast<char*>(mapping) + sizeof(EventJournalHeader))};
+    const bool valid{rightSize && header->magic == EventJournalHeader::Magic && header->version == EventJournalHeader::Version
+        && header->recordSize == sizeof(EventRecord) && header->recordCount == count};
+    if (valid) {
+        // The header may not have made it to the disk along with the records,
+        // so carry on from the last record which did
+        quint64 nextSequence{0};
+        for (quint32 slot = 0; slot < count; ++slot) {
+            const quint64 sequence{records[slot].sequence.load(std::memory_order_relaxed)};
+            if (sequence > 0 && ((sequence - 1) & (count - 1)) == slot) {
+                nextSequence = qMax(nextSequence, sequence);
+            }
+        }
+        header->nextSequence.store(nextSequence, std::memory_order_relaxed);
+    } else {
+        if (rightSize) {
+            qCInfo(RELAYBOARD_METRICS) << "Starting the event journal" << fileName << "afresh";
+        }
+        memset(mapping, 0, size);
+        header->magic = EventJournalHeader::Magic;
+        header->version = EventJournalHeader::Version;
+        header->recordSize = sizeof(EventRecord);
+        header->recordCount = count;
+    }
+    m_records = records;
+    m_mask = count - 1;
+    m_size = size;
+    m_header.store(header, std::memory_order_release);
+
+    timespec realtime;
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    const quint64 nowNs{monotonicNowNs()};
+    record(ServiceStarted, 0, quint32(getpid()), quint64(realtime.tv_sec) * 1000000000ULL + quint64(realtime.tv_nsec), nowNs);
+    qCInfo(RELAYBOARD_METRICS) << "Recording events in" << fileName << "with room for" << count << "of them";
+    return true;
+}
+
+QString EventJournal::read(const QString &fileName, QVector<Event> &events, quint64 fromSequence)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return file.errorString();
+    }
+    const QByteArray contents{file.readAll()};
+    if (contents.size() < int(sizeof(EventJournalHeader))) {
+        return QStringLiteral("the file is too short to be an event journal");
+    }
+    // The records are copied out as plain data, rather than read through the atomics
+    quint32 magic, version, recordSize, recordCount;
+    memcpy(&magic, contents.constData(), sizeof(quint32));
+    memcpy(&version, contents.constData() + 4, sizeof(quint32));
+    memcpy(&recordSize, contents.constData() + 8, sizeof(quint32));
+    memcpy(&recordCount, contents.constData() + 12, sizeof(quint32));
+    if (magic != EventJournalHeader::Magic) {
+        return QStringLiteral("the file is not an event journal");
+    }
+    if (version != EventJournalHeader::Version || recordSize != sizeof(EventRecord)) {
+        return QStringLiteral("the event journal was written by an incompatible version");
+    }
+    if (recordCount == 0 || (recordCount & (recordCount - 1)) || contents.size() < int(sizeof(EventJournalHeader) + recordCount * sizeof(EventRecord))) {
+        return QStringLiteral("the event journal is damaged");
+    }
+    QVector<Event> found;
+    found.reserve(int(recordCount));
+    for (quint32 slot = 0; slot < recordCount; ++slot) {
+        const char *record{contents.constData() + sizeof(EventJournalHeader) + slot * sizeof(EventRecord)};
+        Event event;
+        memcpy(&event.sequence, record + offsetof(EventRecord, sequence), sizeof(quint64));
+        // Never written, only partly written, or not where it belongs
+        if (event.sequence == 0 || ((event.sequence - 1) & (recordCount - 1)) != slot) {
+            continue;
+        }
+        quint8 type;
+        memcpy(&event.timestampNs, record + offsetof(EventRecord, timestampNs), sizeof(quint64));
+        memcpy(&event.data, record + offsetof(EventRecord, data), sizeof(quint64));
+        memcpy(&event.value, record + offsetof(EventRecord, value), sizeof(quint32));
+        memcpy(&event.subject, record + offsetof(EventRecord, subject), sizeof(quint16));
+        memcpy(&type, record + offsetof(EventRecord, type), sizeof(quint8));
+        event.type = EventType(type);
+        found << event;
+    }
+    std::sort(found.begin(), found.end(), [](const Event &first, const Event &second){
+        return first.sequence < second.sequence;
+    });
+    // Every run of the service starts with the time it started, which dates everything after it
+    qint64 offsetNs{0};
+    for (Event &event : found) {
+        if (event.type == ServiceStarted) {
+            offsetNs = qint64(event.data) - qint64(event.timestampNs);
+        }
+        event.realtimeNs = offsetNs ? offsetNs + qint64(event.timestampNs) : 0;
+        if (event.sequence >= fromSequence) {
+            events << event;
+        }
+    }
+    return QString{};
+}
+
+const char *EventJournal::typeName(EventType type)
+{
+    switch (type) {
+        case ServiceStarted:
+            return "started";
+        case CommandReceived:
+            return "command";
+        case CommandRejected:
+            return "rejected";
+        case PulseScheduled:
+            return "scheduled";
+        case RelayEnergised:
+            return "energised";
+        case RelayReleased:
+            return "released";
+        case InputEdge:
+            return "edge";
+        case InputStateChanged:
+            return "state";
+        case StatePublished:
+            return "published";
+        case ConnectionChanged:
+            return "connection";
+    }
+    return "unknown";
+}
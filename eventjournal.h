@@ -0,0 +1,180 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef EVENTJOURNAL_H
+#define EVENTJOURNAL_H
+
+#include "monotonicclock.h"
+
+#include <QString>
+#include <QVector>
+
+#include <atomic>
+
+/**
+ * A single event, exactly as it is laid out in the journal file
+ *
+ * The sequence number is written last, and cleared before anything else is
+ * touched, so a record which was only partly written when the service died
+ * is recognisable as such.
+ */
+struct EventRecord {
+    // One more than the event's position in the journal, or 0 while it is being written
+    std::atomic<quint64> sequence;
+    // CLOCK_MONOTONIC, in nanoseconds
+    quint64 timestampNs;
+    quint64 data;
+    quint32 value;
+    quint16 subject;
+    quint8 type;
+    quint8 reserved;
+};
+static_assert(sizeof(EventRecord) == 32, "The journal file layout depends on the size of the records");
+
+/**
+ * The header at the start of the journal file
+ */
+struct EventJournalHeader {
+    static constexpr quint32 Magic{0x4a454252}; // "RBEJ"
+    static constexpr quint32 Version{1};
+    quint32 magic;
+    quint32 version;
+    quint32 recordSize;
+    // Always a power of two
+    quint32 recordCount;
+    std::atomic<quint64> nextSequence;
+    quint8 reserved[40];
+};
+static_assert(sizeof(EventJournalHeader) == 64, "The journal file layout depends on the size of the header");
+
+/**
+ * A fixed size ring of binary event records, kept in a memory-mapped file
+ *
+ * Recording an event claims a slot with a single atomic increment and fills
+ * it in with a handful of stores into the mapping, which the kernel writes out
+ * in its own time, so it can be done from any thread (including the GPIO
+ * worker) on every command, edge and publish. As the file is shared with the
+ * kernel, everything recorded up to the moment the service crashes is still
+ * there afterwards, and the relayboard-journal tool can dump and filter it.
+ * Once the ring is full, the oldest events are overwritten.
+ *
+ * There is a single journal for the whole process. Until it is opened,
+ * recording an event does nothing.
+ */
+class EventJournal
+{
+public:
+    enum EventType : quint8 {
+        // The subject is unused, the value is the process ID, and the data the
+        // CLOCK_REALTIME time in nanoseconds, for turning timestamps into dates
+        ServiceStarted = 1,
+        // The subject is the channel (0xffff for batches), the value the
+        // TopicRouter::Command and the data the MQTT packet identifier
+        CommandReceived,
+        // As CommandReceived, but with the CommandAdmission::Verdict as the value
+        CommandRejected,
+        // The subject is the channel, and the data the pulse identifier
+        PulseScheduled,
+        // The subject is the relay's output (bank * 64 + line), and the data the pulse identifier
+        RelayEnergised,
+        RelayReleased,
+        // The subject is the channel, the value the raw level, and the timestamp the kernel's
+        InputEdge,
+        // The subject is the channel, and the value whether it is now on
+        InputStateChanged,
+        // The subject is the channel, and the value whether it is on
+        StatePublished,
+        // The value is whether we are now connected to the broker
+        ConnectionChanged,
+    };
+
+    static EventJournal &instance();
+    ~EventJournal();
+
+    /**
+     * Start recording events into a file, carrying on from whatever is in it
+     * already if it was written with the same layout and size
+     * @param fileName The file to keep the journal in
+     * @param recordCount How many events to keep, rounded up to a power of two
+     * @return True if the file could be opened and mapped
+     */
+    bool open(const QString &fileName, int recordCount);
+    bool isOpen() const {
+        return m_header.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Record an event
+     * @param type What happened
+     * @param subject What it happened to (see EventType for what that means for each of them)
+     * @param value Details of the event
+     * @param data More details of the event
+     * @param timestampNs When it happened, on the CLOCK_MONOTONIC clock
+     */
+    void record(EventType type, int subject, quint32 value = 0, quint64 data = 0, quint64 timestampNs = monotonicNowNs()) {
+        EventJournalHeader *header{m_header.load(std::memory_order_acquire)};
+        if (!header) {
+            return;
+        }
+        const quint64 sequence{header->nextSequence.fetch_add(1, std::memory_order_relaxed)};
+        EventRecord &record{m_records[sequence & m_mask]};
+        record.sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        record.timestampNs = timestampNs;
+        record.data = data;
+        record.value = value;
+        record.subject = quint16(subject);
+        record.type = type;
+        record.sequence.store(sequence + 1, std::memory_order_release);
+    }
+
+    /**
+     * A copy of an event read back out of a journal
+     */
+    struct Event {
+        quint64 sequence{0};
+        quint64 timestampNs{0};
+        // The timestamp as a CLOCK_REALTIME time, or 0 if the journal does not say
+        qint64 realtimeNs{0};
+        quint64 data{0};
+        quint32 value{0};
+        quint16 subject{0};
+        EventType type{ServiceStarted};
+    };
+    /**
+     * Read all the complete events in a journal file, oldest first
+     * @param fileName The journal file
+     * @param events The events are added to this
+     * @param fromSequence Leave out the events before this one
+     * @return An empty string on success, or a description of what went wrong
+     */
+    static QString read(const QString &fileName, QVector<Event> &events, quint64 fromSequence = 0);
+    /**
+     * The name of a type of event, as the decoder shows it
+     */
+    static const char *typeName(EventType type);
+private:
+    EventJournal() = default;
+    std::atomic<EventJournalHeader*> m_header{nullptr};
+    EventRecord *m_records{nullptr};
+    quint64 m_mask{0};
+    size_t m_size{0};
+};
+
+#endif//EVENTJOURNAL_H
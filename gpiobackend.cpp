@@ -0,0 +1,63 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "gpiobackend.h"
+#include "gpiochipbackend.h"
+#include "logging.h"
+#include "simulatedgpiobackend.h"
+#ifdef HAVE_BCM2835
+#include "bcm2835backend.h"
+#endif
+
+#include <QDebug>
+
+GpioBackend::GpioBackend(QObject *parent)
+    : QObject(parent)
+{
+}
+
+GpioBackend::~GpioBackend() = default;
+
+GpioBackend *GpioBackend::create(const GpioBankDefinition &bank, Config *config, QObject *parent)
+{
+    const QString type{bank.backend.isEmpty() ? defaultType() : bank.backend};
+    GpioBackend *backend{nullptr};
+    if (type == QLatin1String("simulated")) {
+        backend = new SimulatedGpioBackend(config, parent);
+    } else if (type == QLatin1String("gpiochip")) {
+        backend = new GpioChipBackend(bank, parent);
+    }
+#ifdef HAVE_BCM2835
+    else if (type == QLatin1String("bcm2835")) {
+        backend = new Bcm2835Backend(bank, parent);
+    }
+#endif
+    else {
+        qCWarning(RELAYBOARD_GPIO) << "There is no GPIO backend called" << type << "available in this build";
+    }
+    return backend;
+}
+
+QString GpioBackend::defaultType()
+{
+#ifdef HAVE_BCM2835
+    return QStringLiteral("bcm2835");
+#else
+    return QStringLiteral("simulated");
+#endif
+}
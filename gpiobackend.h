@@ -0,0 +1,91 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GPIOBACKEND_H
+#define GPIOBACKEND_H
+
+#include <QObject>
+
+#include "channeldefinition.h"
+
+class Config;
+/**
+ * The interface through which the relays are driven and the inputs are read
+ *
+ * Lines are identified by their offset on the backend (on a Pi, the BCM GPIO
+ * numbers), and output writes are done as masks, so any number of lines can
+ * be changed in a single operation.
+ */
+class GpioBackend : public QObject
+{
+    Q_OBJECT
+public:
+    explicit GpioBackend(QObject *parent = nullptr);
+    ~GpioBackend() override;
+
+    /**
+     * Create the backend for a GPIO bank
+     * @param bank The bank to create the backend for, whose backend is one of "bcm2835", "gpiochip" or "simulated" (or empty for the default)
+     * @param config The configuration to read any backend specific settings from
+     * @param parent The parent object for the new backend
+     * @return The new backend, or null if there is no backend of that type
+     */
+    static GpioBackend *create(const GpioBankDefinition &bank, Config *config, QObject *parent = nullptr);
+    /**
+     * The name of the backend which is used if none is configured
+     */
+    static QString defaultType();
+
+    /**
+     * Set up the given lines for use. Once this returns, the current levels of
+     * the inputs can be read, and any later changes are reported through inputChanged.
+     * @param outputLines The lines the relays are connected to, set to released (high)
+     * @param inputLines The lines to read the states from, with pull-up bias
+     * @return True if the lines were all successfully set up
+     */
+    virtual bool initialize(const QList<int> &outputLines, const QList<int> &inputLines) = 0;
+    /**
+     * Change the level of a number of output lines in a single operation.
+     * This is called from the GPIO worker thread, and so must be thread-safe.
+     * @param levels The new levels for the lines, one bit per line offset
+     * @param mask The lines which should be changed, one bit per line offset
+     */
+    virtual void writeOutputs(quint64 levels, quint64 mask) = 0;
+    /**
+     * Read the current level of an input line
+     * @param line The line to read
+     * @return True if the line is high
+     */
+    virtual bool inputLevel(int line) const = 0;
+
+    /**
+     * Emitted for every edge on one of the input lines
+     * @param line The line the edge happened on
+     * @param level True if the line went high, false if it went low
+     * @param timestampNs The CLOCK_MONOTONIC timestamp of the edge
+     */
+    Q_SIGNAL void inputChanged(int line, bool level, quint64 timestampNs);
+    /**
+     * Emitted when edges on one of the input lines were lost before they could be reported
+     * @param line The line the edges were lost on
+     * @param count How many edges were lost
+     */
+    Q_SIGNAL void inputEventsLost(int line, quint32 count);
+};
+
+#endif//GPIOBACKEND_H
@@ -0,0 +1,141 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "gpiochipbackend.h"
+#include "gpiolinereader.h"
+#include "logging.h"
+
+#include <QDebug>
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/gpio.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+class GpioChipBackendPrivate {
+public:
+    GpioChipBackendPrivate() {
+        for (int &index : requestIndex) {
+            index = -1;
+        }
+    }
+    ~GpioChipBackendPrivate() {
+        if (outputFd > -1) {
+            close(outputFd);
+        }
+        if (chipFd > -1) {
+            close(chipFd);
+        }
+    }
+    QString gpioChip;
+    int chipFd{-1};
+    int outputFd{-1};
+    // The kernel's value bitmaps are indexed by the position in the request,
+    // so this maps each line offset to its position
+    int requestIndex[GpioBankDefinition::MaxLines];
+    GpioLineReader *lineReader{nullptr};
+};
+
+GpioChipBackend::GpioChipBackend(const GpioBankDefinition &bank, QObject *parent)
+    : GpioBackend(parent)
+    , d(new GpioChipBackendPrivate)
+{
+    d->gpioChip = bank.gpioChip;
+}
+
+GpioChipBackend::~GpioChipBackend() = default;
+
+bool GpioChipBackend::initialize(const QList<int> &outputLines, const QList<int> &inputLines)
+{
+    if (outputLines.count() > GPIO_V2_LINES_MAX) {
+        qCWarning(RELAYBOARD_GPIO) << "Cannot drive" << outputLines.count() << "lines, the character device accepts at most" << GPIO_V2_LINES_MAX;
+        return false;
+    }
+    if (!outputLines.isEmpty()) {
+        d->chipFd = open(d->gpioChip.toLocal8Bit().constData(), O_RDWR | O_CLOEXEC);
+        if (d->chipFd < 0) {
+            qCWarning(RELAYBOARD_GPIO) << "Failed to open the GPIO chip" << d->gpioChip << ":" << strerror(errno);
+            return false;
+        }
+        gpio_v2_line_request request;
+        memset(&request, 0, sizeof(request));
+        for (int i = 0; i < outputLines.count(); ++i) {
+            const int line{outputLines.at(i)};
+            if (line < 0 || line >= GpioBankDefinition::MaxLines) {
+                qCWarning(RELAYBOARD_GPIO) << "Cannot drive line" << line << "which is outside the supported range";
+                return false;
+            }
+            request.offsets[i] = __u32(line);
+            d->requestIndex[line] = i;
+        }
+        request.num_lines = __u32(outputLines.count());
+        strncpy(request.consumer, "relayboard-control", GPIO_MAX_NAME_SIZE - 1);
+        request.config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+        // Make sure the relays start out released, rather than whatever the lines happened to be
+        request.config.num_attrs = 1;
+        request.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+        request.config.attrs[0].attr.values = ~__u64(0);
+        request.config.attrs[0].mask = ~__u64(0);
+        if (ioctl(d->chipFd, GPIO_V2_GET_LINE_IOCTL, &request) < 0) {
+            qCWarning(RELAYBOARD_GPIO) << "Failed to request the output lines" << outputLines << "from" << d->gpioChip << ":" << strerror(errno);
+            return false;
+        }
+        d->outputFd = request.fd;
+    }
+
+    d->lineReader = new GpioLineReader(d->gpioChip, this);
+    connect(d->lineReader, &GpioLineReader::lineChanged, this, &GpioBackend::inputChanged);
+    connect(d->lineReader, &GpioLineReader::eventsLost, this, &GpioBackend::inputEventsLost);
+    if (!inputLines.isEmpty() && !d->lineReader->requestLines(inputLines)) {
+        qCWarning(RELAYBOARD_GPIO) << "Failed to set up the input lines on" << d->gpioChip;
+        return false;
+    }
+    return true;
+}
+
+void GpioChipBackend::writeOutputs(quint64 levels, quint64 mask)
+{
+    if (d->outputFd < 0) {
+        return;
+    }
+    gpio_v2_line_values values;
+    values.bits = 0;
+    values.mask = 0;
+    for (quint64 remaining = mask; remaining; remaining &= remaining - 1) {
+        const int line{__builtin_ctzll(remaining)};
+        const int index{d->requestIndex[line]};
+        if (index > -1) {
+            values.mask |= __u64(1) << index;
+            if (levels & (quint64(1) << line)) {
+                values.bits |= __u64(1) << index;
+            }
+        }
+    }
+    // The whole set of changes goes to the kernel in one go, and the ioctl is
+    // safe to call from the GPIO worker
+    if (values.mask && ioctl(d->outputFd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values) < 0) {
+        qCWarning(RELAYBOARD_GPIO) << "Failed to write the output lines on" << d->gpioChip << ":" << strerror(errno);
+    }
+}
+
+bool GpioChipBackend::inputLevel(int line) const
+{
+    return d->lineReader && d->lineReader->lineLevel(line);
+}
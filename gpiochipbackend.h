@@ -0,0 +1,50 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GPIOCHIPBACKEND_H
+#define GPIOCHIPBACKEND_H
+
+#include "gpiobackend.h"
+
+#include <memory>
+
+class GpioChipBackendPrivate;
+/**
+ * A GPIO backend which does everything through the Linux GPIO character device
+ *
+ * This works with any gpiochip the kernel knows about, which includes I/O
+ * expanders such as the MCP23017, and so is what lets a single Pi drive more
+ * than one relay board. All the output lines share a single line request, so
+ * changing any number of them is still a single ioctl, and the inputs are
+ * read through a GpioLineReader on the same chip.
+ */
+class GpioChipBackend : public GpioBackend
+{
+    Q_OBJECT
+public:
+    explicit GpioChipBackend(const GpioBankDefinition &bank, QObject *parent = nullptr);
+    ~GpioChipBackend() override;
+
+    bool initialize(const QList<int> &outputLines, const QList<int> &inputLines) override;
+    void writeOutputs(quint64 levels, quint64 mask) override;
+    bool inputLevel(int line) const override;
+private:
+    std::unique_ptr<GpioChipBackendPrivate> d;
+};
+
+#endif//GPIOCHIPBACKEND_H
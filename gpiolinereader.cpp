@@ -0,0 +1,152 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "gpiolinereader.h"
+#include "logging.h"
+
+#include <QDebug>
+#include <QHash>
+#include <QSocketNotifier>
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/gpio.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+class GpioLineReaderPrivate {
+public:
+    GpioLineReaderPrivate(GpioLineReader *q)
+        : q(q)
+    {}
+    ~GpioLineReaderPrivate() {
+        delete notifier;
+        if (lineFd > -1) {
+            close(lineFd);
+        }
+        if (chipFd > -1) {
+            close(chipFd);
+        }
+    }
+    GpioLineReader *q;
+    QString chipPath;
+    int chipFd{-1};
+    int lineFd{-1};
+    QSocketNotifier *notifier{nullptr};
+    // The offsets in the order they were requested, as the kernel's value
+    // bitmaps are indexed by the position in the request, not the offset
+    QList<int> lines;
+    // The kernel numbers the edges on every line, so a gap means some were lost
+    QHash<int, quint32> lastLineSeqno;
+
+    void readEvents() {
+        // The kernel hands us as many whole events as fit in the buffer, so
+        // drain it until there is nothing left, and then go back to sleep
+        gpio_v2_line_event events[16];
+        while (true) {
+            const ssize_t bytesRead = read(lineFd, events, sizeof(events));
+            if (bytesRead < 0) {
+                if (errno != EAGAIN && errno != EINTR) {
+                    qCWarning(RELAYBOARD_GPIO) << "Failed to read line events from" << chipPath << ":" << strerror(errno);
+                }
+                break;
+            }
+            const int eventCount = int(bytesRead / sizeof(gpio_v2_line_event));
+            for (int i = 0; i < eventCount; ++i) {
+                const gpio_v2_line_event &event = events[i];
+                quint32 &lastSeqno = lastLineSeqno[int(event.offset)];
+                if (lastSeqno > 0 && event.line_seqno > lastSeqno + 1) {
+                    Q_EMIT q->eventsLost(int(event.offset), event.line_seqno - lastSeqno - 1);
+                }
+                lastSeqno = event.line_seqno;
+                Q_EMIT q->lineChanged(int(event.offset), event.id == GPIO_V2_LINE_EVENT_RISING_EDGE, event.timestamp_ns);
+            }
+            if (eventCount < int(sizeof(events) / sizeof(gpio_v2_line_event))) {
+                break;
+            }
+        }
+    }
+};
+
+GpioLineReader::GpioLineReader(const QString &chipPath, QObject *parent)
+    : QObject(parent)
+    , d(new GpioLineReaderPrivate(this))
+{
+    d->chipPath = chipPath;
+}
+
+GpioLineReader::~GpioLineReader() = default;
+
+bool GpioLineReader::requestLines(const QList<int> &lines)
+{
+    if (lines.isEmpty() || lines.count() > GPIO_V2_LINES_MAX) {
+        qCWarning(RELAYBOARD_GPIO) << "Cannot request" << lines.count() << "lines, the character device accepts between 1 and" << GPIO_V2_LINES_MAX;
+        return false;
+    }
+    if (d->chipFd < 0) {
+        d->chipFd = open(d->chipPath.toLocal8Bit().constData(), O_RDWR | O_CLOEXEC);
+        if (d->chipFd < 0) {
+            qCWarning(RELAYBOARD_GPIO) << "Failed to open the GPIO chip" << d->chipPath << ":" << strerror(errno);
+            return false;
+        }
+    }
+
+    gpio_v2_line_request request;
+    memset(&request, 0, sizeof(request));
+    for (int i = 0; i < lines.count(); ++i) {
+        request.offsets[i] = __u32(lines.at(i));
+    }
+    request.num_lines = __u32(lines.count());
+    // As deep a queue as the kernel allows, so a burst of edges on the counter
+    // inputs survives the event loop being busy for a moment
+    request.event_buffer_size = GPIO_V2_LINES_MAX * 16;
+    strncpy(request.consumer, "relayboard-control", GPIO_MAX_NAME_SIZE - 1);
+    request.config.flags = GPIO_V2_LINE_FLAG_INPUT
+                         | GPIO_V2_LINE_FLAG_EDGE_RISING
+                         | GPIO_V2_LINE_FLAG_EDGE_FALLING
+                         | GPIO_V2_LINE_FLAG_BIAS_PULL_UP;
+    if (ioctl(d->chipFd, GPIO_V2_GET_LINE_IOCTL, &request) < 0) {
+        qCWarning(RELAYBOARD_GPIO) << "Failed to request the input lines" << lines << "from" << d->chipPath << ":" << strerror(errno);
+        return false;
+    }
+    d->lineFd = request.fd;
+    d->lines = lines;
+    fcntl(d->lineFd, F_SETFL, fcntl(d->lineFd, F_GETFL) | O_NONBLOCK);
+
+    d->notifier = new QSocketNotifier(d->lineFd, QSocketNotifier::Read, this);
+    connect(d->notifier, &QSocketNotifier::activated, this, [this](){ d->readEvents(); });
+    qCDebug(RELAYBOARD_GPIO) << "Watching input lines" << lines << "on" << d->chipPath;
+    return true;
+}
+
+bool GpioLineReader::lineLevel(int line) const
+{
+    const int index = d->lines.indexOf(line);
+    if (d->lineFd < 0 || index < 0) {
+        return false;
+    }
+    gpio_v2_line_values values;
+    values.bits = 0;
+    values.mask = 1ULL << index;
+    if (ioctl(d->lineFd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0) {
+        qCWarning(RELAYBOARD_GPIO) << "Failed to read the level of line" << line << "on" << d->chipPath << ":" << strerror(errno);
+        return false;
+    }
+    return values.bits & (1ULL << index);
+}
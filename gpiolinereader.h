@@ -0,0 +1,74 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GPIOLINEREADER_H
+#define GPIOLINEREADER_H
+
+#include <QObject>
+#include <memory>
+
+class GpioLineReaderPrivate;
+/**
+ * Reads input lines through the Linux GPIO character device
+ *
+ * All the requested lines share a single line request, which means a single
+ * file descriptor, and the kernel queues edge events for us. We get woken up
+ * by a QSocketNotifier only when something has actually changed, and every
+ * edge carries the kernel's CLOCK_MONOTONIC timestamp for when it happened.
+ *
+ * This works against any gpiochip device, including the ones created by the
+ * kernel's gpio-sim module, which is useful for testing without hardware.
+ */
+class GpioLineReader : public QObject
+{
+    Q_OBJECT
+public:
+    GpioLineReader(const QString &chipPath, QObject *parent = nullptr);
+    ~GpioLineReader() override;
+
+    /**
+     * Request the given line offsets as inputs, with pull-up bias and edge
+     * detection on both rising and falling edges
+     * @param lines The line offsets on the chip (on a Pi, the BCM GPIO numbers)
+     * @return True if the lines were successfully requested
+     */
+    bool requestLines(const QList<int> &lines);
+    /**
+     * Read the current level of a requested line directly from the chip
+     * @param line The line offset to read
+     * @return True if the line is high, false if it is low or not requested
+     */
+    bool lineLevel(int line) const;
+    /**
+     * Emitted for every edge reported by the kernel
+     * @param line The line offset the edge happened on
+     * @param level True if the line went high, false if it went low
+     * @param timestampNs The kernel's CLOCK_MONOTONIC timestamp of the edge
+     */
+    Q_SIGNAL void lineChanged(int line, bool level, quint64 timestampNs);
+    /**
+     * Emitted when the kernel's queue of edges overflowed, and some were lost
+     * @param line The line offset the edges were lost on
+     * @param count How many edges were lost
+     */
+    Q_SIGNAL void eventsLost(int line, quint32 count);
+private:
+    std::unique_ptr<GpioLineReaderPrivate> d;
+};
+
+#endif//GPIOLINEREADER_H
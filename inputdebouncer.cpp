@@ -0,0 +1,280 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "inputdebouncer.h"
+#include "metrics.h"
+#include "monotonicclock.h"
+
+#include <QDebug>
+#include <QHash>
+#include <QTimer>
+
+/**
+ * The filter state of a single line
+ */
+struct DebounceLineState {
+    // The level the line most recently reported, and the level we last accepted
+    bool rawLevel{true};
+    bool stableLevel{true};
+    quint64 lastEdgeNs{0};
+    // Whether the line is moving, and when it next needs looking at if so
+    bool active{false};
+    quint64 nextDeadlineNs{0};
+    // The integrator count, or the samples taken for the current vote
+    int integrator{0};
+    int samplesTaken{0};
+    int highSamples{0};
+    // The edges seen and levels accepted since the line last settled
+    quint32 roundEdges{0};
+    quint32 roundAccepted{0};
+    quint32 suppressed{0};
+};
+
+class InputDebouncerPrivate {
+public:
+    InputDebouncerPrivate(InputDebouncer *q)
+        : q(q)
+    {}
+    InputDebouncer *q;
+    InputDebouncer::Mode mode{InputDebouncer::NoDebounce};
+    quint64 windowNs{0};
+    int sampleCount{5};
+    QHash<int, DebounceLineState> lines;
+    QTimer *timer{nullptr};
+
+    quint64 sampleIntervalNs() const {
+        return qMax(quint64(1), windowNs / quint64(sampleCount));
+    }
+
+    void accept(int line, DebounceLineState &state, bool level) {
+        state.stableLevel = level;
+        ++state.roundAccepted;
+        Q_EMIT q->levelChanged(line, level, state.lastEdgeNs);
+    }
+
+    void settle(DebounceLineState &state) {
+        state.active = false;
+        if (state.roundEdges > state.roundAccepted) {
+            state.suppressed += state.roundEdges - state.roundAccepted;
+            Metrics::instance().increment(Metrics::SuppressedTransitions, state.roundEdges - state.roundAccepted);
+        }
+        state.roundEdges = 0;
+        state.roundAccepted = 0;
+    }
+
+    void process(int line, DebounceLineState &state, quint64 now) {
+        // If we were woken up late, catch up on every sample we missed
+        while (state.active && state.nextDeadlineNs <= now) {
+            switch (mode) {
+                case InputDebouncer::StableTime:
+                    // Nothing has happened on the line for the whole window
+                    if (state.rawLevel != state.stableLevel) {
+                        accept(line, state, state.rawLevel);
+                    }
+                    settle(state);
+                    break;
+                case InputDebouncer::Integrator:
+                    state.integrator = qBound(0, state.integrator + (state.rawLevel ? 1 : -1), sampleCount);
+                    if (state.integrator == sampleCount && !state.stableLevel) {
+                        accept(line, state, true);
+                    } else if (state.integrator == 0 && state.stableLevel) {
+                        accept(line, state, false);
+                    }
+                    if (state.rawLevel == state.stableLevel && state.integrator == (state.stableLevel ? sampleCount : 0)) {
+                        settle(state);
+                    } else {
+                        state.nextDeadlineNs += sampleIntervalNs();
+                    }
+                    break;
+                case InputDebouncer::MajorityVote:
+                    ++state.samplesTaken;
+                    if (state.rawLevel) {
+                        ++state.highSamples;
+                    }
+                    if (state.samplesTaken >= sampleCount) {
+                        // A tied vote leaves the line where it was
+                        const int lowSamples{state.samplesTaken - state.highSamples};
+                        if (state.highSamples != lowSamples) {
+                            const bool level{state.highSamples > lowSamples};
+                            if (level != state.stableLevel) {
+                                accept(line, state, level);
+                            }
+                        }
+                        state.samplesTaken = 0;
+                        state.highSamples = 0;
+                        if (state.rawLevel == state.stableLevel) {
+                            settle(state);
+                            break;
+                        }
+                    }
+                    state.nextDeadlineNs += sampleIntervalNs();
+                    break;
+                case InputDebouncer::NoDebounce:
+                    settle(state);
+                    break;
+            }
+        }
+    }
+
+    void armTimer() {
+        quint64 earliest{0};
+        for (const DebounceLineState &state : qAsConst(lines)) {
+            if (state.active && (earliest == 0 || state.nextDeadlineNs < earliest)) {
+                earliest = state.nextDeadlineNs;
+            }
+        }
+        if (earliest == 0) {
+            timer->stop();
+        } else {
+            const quint64 now{monotonicNowNs()};
+            // Round up, so we do not wake up just before the deadline and have to go round again
+            const quint64 waitMs{earliest > now ? (earliest - now + 999999ULL) / 1000000ULL : 0};
+            timer->start(int(waitMs));
+        }
+    }
+
+    void handleTimeout() {
+        const quint64 now{monotonicNowNs()};
+        for (auto it = lines.begin(); it != lines.end(); ++it) {
+            process(it.key(), it.value(), now);
+        }
+        armTimer();
+    }
+};
+
+InputDebouncer::InputDebouncer(QObject *parent)
+    : QObject(parent)
+    , d(new InputDebouncerPrivate(this))
+{
+    d->timer = new QTimer(this);
+    d->timer->setSingleShot(true);
+    d->timer->setTimerType(Qt::PreciseTimer);
+    connect(d->timer, &QTimer::timeout, this, [this](){ d->handleTimeout(); });
+}
+
+InputDebouncer::~InputDebouncer() = default;
+
+InputDebouncer::Mode InputDebouncer::modeFromName(const QString &name, bool *ok)
+{
+    static const QHash<QString, Mode> modes{
+        {QStringLiteral("none"), NoDebounce},
+        {QStringLiteral("stable"), StableTime},
+        {QStringLiteral("integrator"), Integrator},
+        {QStringLiteral("majority"), MajorityVote},
+    };
+    const auto it = modes.constFind(name.toLower());
+    if (ok) {
+        *ok = (it != modes.constEnd());
+    }
+    return it != modes.constEnd() ? it.value() : NoDebounce;
+}
+
+void InputDebouncer::setMode(InputDebouncer::Mode mode)
+{
+    d->mode = mode;
+}
+
+InputDebouncer::Mode InputDebouncer::mode() const
+{
+    return d->mode;
+}
+
+void InputDebouncer::setWindowMs(int windowMs)
+{
+    d->windowNs = quint64(qMax(0, windowMs)) * 1000000ULL;
+}
+
+int InputDebouncer::windowMs() const
+{
+    return int(d->windowNs / 1000000ULL);
+}
+
+void InputDebouncer::setSampleCount(int sampleCount)
+{
+    d->sampleCount = qMax(1, sampleCount);
+}
+
+int InputDebouncer::sampleCount() const
+{
+    return d->sampleCount;
+}
+
+void InputDebouncer::setLevel(int line, bool level)
+{
+    DebounceLineState &state = d->lines[line];
+    state.rawLevel = level;
+    state.stableLevel = level;
+    state.integrator = level ? d->sampleCount : 0;
+    state.samplesTaken = 0;
+    state.highSamples = 0;
+    d->settle(state);
+}
+
+void InputDebouncer::handleEdge(int line, bool level, quint64 timestampNs)
+{
+    auto it = d->lines.find(line);
+    if (it == d->lines.end()) {
+        // Lines are pulled up, so one we have not been told about starts out high
+        it = d->lines.insert(line, DebounceLineState{});
+        it->integrator = d->sampleCount;
+    }
+    DebounceLineState &state = it.value();
+    state.rawLevel = level;
+    state.lastEdgeNs = timestampNs;
+    ++state.roundEdges;
+    if (d->mode == NoDebounce || d->windowNs == 0) {
+        if (state.rawLevel != state.stableLevel) {
+            d->accept(line, state, level);
+        }
+        d->settle(state);
+        return;
+    }
+    switch (d->mode) {
+        case StableTime:
+            // Every edge restarts the window
+            state.active = true;
+            state.nextDeadlineNs = timestampNs + d->windowNs;
+            break;
+        case Integrator:
+        case MajorityVote:
+            if (!state.active) {
+                state.active = true;
+                state.samplesTaken = 0;
+                state.highSamples = 0;
+                state.nextDeadlineNs = timestampNs + d->sampleIntervalNs();
+            }
+            break;
+        case NoDebounce:
+            break;
+    }
+    d->armTimer();
+}
+
+quint32 InputDebouncer::suppressedCount(int line) const
+{
+    const DebounceLineState state{d->lines.value(line)};
+    quint32 suppressed{state.suppressed};
+    if (state.active) {
+        // A change which is still settling has not been suppressed (yet)
+        const quint32 pending{state.roundAccepted + (state.rawLevel != state.stableLevel ? 1u : 0u)};
+        if (state.roundEdges > pending) {
+            suppressed += state.roundEdges - pending;
+        }
+    }
+    return suppressed;
+}
@@ -0,0 +1,111 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INPUTDEBOUNCER_H
+#define INPUTDEBOUNCER_H
+
+#include <QObject>
+#include <memory>
+
+class InputDebouncerPrivate;
+/**
+ * Filters the raw edges of the input lines down to real state changes
+ *
+ * The contacts on the relays' second pole bounce when they switch, and the
+ * long cables pick up the occasional glitch, both of which would otherwise
+ * end up as a burst of status changes. Every line is filtered on its own, and
+ * the debouncer only does any work while a line is actually moving, so idle
+ * lines cost nothing.
+ *
+ * The filtering can be done in one of three ways:
+ * - StableTime accepts a new level once the line has held it for the whole window
+ * - Integrator samples the line across the window, counting up while it is high
+ *   and down while it is low, and accepts a new level when the count saturates
+ * - MajorityVote samples the line across the window, and accepts whichever
+ *   level was seen the most
+ */
+class InputDebouncer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit InputDebouncer(QObject *parent = nullptr);
+    ~InputDebouncer() override;
+
+    enum Mode {
+        NoDebounce = 0,
+        StableTime,
+        Integrator,
+        MajorityVote,
+    };
+    Q_ENUM(Mode)
+    /**
+     * Find the mode with the given name (none, stable, integrator or majority)
+     * @param name The name of the mode
+     * @param ok Set to whether the name was recognised
+     * @return The mode, or NoDebounce if the name was not recognised
+     */
+    static Mode modeFromName(const QString &name, bool *ok = nullptr);
+
+    void setMode(Mode mode);
+    Mode mode() const;
+    /**
+     * Set how long a line must settle for before a change is accepted
+     * @param windowMs The window in milliseconds, or 0 to not filter at all
+     */
+    void setWindowMs(int windowMs);
+    int windowMs() const;
+    /**
+     * Set how many times the line is sampled across the window, for the
+     * integrator and majority vote modes
+     * @param sampleCount The number of samples (at least 1)
+     */
+    void setSampleCount(int sampleCount);
+    int sampleCount() const;
+
+    /**
+     * Set the known level of a line, without reporting it as a change. Any
+     * change in progress on the line is dropped.
+     * @param line The line to set the level for
+     * @param level The current level of the line
+     */
+    void setLevel(int line, bool level);
+    /**
+     * Feed a raw edge into the filter
+     * @param line The line the edge happened on
+     * @param level True if the line went high, false if it went low
+     * @param timestampNs The CLOCK_MONOTONIC timestamp of the edge
+     */
+    Q_SLOT void handleEdge(int line, bool level, quint64 timestampNs);
+    /**
+     * How many raw edges on a line have been filtered out since startup
+     * @param line The line to check
+     */
+    quint32 suppressedCount(int line) const;
+
+    /**
+     * Emitted when a line has settled on a new level
+     * @param line The line which changed
+     * @param level The new level of the line
+     * @param timestampNs The timestamp of the raw edge which led to the new level
+     */
+    Q_SIGNAL void levelChanged(int line, bool level, quint64 timestampNs);
+private:
+    std::unique_ptr<InputDebouncerPrivate> d;
+};
+
+#endif//INPUTDEBOUNCER_H
@@ -17,233 +17,346 @@
 */
 
 #include "inputhandler.h"
+#include "config.h"
+#include "eventjournal.h"
+#include "gpiobackend.h"
+#include "inputdebouncer.h"
+#include "logging.h"
+#include "monotonicclock.h"
+#include "pulsecounter.h"
+#include "relaypulsescheduler.h"
+#include "statefile.h"
 
 #include <QCoreApplication>
+#include <QDateTime>
 #include <QDebug>
-#include <QMetaEnum>
+#include <QTimer>
+#include <QVector>
 
-#include <bcm2835.h>
-#include <termios.h>
-
-static struct termios oldSettings;
-static struct termios newSettings;
-
-/* Initialize new terminal i/o settings */
-void initTermios(int echo) 
-{
-    tcgetattr(0, &oldSettings); /* grab old terminal i/o settings */
-    newSettings = oldSettings; /* make new settings same as old settings */
-    newSettings.c_lflag &= ~ICANON; /* disable buffered i/o */
-    newSettings.c_lflag &= echo ? ECHO : ~ECHO; /* set echo mode */
-    tcsetattr(0, TCSANOW, &newSettings); /* use these new terminal i/o settings now */
-}
+class InputHandlerPrivate {
+public:
+    InputHandlerPrivate() {}
+    ~InputHandlerPrivate() {
+        // The scheduler must be stopped before the backends go away, so the
+        // relays are released while we can still talk to them
+        delete pulseScheduler;
+        qDeleteAll(banks);
+        for (quint64 remaining = pulseCounter.countingChannels(); remaining; remaining &= remaining - 1) {
+            const int channel{__builtin_ctzll(remaining)};
+            stateFile->setCounterTotal(channel, pulseCounter.total(channel));
+        }
+        delete stateFile;
+    }
+    Config *config{nullptr};
+    QList<GpioBackend*> banks;
+    InputDebouncer *debouncer{nullptr};
+    RelayPulseScheduler *pulseScheduler{nullptr};
+    QVector<ChannelDefinition> channels;
+    // The channels as they were configured when the GPIO banks were set up
+    QList<ChannelDefinition> configuredChannels;
+    // The channel for every output and input, indexed by RelayPulseScheduler::output(bank, line)
+    QVector<int> channelByOutput;
+    QVector<int> channelByInput;
+    ChannelStateTable channelStates;
+    StateFile *stateFile{nullptr};
+    PulseCounter pulseCounter;
+    // The counter totals are saved once a second, rather than on every pulse
+    QTimer *counterSaveTimer{nullptr};
 
-/* Restore old terminal i/o settings */
-void resetTermios(void) 
-{
-    tcsetattr(0, TCSANOW, &oldSettings);
-}
+    bool isValidChannel(int channel) const {
+        return channel > -1 && channel < channels.count();
+    }
 
-class KeyboardThread : public QThread
-{
-    Q_OBJECT
-public:
-    KeyboardThread(QObject *parent = nullptr)
-        : QThread(parent)
-    {
-        initTermios(0);
-    }
-    ~KeyboardThread() override {
-        resetTermios();
-    }
-    void run() override {
-        while (true)
-        {
-            char key = getchar();
-            Q_EMIT keyPressed(key);
-            if (key == 'q' || key == 'Q') {
-                break;
+    void handleLineChanged(InputHandler *q, int channel, bool level, quint64 timestampNs) {
+        if (isValidChannel(channel)) {
+            // The low value means the circuit is closed, and high means it
+            // is open, so reflect that in the reported values
+            const bool on{!level};
+            if (!channelStates.isKnown(channel) || channelStates.isOn(channel) != on) {
+                channelStates.update(channel, on, timestampNs);
+                EventJournal::instance().record(EventJournal::InputStateChanged, channel, on, 0, timestampNs);
+                stateFile->setStates(channelStates.states(), channelStates.knownStates());
+                Q_EMIT q->inputChannelStateChanged(channel, InputHandler::stateName(on));
             }
         }
     }
-    Q_SIGNAL void keyPressed(char keyValue);
 };
 
-class PinReaderThread : public QThread
+InputHandler::InputHandler(Config *config, QObject *parent)
+    : QObject(parent)
+    , d(new InputHandlerPrivate)
 {
-    Q_OBJECT
-public:
-    PinReaderThread(InputHandler::InputChannel channel, QObject *parent = nullptr)
-        : QThread(parent)
-        , channel(channel)
-    {
-        bcm2835_gpio_fsel(channel, BCM2835_GPIO_FSEL_INPT);
-        bcm2835_gpio_set_pud(channel, BCM2835_GPIO_PUD_UP);
-    }
-    ~PinReaderThread() override {
-    }
-    void run() override {
-        uint8_t value{0};
-        while (true) {
-            if (shouldAbort) {
-                break;
-            }
-            value = bcm2835_gpio_lev(channel);
-            if (value != lastValue) {
-                // The low value means the circuit is closed, and high means it
-                // is open, so reflect that in the return values
-                Q_EMIT pinValueChanged(channel, (value == LOW ? onValue : offValue));
-            }
-            lastValue = value;
-            usleep(250);
+    d->config = config;
+    d->stateFile = new StateFile(config->stateFile());
+
+    // Work out which lines each bank needs, and where to find the channel for each of them
+    const QList<GpioBankDefinition> bankDefinitions{config->gpioBanks()};
+    d->configuredChannels = config->channels();
+    d->channels = d->configuredChannels.toVector();
+    const int outputCount{RelayPulseScheduler::output(GpioBankDefinition::MaxBanks, 0)};
+    d->channelByOutput.fill(-1, outputCount);
+    d->channelByInput.fill(-1, outputCount);
+    QVector<QList<int>> outputLines(bankDefinitions.count());
+    QVector<QList<int>> inputLines(bankDefinitions.count());
+    for (int index = 0; index < d->channels.count(); ++index) {
+        ChannelDefinition &channel = d->channels[index];
+        if (channel.bank < 0 || channel.bank >= bankDefinitions.count()) {
+            qCWarning(RELAYBOARD_GPIO) << "Channel" << index + 1 << "is on a GPIO bank which does not exist, and will not be used";
+            channel.relayLine = channel.inputLine = -1;
+            continue;
+        }
+        if (channel.relayLine >= GpioBankDefinition::MaxLines || channel.inputLine >= GpioBankDefinition::MaxLines) {
+            qCWarning(RELAYBOARD_GPIO) << "Channel" << index + 1 << "uses a line outside the supported range, and will not be used";
+            channel.relayLine = channel.inputLine = -1;
+            continue;
+        }
+        if (channel.relayLine > -1) {
+            outputLines[channel.bank] << channel.relayLine;
+            d->channelByOutput[RelayPulseScheduler::output(channel.bank, channel.relayLine)] = index;
         }
+        if (channel.inputLine > -1) {
+            inputLines[channel.bank] << channel.inputLine;
+            d->channelByInput[RelayPulseScheduler::output(channel.bank, channel.inputLine)] = index;
+        }
+    }
+
+    // Raw edges go through the debouncer, so only settled changes get reported
+    d->debouncer = new InputDebouncer(this);
+    bool debounceModeOk{false};
+    d->debouncer->setMode(InputDebouncer::modeFromName(config->debounceMode(), &debounceModeOk));
+    if (!debounceModeOk) {
+        qCWarning(RELAYBOARD_GPIO) << "Unknown debounce mode" << config->debounceMode() << "- input changes will not be debounced";
     }
-    Q_SIGNAL void pinValueChanged(InputHandler::InputChannel channel, QString newPinValue);
-    Q_SLOT void abort() {
-        shouldAbort = true;
+    d->debouncer->setWindowMs(config->debounceTime());
+    d->debouncer->setSampleCount(config->debounceSamples());
+    connect(d->debouncer, &InputDebouncer::levelChanged, this, [this](int channel, bool level, quint64 timestampNs){
+        d->handleLineChanged(this, channel, level, timestampNs);
+    });
+
+    d->pulseCounter.setRateWindows(config->counterRateWindows());
+    for (int index = 0; index < d->channels.count(); ++index) {
+        d->pulseCounter.setChannel(index, d->channels.at(index));
+        if (d->stateFile->isRestored()) {
+            d->pulseCounter.setTotal(index, d->stateFile->counterTotal(index));
+        }
     }
-    const QString mostRecentValue() const {
-        return (lastValue == LOW ? onValue : offValue);
+    if (d->pulseCounter.countingChannels()) {
+        d->counterSaveTimer = new QTimer(this);
+        connect(d->counterSaveTimer, &QTimer::timeout, this, [this](){
+            for (quint64 remaining = d->pulseCounter.countingChannels(); remaining; remaining &= remaining - 1) {
+                const int channel{__builtin_ctzll(remaining)};
+                d->stateFile->setCounterTotal(channel, d->pulseCounter.total(channel));
+            }
+        });
+        d->counterSaveTimer->start(1000);
     }
-private:
-    // Set to max to try and ensure we get updated on the first run
-    uint8_t lastValue{UINT8_MAX};
-    InputHandler::InputChannel channel;
-    bool shouldAbort{false};
-    const QLatin1String onValue{"on"};
-    const QLatin1String offValue{"off"};
-};
 
-class InputHandlerPrivate {
-public:
-    InputHandlerPrivate() {}
-    ~InputHandlerPrivate() {
-        if (inputThread) {
-            inputThread->quit();
-            inputThread->wait(1000);
+    bool banksReady{!bankDefinitions.isEmpty()};
+    for (int bank = 0; bank < bankDefinitions.count() && banksReady; ++bank) {
+        GpioBackend *backend = GpioBackend::create(bankDefinitions.at(bank), config);
+        if (backend && backend->initialize(outputLines.at(bank), inputLines.at(bank))) {
+            d->banks << backend;
+            connect(backend, &GpioBackend::inputChanged, this, [this, bank](int line, bool level, quint64 timestampNs){
+                const int channel{d->channelByInput.at(RelayPulseScheduler::output(bank, line))};
+                if (channel > -1) {
+                    EventJournal::instance().record(EventJournal::InputEdge, channel, level, 0, timestampNs);
+                    if (d->pulseCounter.isCounting(channel)) {
+                        d->pulseCounter.handleEdge(channel, level, timestampNs);
+                    } else {
+                        d->debouncer->handleEdge(channel, level, timestampNs);
+                    }
+                }
+            });
+            connect(backend, &GpioBackend::inputEventsLost, this, [this, bank](int line, quint32 count){
+                const int channel{d->channelByInput.at(RelayPulseScheduler::output(bank, line))};
+                if (channel > -1) {
+                    qCWarning(RELAYBOARD_GPIO) << "Lost" << count << "edges on the input of channel" << channel + 1;
+                    d->pulseCounter.addMissed(channel, count);
+                }
+            });
+            qCInfo(RELAYBOARD_GPIO) << "Set up the GPIO bank" << bankDefinitions.at(bank).name << "with" << outputLines.at(bank).count() << "relays and" << inputLines.at(bank).count() << "inputs";
+        } else {
+            qCWarning(RELAYBOARD_GPIO) << "Failed to set up the GPIO bank" << bankDefinitions.at(bank).name;
+            delete backend;
+            banksReady = false;
         }
-        for (PinReaderThread *pinReader : pinReaders) {
-            pinReader->abort();
-            pinReader->wait(1000);
+    }
+    if (banksReady) {
+        // Report the initial levels, so everybody starts out with a known state
+        const quint64 restoredStates{d->stateFile->states()};
+        const quint64 restoredKnown{d->stateFile->isRestored() ? d->stateFile->knownStates() : 0};
+        const quint64 nowNs{monotonicNowNs()};
+        for (int index = 0; index < d->channels.count(); ++index) {
+            const ChannelDefinition &channel = d->channels.at(index);
+            if (channel.inputLine > -1 && !d->pulseCounter.isCounting(index)) {
+                const bool level{d->banks.at(channel.bank)->inputLevel(channel.inputLine)};
+                d->debouncer->setLevel(index, level);
+                d->handleLineChanged(this, index, level, nowNs);
+            }
         }
-        if (bcm2835_close()) {
-            qDebug() << "Successfully shut down the relay connection";
+        if (restoredKnown) {
+            // Anything which changed while we were not running was switched by hand, or lost power
+            const quint64 changedWhileStopped{(d->channelStates.states() ^ restoredStates) & d->channelStates.knownStates() & restoredKnown};
+            qCInfo(RELAYBOARD_GPIO) << "Restored the last known states, saved" << QDateTime::fromMSecsSinceEpoch(d->stateFile->savedAtMs()).toString(Qt::ISODate);
+            for (quint64 remaining = changedWhileStopped; remaining; remaining &= remaining - 1) {
+                const int channel{__builtin_ctzll(remaining)};
+                qCInfo(RELAYBOARD_GPIO) << "Channel" << channel + 1 << "changed to" << stateName(d->channelStates.isOn(channel)) << "while the service was stopped";
+            }
         }
+
+        d->pulseScheduler = new RelayPulseScheduler(d->banks);
+        connect(d->pulseScheduler, &RelayPulseScheduler::pulseCompleted, this, [this](int output, quint64 pulseId){
+            const int channel{d->channelByOutput.value(output, -1)};
+            d->stateFile->addPulse(channel);
+            Q_EMIT relayPulseCompleted(channel, pulseId);
+        });
+        d->pulseScheduler->setMaxEnergised(config->maxSimultaneousRelays());
+        d->pulseScheduler->setRealtimePriority(config->realtimePriority());
+        d->pulseScheduler->start();
+
+        qCInfo(RELAYBOARD_GPIO) << "Successfully set up" << d->channels.count() << "channels";
+    } else {
+        qCWarning(RELAYBOARD_GPIO) << "Failed to set up the relays for output!";
+        qApp->quit();
     }
-    KeyboardThread *inputThread{nullptr};
-    QList<PinReaderThread*> pinReaders;
-};
+}
 
-InputHandler::InputHandler(QObject *parent)
-    : QObject(parent)
-    , d(new InputHandlerPrivate)
+InputHandler::~InputHandler() = default;
+
+void InputHandler::reloadConfig()
 {
-    d->inputThread = new KeyboardThread(this);
-    connect(d->inputThread, &KeyboardThread::keyPressed, this, &InputHandler::handleKeyPressed);
-    connect(d->inputThread, &QThread::finished, qApp, &QCoreApplication::quit);
-    if (bcm2835_init()) {
-        bcm2835_gpio_fsel(RelayChannel1, BCM2835_GPIO_FSEL_OUTP);
-        bcm2835_gpio_fsel(RelayChannel2, BCM2835_GPIO_FSEL_OUTP);
-        bcm2835_gpio_fsel(RelayChannel3, BCM2835_GPIO_FSEL_OUTP);
-        bcm2835_gpio_fsel(RelayChannel4, BCM2835_GPIO_FSEL_OUTP);
-        bcm2835_gpio_fsel(RelayChannel5, BCM2835_GPIO_FSEL_OUTP);
-        bcm2835_gpio_fsel(RelayChannel6, BCM2835_GPIO_FSEL_OUTP);
-        bcm2835_gpio_fsel(RelayChannel7, BCM2835_GPIO_FSEL_OUTP);
-        bcm2835_gpio_fsel(RelayChannel8, BCM2835_GPIO_FSEL_OUTP);
-
-        d->pinReaders << new PinReaderThread(InputChannel1, this);
-        d->pinReaders << new PinReaderThread(InputChannel2, this);
-        d->pinReaders << new PinReaderThread(InputChannel3, this);
-        d->pinReaders << new PinReaderThread(InputChannel4, this);
-        d->pinReaders << new PinReaderThread(InputChannel5, this);
-        d->pinReaders << new PinReaderThread(InputChannel6, this);
-        d->pinReaders << new PinReaderThread(InputChannel7, this);
-        d->pinReaders << new PinReaderThread(InputChannel8, this);
-        for (PinReaderThread *pinReader : d->pinReaders) {
-            connect(pinReader, &PinReaderThread::pinValueChanged, this, &InputHandler::inputChannelStateChanged, Qt::QueuedConnection);
-            pinReader->start();
+    // The GPIO lines stay as they were set up, so the relays and inputs carry
+    // on undisturbed, but everything else about the channels can change
+    const QList<ChannelDefinition> channels{d->config->channels()};
+    bool layoutChanged{channels.count() != d->configuredChannels.count()};
+    for (int index = 0; index < qMin(channels.count(), d->channels.count()); ++index) {
+        const ChannelDefinition &updated = channels.at(index);
+        const ChannelDefinition &configured = d->configuredChannels.at(index);
+        if (updated.bank != configured.bank || updated.relayLine != configured.relayLine || updated.inputLine != configured.inputLine
+            || updated.inputMode != configured.inputMode) {
+            layoutChanged = true;
         }
-        qDebug() << "Successfully set up the relays for output. Send the relay number to pulse it, a to pulse all, or q to quit.";
-        d->inputThread->start();
-    } else {
-        qWarning() << "Failed to set up the relays for output!";
-        qApp->quit();
+        ChannelDefinition &channel = d->channels[index];
+        channel.toggleTopic = updated.toggleTopic;
+        channel.statusTopic = updated.statusTopic;
+        channel.setTopic = updated.setTopic;
+        channel.pulseWidth = updated.pulseWidth;
+        channel.restTime = updated.restTime;
+        channel.counterEdge = updated.counterEdge;
+        channel.counterHoldoff = updated.counterHoldoff;
+        d->pulseCounter.setChannel(index, channel);
+    }
+    if (layoutChanged || d->config->gpioBanks().count() != d->banks.count()) {
+        qCWarning(RELAYBOARD_GPIO) << "The channels or GPIO banks have changed, which will only take effect once the service is restarted";
     }
+    bool debounceModeOk{false};
+    const InputDebouncer::Mode debounceMode{InputDebouncer::modeFromName(d->config->debounceMode(), &debounceModeOk)};
+    if (debounceModeOk) {
+        d->debouncer->setMode(debounceMode);
+    }
+    d->debouncer->setWindowMs(d->config->debounceTime());
+    d->debouncer->setSampleCount(d->config->debounceSamples());
+    if (d->pulseCounter.rateWindows() != d->config->counterRateWindows()) {
+        d->pulseCounter.setRateWindows(d->config->counterRateWindows());
+    }
+    if (d->pulseScheduler) {
+        d->pulseScheduler->setMaxEnergised(d->config->maxSimultaneousRelays());
+        d->pulseScheduler->setRealtimePriority(d->config->realtimePriority());
+    }
+}
 
+bool InputHandler::isReady() const
+{
+    return d->pulseScheduler;
 }
 
-InputHandler::~InputHandler() = default;
+StateFile *InputHandler::stateFile() const
+{
+    return d->stateFile;
+}
 
-const char *relayChannelName(InputHandler::RelayChannel channel) {
-    static const QMetaEnum theEnum = QMetaEnum::fromType<InputHandler::RelayChannel>();
-    return theEnum.valueToKey(channel);
+quint64 InputHandler::gpioWorkerHeartbeatNs() const
+{
+    return d->pulseScheduler ? d->pulseScheduler->heartbeatNs() : 0;
 }
 
-InputHandler::RelayChannel InputHandler::channelByNumber(int number) const
+void InputHandler::pingGpioWorker() const
 {
-    static const QMetaEnum theEnum = QMetaEnum::fromType<InputHandler::RelayChannel>();
-    RelayChannel channel{RelayChannelInvalid};
-    if (number > -1 && number < theEnum.keyCount()) {
-        bool ok{false};
-        int value = theEnum.keyToValue(QString("RelayChannel%1").arg(QString::number(number)).toLatin1(), &ok);
-        if (ok) {
-            channel = RelayChannel(value);
-        }
+    if (d->pulseScheduler) {
+        d->pulseScheduler->ping();
     }
-    return channel;
 }
 
-void InputHandler::pulseRelay(InputHandler::RelayChannel channel) const {
-    if (channel == RelayChannelInvalid) {
-        qWarning() << "Not pulsing invalid relay!";
+int InputHandler::channelCount() const
+{
+    return d->channels.count();
+}
+
+const ChannelDefinition &InputHandler::channel(int channel) const
+{
+    static const ChannelDefinition noChannel;
+    return d->isValidChannel(channel) ? d->channels.at(channel) : noChannel;
+}
+
+quint64 InputHandler::pulseRelay(int channel) const {
+    quint64 pulseId{0};
+    if (!d->isValidChannel(channel) || d->channels.at(channel).relayLine < 0) {
+        qCWarning(RELAYBOARD_GPIO) << "Not pulsing invalid relay!" << channel;
+    } else if (!d->pulseScheduler) {
+        qCWarning(RELAYBOARD_GPIO) << "Not pulsing channel" << channel + 1 << "as the relays have not been set up";
     } else {
-        qDebug() << "Pulsing" << relayChannelName(channel);
-        bcm2835_gpio_write(channel,LOW);
-        bcm2835_delay(50);
-        bcm2835_gpio_write(channel,HIGH);
-        bcm2835_delay(50);
+        const ChannelDefinition &definition = d->channels.at(channel);
+        qCDebug(RELAYBOARD_GPIO) << "Pulsing channel" << channel + 1;
+        pulseId = d->pulseScheduler->schedulePulse(RelayPulseScheduler::output(definition.bank, definition.relayLine), definition.pulseWidth, definition.restTime);
+        if (pulseId > 0) {
+            EventJournal::instance().record(EventJournal::PulseScheduled, channel, 0, pulseId);
+        }
     }
+    return pulseId;
 }
 
-void InputHandler::handleKeyPressed(char keyValue)
+quint64 InputHandler::pulseRelays(const QList<int> &channels) const
 {
-    if (keyValue == 'q' || keyValue == 'Q') {
-        qApp->quit();
-    } else if (keyValue == 'a' || keyValue == 'A') {
-        pulseRelay(RelayChannel1);
-        pulseRelay(RelayChannel2);
-        pulseRelay(RelayChannel3);
-        pulseRelay(RelayChannel4);
-        pulseRelay(RelayChannel5);
-        pulseRelay(RelayChannel6);
-        pulseRelay(RelayChannel7);
-        pulseRelay(RelayChannel8);
-    } else if (keyValue == '1') {
-        pulseRelay(RelayChannel1);
-    } else if (keyValue == '2') {
-        pulseRelay(RelayChannel2);
-    } else if (keyValue == '3') {
-        pulseRelay(RelayChannel3);
-    } else if (keyValue == '4') {
-        pulseRelay(RelayChannel4);
-    } else if (keyValue == '5') {
-        pulseRelay(RelayChannel5);
-    } else if (keyValue == '6') {
-        pulseRelay(RelayChannel6);
-    } else if (keyValue == '7') {
-        pulseRelay(RelayChannel7);
-    } else if (keyValue == '8') {
-        pulseRelay(RelayChannel8);
+    quint64 firstPulseId{0};
+    if (!d->pulseScheduler) {
+        qCWarning(RELAYBOARD_GPIO) << "Not pulsing" << channels.count() << "relays, as the relays have not been set up";
+    } else {
+        QList<RelayPulseScheduler::Pulse> pulses;
+        QVector<int> pulsedChannels;
+        for (int channel : channels) {
+            if (!d->isValidChannel(channel) || d->channels.at(channel).relayLine < 0) {
+                qCWarning(RELAYBOARD_GPIO) << "Not pulsing invalid relay!" << channel;
+            } else {
+                const ChannelDefinition &definition = d->channels.at(channel);
+                pulses << RelayPulseScheduler::Pulse{RelayPulseScheduler::output(definition.bank, definition.relayLine), definition.pulseWidth, definition.restTime};
+                pulsedChannels << channel;
+            }
+        }
+        qCDebug(RELAYBOARD_GPIO) << "Pulsing" << pulses.count() << "relays together";
+        firstPulseId = d->pulseScheduler->schedulePulses(pulses);
+        if (firstPulseId > 0) {
+            for (int index = 0; index < pulsedChannels.count(); ++index) {
+                EventJournal::instance().record(EventJournal::PulseScheduled, pulsedChannels.at(index), 0, firstPulseId + quint64(index));
+            }
+        }
     }
+    return firstPulseId;
 }
 
-QStringList InputHandler::mostRecentChannelStates() const
+const ChannelStateTable &InputHandler::channelStates() const
 {
-    QStringList states;
-    for (PinReaderThread *pinReader : d->pinReaders) {
-        states << pinReader->mostRecentValue();
-    }
-    return states;
+    return d->channelStates;
 }
 
-#include "inputhandler.moc"
+const PulseCounter &InputHandler::pulseCounter() const
+{
+    return d->pulseCounter;
+}
+
+const QString &InputHandler::stateName(bool on)
+{
+    // QStringLiteral data is static, so handing out copies of these never allocates
+    static const QString onValue{QStringLiteral("on")};
+    static const QString offValue{QStringLiteral("off")};
+    return on ? onValue : offValue;
+}
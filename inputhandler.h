@@ -20,51 +20,118 @@
 #define INPUTTHREAD_H
 
 #include <QObject>
-#include <QThread>
 #include <memory>
 
+#include "channeldefinition.h"
+#include "channelstatetable.h"
+
+class Config;
 class InputHandlerPrivate;
+class PulseCounter;
+class StateFile;
+/**
+ * Looks after the channels, that is the relays and the inputs which read
+ * their states back
+ *
+ * Channels are identified by their zero-based position in Config::channels(),
+ * and each of them lives on one of the configured GPIO banks. Looking up the
+ * channel for a line, or the line for a channel, is a table lookup, however
+ * many channels there are. A channel's input can also be set up to count the
+ * pulses of a meter, rather than read back the state of the relay, in which
+ * case its edges go to the pulse counter instead of the debouncer, and the
+ * channel never has a state.
+ */
 class InputHandler : public QObject
 {
     Q_OBJECT
 public:
-    InputHandler(QObject *parent = 0);
+    InputHandler(Config *config, QObject *parent = nullptr);
     ~InputHandler() override;
 
-    enum RelayChannel {
-        RelayChannelInvalid = 0,
-        RelayChannel1 = 5,  // Pin 29 - P5
-        RelayChannel2 = 6,  // Pin 31 - P6
-        RelayChannel3 = 13, // Pin 33 - P13
-        RelayChannel4 = 16, // Pin 36 - P16
-        RelayChannel5 = 19, // Pin 35 - P19
-        RelayChannel6 = 20, // Pin 38 - P20
-        RelayChannel7 = 21, // Pin 40 - P21
-        RelayChannel8 = 26, // Pin 37 - P26
-    };
-    Q_ENUM(RelayChannel)
-    enum InputChannel {
-        InputChannelInvalid = 0,
-        InputChannel1 = 2,  // Pin 3  - P2
-        InputChannel2 = 3,  // Pin 5  - P3
-        InputChannel3 = 4,  // Pin 7  - P4
-        InputChannel4 = 17, // Pin 11 - P17
-        InputChannel5 = 27, // Pin 13 - P27
-        InputChannel6 = 22, // Pin 15 - P22
-        InputChannel7 = 10, // Pin 19 - P10
-        InputChannel8 = 9,  // Pin 21 - P9
-    };
-    Q_ENUM(InputChannel)
+    /**
+     * The number of channels
+     */
+    int channelCount() const;
+    /**
+     * The definition of a channel
+     * @param channel The zero-based position of the channel
+     * @return The definition of the channel (which is empty for channels out of range)
+     */
+    const ChannelDefinition &channel(int channel) const;
 
-    InputHandler::RelayChannel channelByNumber(int number) const;
-    Q_SLOT void pulseRelay(InputHandler::RelayChannel channel) const;
-    Q_SLOT void handleKeyPressed(char keyValue);
-    Q_SIGNAL void inputChannelStateChanged(InputHandler::InputChannel channel, const QString& updatedState);
     /**
-     * Fetch the most recently updated channel states for all the channels
-     * @return An ordered list of the most recent states
+     * Pulse the given relay. This returns immediately, and the pulse itself is
+     * performed by the GPIO worker, after any pulse already queued for the same
+     * relay. Pulses on different relays overlap.
+     * @param channel The channel whose relay should be pulsed
+     * @return An identifier for the pulse (or 0 if it could not be scheduled),
+     *         which will be passed to relayPulseCompleted when the pulse is done
+     */
+    Q_SLOT quint64 pulseRelay(int channel) const;
+    /**
+     * Pulse a group of relays at the same time. The relays which are free are
+     * all switched in the same GPIO write, limited by the configured maximum
+     * number of simultaneously energised relays, with the remainder following
+     * as soon as the first ones are released.
+     * @param channels The channels whose relays should be pulsed
+     * @return The identifier of the first pulse, with the rest following on consecutively
+     */
+    Q_SLOT quint64 pulseRelays(const QList<int> &channels) const;
+    /**
+     * Emitted once a relay pulse has been completed
+     * @param channel The channel whose relay was pulsed
+     * @param pulseId The identifier returned by pulseRelay
+     */
+    Q_SIGNAL void relayPulseCompleted(int channel, quint64 pulseId);
+    /**
+     * Emitted when the input of a channel has settled on a new state
+     * @param channel The channel whose state changed
+     * @param updatedState The name of the new state (see stateName)
+     */
+    Q_SIGNAL void inputChannelStateChanged(int channel, const QString& updatedState);
+    /**
+     * The most recently reported states of all the input channels
+     *
+     * The table is indexed by the channel's position, and can be read from any
+     * thread without locking or allocating.
+     * @return The live state table for the input channels
+     */
+    const ChannelStateTable &channelStates() const;
+    /**
+     * The totals and rates of the channels whose inputs are counters
+     */
+    const PulseCounter &pulseCounter() const;
+    /**
+     * The name used to report a channel state, shared so it never needs allocating
+     * @param on Whether to fetch the name of the on or the off state
+     * @return "on" or "off"
+     */
+    static const QString &stateName(bool on);
+    /**
+     * Whether the GPIO banks were set up, so the channels can actually be used
+     */
+    bool isReady() const;
+    /**
+     * The file the last known states are kept in, which also holds whatever
+     * was there from the previous run until the inputs have been read
+     */
+    StateFile *stateFile() const;
+    /**
+     * When the GPIO worker was last seen to be alive (see RelayPulseScheduler::heartbeatNs)
+     * @return The CLOCK_MONOTONIC time in nanoseconds, or 0 if there is no worker
+     */
+    quint64 gpioWorkerHeartbeatNs() const;
+    /**
+     * Ask the GPIO worker to show it is alive, by updating its heartbeat
+     */
+    void pingGpioWorker() const;
+    /**
+     * Pick up the changes from a reloaded configuration. The topics, pulse
+     * timings, debouncing, counter settings and relay limit are applied
+     * straight away, but the GPIO banks and lines, and whether an input is a
+     * counter, stay as they are until the service is restarted.
      */
-    QStringList mostRecentChannelStates() const;
+    Q_SLOT void reloadConfig();
 private:
     std::unique_ptr<InputHandlerPrivate> d;
 };
@@ -0,0 +1,151 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "eventjournal.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSet>
+#include <QTextStream>
+#include <QThread>
+
+#include <cstdio>
+
+/**
+ * Describes what the subject, value and data of an event mean, for showing to a person
+ */
+static QString describe(const EventJournal::Event &event)
+{
+    static const char *commandNames[]{"toggle", "set", "batch"};
+    static const char *verdictNames[]{"accepted", "duplicate delivery", "duplicate command", "rate limited", "expired"};
+    const QString channel{event.subject == 0xffff ? QStringLiteral("batch") : QStringLiteral("channel %1").arg(event.subject + 1)};
+    const QString output{QStringLiteral("bank %1 line %2").arg(event.subject / 64).arg(event.subject % 64)};
+    switch (event.type) {
+        case EventJournal::ServiceStarted:
+            return QStringLiteral("process %1").arg(event.value);
+        case EventJournal::CommandReceived:
+            return QStringLiteral("%1 %2 packet %3").arg(channel).arg(event.value < 3 ? commandNames[event.value] : "unknown").arg(event.data);
+        case EventJournal::CommandRejected:
+            return QStringLiteral("%1 %2 packet %3").arg(channel).arg(event.value < 5 ? verdictNames[event.value] : "unknown").arg(event.data);
+        case EventJournal::PulseScheduled:
+            return QStringLiteral("%1 pulse %2").arg(channel).arg(event.data);
+        case EventJournal::RelayEnergised:
+        case EventJournal::RelayReleased:
+            return QStringLiteral("%1 pulse %2").arg(output).arg(event.data);
+        case EventJournal::InputEdge:
+            return QStringLiteral("%1 %2").arg(channel).arg(event.value ? "high" : "low");
+        case EventJournal::InputStateChanged:
+        case EventJournal::StatePublished:
+            return QStringLiteral("%1 %2").arg(channel).arg(event.value ? "on" : "off");
+        case EventJournal::ConnectionChanged:
+            return event.value ? QStringLiteral("connected") : QStringLiteral("disconnected");
+    }
+    return QString{};
+}
+
+static bool hasChannel(const EventJournal::Event &event)
+{
+    return event.type != EventJournal::ServiceStarted && event.type != EventJournal::ConnectionChanged
+        && event.type != EventJournal::RelayEnergised && event.type != EventJournal::RelayReleased;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("relayboard-journal");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Shows the events recorded in the relayboard-control event journal, oldest first");
+    parser.addHelpOption();
+    parser.addPositionalArgument("journalFile", "The journal to read, which is /var/lib/relayboard-control/journal by default");
+    const QCommandLineOption typeOption{"type", "Only show events of this type (can be given more than once): started, command, rejected, scheduled, energised, released, edge, state, published or connection", "type"};
+    const QCommandLineOption channelOption{"channel", "Only show events for this channel (counting from 1)", "channel"};
+    const QCommandLineOption lastOption{"last", "Only show this many of the latest events", "count"};
+    const QCommandLineOption jsonOption{"json", "Write every event out as a line of JSON"};
+    const QCommandLineOption followOption{"follow", "Keep showing new events as they are recorded"};
+    parser.addOptions({typeOption, channelOption, lastOption, jsonOption, followOption});
+    parser.process(app);
+
+    const QString fileName{parser.positionalArguments().value(0, QStringLiteral("/var/lib/relayboard-control/journal"))};
+    QSet<QString> types;
+    for (const QString &type : parser.values(typeOption)) {
+        for (const QString &name : type.split(',', QString::SkipEmptyParts)) {
+            types << name.trimmed();
+        }
+    }
+    const int channel{parser.isSet(channelOption) ? parser.value(channelOption).toInt() - 1 : -1};
+    const int last{parser.value(lastOption).toInt()};
+    const bool json{parser.isSet(jsonOption)};
+
+    QTextStream out(stdout);
+    quint64 nextSequence{0};
+    do {
+        QVector<EventJournal::Event> events;
+        const QString error{EventJournal::read(fileName, events, nextSequence)};
+        if (!error.isEmpty()) {
+            fprintf(stderr, "Could not read %s: %s\n", qPrintable(fileName), qPrintable(error));
+            return 1;
+        }
+        QVector<EventJournal::Event> shown;
+        for (const EventJournal::Event &event : qAsConst(events)) {
+            if (!types.isEmpty() && !types.contains(QLatin1String(EventJournal::typeName(event.type)))) {
+                continue;
+            }
+            if (channel > -1 && (!hasChannel(event) || event.subject != channel)) {
+                continue;
+            }
+            shown << event;
+        }
+        if (nextSequence == 0 && last > 0 && shown.count() > last) {
+            shown.remove(0, shown.count() - last);
+        }
+        for (const EventJournal::Event &event : qAsConst(shown)) {
+            const QString time{event.realtimeNs > 0
+                ? QDateTime::fromMSecsSinceEpoch(event.realtimeNs / 1000000).toString(Qt::ISODateWithMs) + QString::asprintf("%06lld", event.realtimeNs % 1000000)
+                : QString::number(double(event.timestampNs) / 1e9, 'f', 9)};
+            if (json) {
+                QJsonObject object;
+                object.insert(QStringLiteral("sequence"), double(event.sequence - 1));
+                object.insert(QStringLiteral("time"), time);
+                object.insert(QStringLiteral("monotonicNs"), double(event.timestampNs));
+                object.insert(QStringLiteral("type"), QLatin1String(EventJournal::typeName(event.type)));
+                object.insert(QStringLiteral("subject"), event.subject);
+                object.insert(QStringLiteral("value"), double(event.value));
+                object.insert(QStringLiteral("data"), double(event.data));
+                object.insert(QStringLiteral("description"), describe(event));
+                out << QJsonDocument(object).toJson(QJsonDocument::Compact) << '\n';
+            } else {
+                out << time << ' ' << EventJournal::typeName(event.type) << ' ' << describe(event) << '\n';
+            }
+        }
+        out.flush();
+        if (!events.isEmpty()) {
+            nextSequence = events.last().sequence + 1;
+        } else if (nextSequence == 0) {
+            nextSequence = 1;
+        }
+        if (parser.isSet(followOption)) {
+            QThread::msleep(200);
+        }
+    } while (parser.isSet(followOption));
+    return 0;
+}
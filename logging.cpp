@@ -0,0 +1,346 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "logging.h"
+
+#include <QThread>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+Q_LOGGING_CATEGORY(RELAYBOARD_GPIO, "relayboard.gpio")
+Q_LOGGING_CATEGORY(RELAYBOARD_MQTT, "relayboard.mqtt")
+Q_LOGGING_CATEGORY(RELAYBOARD_CONFIG, "relayboard.config")
+Q_LOGGING_CATEGORY(RELAYBOARD_METRICS, "relayboard.metrics")
+Q_LOGGING_CATEGORY(RELAYBOARD_CONTROL, "relayboard.control")
+
+namespace {
+/**
+ * A single formatted log line, sitting in the ring buffer
+ */
+struct LogSlot {
+    std::atomic<quint64> sequence{0};
+    int length{0};
+    char text[240];
+};
+
+/**
+ * A bounded lock-free queue for many producers and a single consumer
+ *
+ * Each slot carries a sequence number, which tells a producer whether the
+ * slot is free for its position in the queue, and tells the consumer whether
+ * the producer has finished writing it. Producers never wait for each other,
+ * or for the consumer, beyond the odd retry of a compare and swap.
+ */
+class LogRing {
+public:
+    static constexpr quint64 Capacity{1024};
+    LogRing() {
+        for (quint64 index = 0; index < Capacity; ++index) {
+            slots[index].sequence.store(index, std::memory_order_relaxed);
+        }
+    }
+    LogSlot *claim(quint64 &position) {
+        position = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            LogSlot *slot{&slots[position % Capacity]};
+            const qint64 difference{qint64(slot->sequence.load(std::memory_order_acquire)) - qint64(position)};
+            if (difference == 0) {
+                if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    return slot;
+                }
+            } else if (difference < 0) {
+                // The consumer has not caught up, so the ring is full
+                return nullptr;
+            } else {
+                position = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    static void publish(LogSlot *slot, quint64 position) {
+        slot->sequence.store(position + 1, std::memory_order_release);
+    }
+    LogSlot *next() {
+        LogSlot *slot{&slots[head % Capacity]};
+        return slot->sequence.load(std::memory_order_acquire) == head + 1 ? slot : nullptr;
+    }
+    void release(LogSlot *slot) {
+        slot->sequence.store(head + Capacity, std::memory_order_release);
+        ++head;
+    }
+    std::atomic<quint64> dropped{0};
+private:
+    LogSlot slots[Capacity];
+    std::atomic<quint64> tail{0};
+    // Only touched by the consumer
+    quint64 head{0};
+};
+
+class LogWriterThread : public QThread
+{
+public:
+    void run() override;
+    std::atomic<bool> shouldAbort{false};
+};
+
+LogRing *ring{nullptr};
+LogWriterThread *writerThread{nullptr};
+// The writer sleeps on an eventfd while the ring is empty. It says it is about
+// to go to sleep before having a last look at the ring, and a producer which
+// finds it asleep after publishing a line wakes it up, so only the message
+// which ends an idle spell costs a syscall. Like the ring, these outlive the
+// writer thread, as other threads may still be logging when it is shut down.
+int writerWakeFd{-1};
+std::atomic<bool> writerSleeping{false};
+
+void wakeWriter() {
+    const quint64 one{1};
+    if (write(writerWakeFd, &one, sizeof(one)) < 0) {
+        // Only fails if the counter is about to overflow, in which case the writer is awake anyway
+    }
+}
+QtMessageHandler previousHandler{nullptr};
+// Under systemd, stderr goes to the journal, which understands the <N> priority prefixes
+const bool usePriorityPrefix{qEnvironmentVariableIsSet("JOURNAL_STREAM")};
+
+int syslogPriority(QtMsgType type) {
+    switch (type) {
+        case QtDebugMsg:
+            return 7;
+        case QtInfoMsg:
+            return 6;
+        case QtWarningMsg:
+            return 4;
+        case QtCriticalMsg:
+            return 3;
+        case QtFatalMsg:
+            break;
+    }
+    return 2;
+}
+
+// Converts straight into the slot, so logging does not need to allocate anything
+int appendUtf8(char *buffer, int length, int capacity, const QChar *text, int count) {
+    for (int index = 0; index < count; ++index) {
+        uint code{text[index].unicode()};
+        if (QChar::isHighSurrogate(code) && index + 1 < count && text[index + 1].isLowSurrogate()) {
+            code = QChar::surrogateToUcs4(ushort(code), text[++index].unicode());
+        }
+        if (code < 0x80) {
+            if (length + 1 > capacity) {
+                break;
+            }
+            buffer[length++] = char(code);
+        } else if (code < 0x800) {
+            if (length + 2 > capacity) {
+                break;
+            }
+            buffer[length++] = char(0xc0 | (code >> 6));
+            buffer[length++] = char(0x80 | (code & 0x3f));
+        } else if (code < 0x10000) {
+            if (length + 3 > capacity) {
+                break;
+            }
+            buffer[length++] = char(0xe0 | (code >> 12));
+            buffer[length++] = char(0x80 | ((code >> 6) & 0x3f));
+            buffer[length++] = char(0x80 | (code & 0x3f));
+        } else {
+            if (length + 4 > capacity) {
+                break;
+            }
+            buffer[length++] = char(0xf0 | (code >> 18));
+            buffer[length++] = char(0x80 | ((code >> 12) & 0x3f));
+            buffer[length++] = char(0x80 | ((code >> 6) & 0x3f));
+            buffer[length++] = char(0x80 | (code & 0x3f));
+        }
+    }
+    return length;
+}
+
+int formatLine(char *buffer, int capacity, int priority, const char *category, const QString &message) {
+    int length{0};
+    if (usePriorityPrefix) {
+        buffer[length++] = '<';
+        buffer[length++] = char('0' + priority);
+        buffer[length++] = '>';
+    }
+    // The default category is what plain qDebug() uses, and is left out
+    if (category && strcmp(category, "default") != 0) {
+        const int categoryLength{qMin(int(strlen(category)), capacity / 4)};
+        memcpy(buffer + length, category, size_t(categoryLength));
+        length += categoryLength;
+        buffer[length++] = ':';
+        buffer[length++] = ' ';
+    }
+    // Leave room for the newline
+    length = appendUtf8(buffer, length, capacity - 1, message.constData(), message.size());
+    buffer[length++] = '\n';
+    return length;
+}
+
+void writeAll(const char *data, int length) {
+    while (length > 0) {
+        const ssize_t written{write(STDERR_FILENO, data, size_t(length))};
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        data += written;
+        length -= int(written);
+    }
+}
+
+// Writes out everything currently in the ring, returning whether there was anything
+bool drainRing() {
+    static char batch[64 * 1024];
+    int length{0};
+    bool foundAny{false};
+    while (LogSlot *slot = ring->next()) {
+        foundAny = true;
+        if (length + slot->length > int(sizeof(batch))) {
+            writeAll(batch, length);
+            length = 0;
+        }
+        memcpy(batch + length, slot->text, size_t(slot->length));
+        length += slot->length;
+        ring->release(slot);
+    }
+    const quint64 dropped{ring->dropped.exchange(0, std::memory_order_relaxed)};
+    if (dropped > 0) {
+        char line[128];
+        const int lineLength{formatLine(line, int(sizeof(line)), 4, nullptr, QStringLiteral("%1 log messages were dropped, as they came in faster than they could be written").arg(dropped))};
+        if (length + lineLength > int(sizeof(batch))) {
+            writeAll(batch, length);
+            length = 0;
+        }
+        memcpy(batch + length, line, size_t(lineLength));
+        length += lineLength;
+    }
+    writeAll(batch, length);
+    return foundAny;
+}
+
+void LogWriterThread::run()
+{
+    while (!shouldAbort) {
+        if (drainRing()) {
+            continue;
+        }
+        if (writerWakeFd < 0) {
+            // Without an eventfd, fall back to looking every so often
+            QThread::msleep(20);
+            continue;
+        }
+        writerSleeping.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        // Something may have come in between finding the ring empty and saying we are going to sleep
+        if (!drainRing() && !shouldAbort) {
+            quint64 wakeups{0};
+            while (read(writerWakeFd, &wakeups, sizeof(wakeups)) < 0 && errno == EINTR) {}
+        }
+        writerSleeping.store(false);
+    }
+    drainRing();
+}
+
+// Serialises the fatal path, which drains the ring from whichever thread is going down
+std::mutex fatalMutex;
+
+void asyncMessageHandler(QtMsgType type, const QMessageLogContext &context, const QString &message)
+{
+    const int priority{syslogPriority(type)};
+    if (type == QtFatalMsg) {
+        // We are about to go down, so get everything out first, in the right
+        // order: the writer is stopped, and whatever it had not got to yet is
+        // written out from here, before the fatal message itself
+        std::lock_guard<std::mutex> lock(fatalMutex);
+        if (writerThread && QThread::currentThread() != writerThread) {
+            writerThread->shouldAbort = true;
+            wakeWriter();
+            writerThread->wait();
+        }
+        drainRing();
+        char line[sizeof(LogSlot::text)];
+        const int length{formatLine(line, int(sizeof(line)), priority, context.category, message)};
+        writeAll(line, length);
+        return;
+    }
+    quint64 position{0};
+    LogSlot *slot{ring->claim(position)};
+    if (!slot) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    slot->length = formatLine(slot->text, int(sizeof(slot->text)), priority, context.category, message);
+    LogRing::publish(slot, position);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (writerSleeping.load(std::memory_order_relaxed) && writerSleeping.exchange(false)) {
+        wakeWriter();
+    }
+}
+}
+
+void AsyncLogSink::install()
+{
+    if (writerThread) {
+        return;
+    }
+    ring = new LogRing;
+    writerWakeFd = eventfd(0, EFD_CLOEXEC);
+    writerThread = new LogWriterThread;
+    writerThread->setObjectName(QStringLiteral("LogWriter"));
+    writerThread->start(QThread::LowPriority);
+    previousHandler = qInstallMessageHandler(asyncMessageHandler);
+}
+
+void AsyncLogSink::shutdown()
+{
+    if (!writerThread) {
+        return;
+    }
+    qInstallMessageHandler(previousHandler);
+    writerThread->shouldAbort = true;
+    wakeWriter();
+    writerThread->wait();
+    delete writerThread;
+    writerThread = nullptr;
+    // Anything still logging on another thread may be holding on to a slot, so the ring stays around
+}
+
+void AsyncLogSink::setFilter(const QString &level, const QString &rules)
+{
+    static const QStringList levels{QStringLiteral("debug"), QStringLiteral("info"), QStringLiteral("warning"), QStringLiteral("critical")};
+    QStringList filterRules;
+    const int lowest{levels.indexOf(level.toLower())};
+    if (lowest < 0) {
+        qCWarning(RELAYBOARD_CONFIG) << "Unknown log level" << level << "- logging everything";
+    }
+    for (int index = 0; index < lowest; ++index) {
+        filterRules << QStringLiteral("relayboard.*.%1=false").arg(levels.at(index));
+    }
+    for (const QString &rule : rules.split(QLatin1Char(';'), QString::SkipEmptyParts)) {
+        filterRules << rule.trimmed();
+    }
+    QLoggingCategory::setFilterRules(filterRules.join(QLatin1Char('\n')));
+}
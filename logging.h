@@ -0,0 +1,65 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LOGGING_H
+#define LOGGING_H
+
+#include <QLoggingCategory>
+
+// The logging categories for each part of the service. Use these with
+// qCDebug() and friends, which skip formatting the message entirely when the
+// category is disabled (and disappear completely for debug messages when
+// built with RELAYBOARD_DEBUG_LOGGING turned off).
+Q_DECLARE_LOGGING_CATEGORY(RELAYBOARD_GPIO)
+Q_DECLARE_LOGGING_CATEGORY(RELAYBOARD_MQTT)
+Q_DECLARE_LOGGING_CATEGORY(RELAYBOARD_CONFIG)
+Q_DECLARE_LOGGING_CATEGORY(RELAYBOARD_METRICS)
+Q_DECLARE_LOGGING_CATEGORY(RELAYBOARD_CONTROL)
+
+/**
+ * Writes log messages out on a background thread
+ *
+ * Once installed, every log message is copied into a preallocated ring
+ * buffer, and a background thread writes them to stderr in batches. Logging
+ * never blocks the thread doing it: if the buffer is full, the message is
+ * dropped (and the number of dropped messages is reported once there is room
+ * again). When running under systemd, each line is prefixed with its syslog
+ * priority, so the journal records the right level for it.
+ */
+class AsyncLogSink
+{
+public:
+    /**
+     * Start the background thread and route all log messages through it
+     */
+    static void install();
+    /**
+     * Write out everything still in the buffer, stop the background thread,
+     * and go back to writing log messages directly
+     */
+    static void shutdown();
+    /**
+     * Set which messages are logged
+     * @param level The lowest level to log for our own categories: debug, info, warning or critical
+     * @param rules Further QLoggingCategory filter rules, separated by semicolons
+     *              (for example relayboard.mqtt.debug=true), which take precedence over the level
+     */
+    static void setFilter(const QString &level, const QString &rules = QString{});
+};
+
+#endif//LOGGING_H
@@ -20,8 +20,15 @@
 #include <QCommandLineParser>
 
 #include "config.h"
+#include "configwatcher.h"
+#include "controlserver.h"
+#include "eventjournal.h"
 #include "inputhandler.h"
+#include "logging.h"
+#include "metricsexporter.h"
 #include "mqttclient.h"
+#include "servicenotifier.h"
+#include "shutdownwatcher.h"
 
 int main(int argc, char *argv[])
 {
@@ -38,6 +45,7 @@ int main(int argc, char *argv[])
     parser.addPositionalArgument("configurationFile", QString("A configuration file which describes which mqtt topics to use for what, as well as the server details for the mqtt broker. Default is %1").arg(configFileLoation));
 
     parser.process(app);
+    AsyncLogSink::install();
 
     const QStringList args{parser.positionalArguments()};
     if (args.length() > 0) {
@@ -45,14 +53,46 @@ int main(int argc, char *argv[])
     }
 
     Config config(configFileLoation);
+    AsyncLogSink::setFilter(config.logLevel(), config.logRules());
+    ServiceNotifier::markStartup("configuration loaded");
+    // Opened before anything else starts, as the GPIO worker records into it
+    // from the moment it is running (a new location only takes effect on restart)
+    if (!config.journalFile().isEmpty()) {
+        EventJournal::instance().open(config.journalFile(), config.journalSize());
+    }
 
-    InputHandler inputHandler;
+    InputHandler inputHandler(&config);
+    ServiceNotifier serviceNotifier(&inputHandler);
     MqttClient mqttClient(&config, &inputHandler);
+    MetricsExporter metricsExporter(&config);
+    ControlServer controlServer(&config, &inputHandler, mqttClient.stateController());
+    // The input handler must see a reloaded configuration first, as the client gets the channel topics from it
+    QObject::connect(&config, &Config::reloaded, &inputHandler, &InputHandler::reloadConfig);
+    QObject::connect(&config, &Config::reloaded, &mqttClient, &MqttClient::reloadConfig);
+    QObject::connect(&config, &Config::reloaded, &controlServer, &ControlServer::reloadConfig);
+    QObject::connect(&config, &Config::reloaded, &config, [&config](){
+        AsyncLogSink::setFilter(config.logLevel(), config.logRules());
+    });
+    ConfigWatcher configWatcher(&config);
+    // Everything above is torn down properly once the event loop returns, rather than the process just being killed
+    ShutdownWatcher shutdownWatcher;
+    QObject::connect(&mqttClient, &MqttClient::connectedChanged, &serviceNotifier, [&serviceNotifier](bool connected){
+        serviceNotifier.setStatus(connected ? QStringLiteral("Connected to the MQTT broker") : QStringLiteral("Waiting for the MQTT broker"));
+    });
+    metricsExporter.start();
+    controlServer.start();
     if (config.isValid()) {
         mqttClient.start();
     } else {
-        qWarning() << "Failed to load configuration file. Please install a correctly formatted configuration file into" << configFileLoation << "and try again";
+        qCWarning(RELAYBOARD_CONFIG) << "Failed to load configuration file. Please install a correctly formatted configuration file into" << configFileLoation << "and try again";
+    }
+    // The relays can be driven and their states are known as soon as the GPIO
+    // banks are up, so there is no reason to hold back for the broker
+    if (inputHandler.isReady()) {
+        serviceNotifier.notifyReady();
     }
 
     app.exec();
+    serviceNotifier.notifyStopping();
+    AsyncLogSink::shutdown();
 }
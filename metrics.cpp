@@ -0,0 +1,128 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "metrics.h"
+
+namespace {
+struct CounterDescription {
+    const char *name;
+    const char *help;
+};
+const CounterDescription counterDescriptions[Metrics::CounterCount]{
+    {"relayboard_messages_received_total", "Messages received from the MQTT broker"},
+    {"relayboard_unrouted_messages_total", "Messages received on topics which are not ours, and so dropped"},
+    {"relayboard_duplicate_commands_total", "Commands which were ignored as duplicates of one already handled"},
+    {"relayboard_rate_limited_commands_total", "Commands which were ignored for arriving faster than the rate limit allows"},
+    {"relayboard_redundant_commands_total", "Set commands which needed no pulse, as the channel was already in the requested state"},
+    {"relayboard_set_state_failures_total", "Set commands which failed to bring the channel into the requested state"},
+    {"relayboard_pulses_scheduled_total", "Relay pulses scheduled"},
+    {"relayboard_pulses_completed_total", "Relay pulses completed"},
+    {"relayboard_states_published_total", "Channel states published to the MQTT broker"},
+    {"relayboard_publish_failures_total", "Channel states which could not be published"},
+    {"relayboard_reconnects_total", "Attempts at reconnecting to the MQTT broker"},
+    {"relayboard_control_commands_total", "Commands received through the local control socket"},
+    {"relayboard_expired_commands_total", "Commands which were ignored for being older than the maximum command age when they arrived"},
+    {"relayboard_suppressed_transitions_total", "Input transitions which the debouncer dropped as bounce"},
+};
+const CounterDescription histogramDescriptions[Metrics::HistogramCount]{
+    {"relayboard_command_to_relay_seconds", "Time from a command arriving to the relay being energised"},
+    {"relayboard_edge_to_publish_seconds", "Time from an input edge to its state being published"},
+    {"relayboard_wakeup_jitter_seconds", "How late the relay pulse worker woke up to release a relay"},
+    {"relayboard_pulse_width_error_seconds", "Difference between the achieved and the requested relay pulse width"},
+    {"relayboard_command_transit_seconds", "Time from the sender stamping a command to it arriving"},
+};
+const char *summaryNames[Metrics::HistogramCount]{"commandToRelay", "edgeToPublish", "wakeupJitter", "pulseWidthError", "commandTransit"};
+}
+
+qint64 LatencyHistogram::quantileUs(double quantile) const
+{
+    quint64 total{0};
+    for (int bucket = 0; bucket <= BucketCount; ++bucket) {
+        total += bucketCount(bucket);
+    }
+    if (total == 0) {
+        return -1;
+    }
+    const quint64 rank{qMax(quint64(1), quint64(quantile * total + 0.5))};
+    quint64 seen{0};
+    for (int bucket = 0; bucket < BucketCount; ++bucket) {
+        seen += bucketCount(bucket);
+        if (seen >= rank) {
+            return qint64(BucketBoundsUs[bucket]);
+        }
+    }
+    return -1;
+}
+
+Metrics &Metrics::instance()
+{
+    static Metrics metrics;
+    return metrics;
+}
+
+QByteArray Metrics::prometheusText() const
+{
+    QByteArray text;
+    text.reserve(4096);
+    for (int index = 0; index < CounterCount; ++index) {
+        const CounterDescription &description{counterDescriptions[index]};
+        text += QByteArray("# HELP ") + description.name + ' ' + description.help + '\n';
+        text += QByteArray("# TYPE ") + description.name + " counter\n";
+        text += QByteArray(description.name) + ' ' + QByteArray::number(counter(Counter(index))) + '\n';
+    }
+    for (int index = 0; index < HistogramCount; ++index) {
+        const CounterDescription &description{histogramDescriptions[index]};
+        const LatencyHistogram &latencies{m_histograms[index]};
+        const QByteArray name{description.name};
+        text += "# HELP " + name + ' ' + description.help + '\n';
+        text += "# TYPE " + name + " histogram\n";
+        // The buckets are read one at a time, so the count is made up from
+        // them, to keep it consistent with the buckets if something is
+        // recorded while we are going through them
+        quint64 cumulative{0};
+        for (int bucket = 0; bucket < LatencyHistogram::BucketCount; ++bucket) {
+            cumulative += latencies.bucketCount(bucket);
+            text += name + "_bucket{le=\"" + QByteArray::number(double(LatencyHistogram::BucketBoundsUs[bucket]) / 1000000.0, 'g', 6) + "\"} " + QByteArray::number(cumulative) + '\n';
+        }
+        cumulative += latencies.bucketCount(LatencyHistogram::BucketCount);
+        text += name + "_bucket{le=\"+Inf\"} " + QByteArray::number(cumulative) + '\n';
+        text += name + "_sum " + QByteArray::number(double(latencies.sumNs()) / 1000000000.0, 'g', 9) + '\n';
+        text += name + "_count " + QByteArray::number(cumulative) + '\n';
+    }
+    return text;
+}
+
+QJsonObject Metrics::summary() const
+{
+    QJsonObject summary;
+    for (int index = 0; index < CounterCount; ++index) {
+        // The names without the prefix and suffix Prometheus wants
+        QString name{QString::fromLatin1(counterDescriptions[index].name)};
+        name = name.mid(11, name.length() - 17);
+        summary.insert(name, double(counter(Counter(index))));
+    }
+    for (int index = 0; index < HistogramCount; ++index) {
+        const LatencyHistogram &latencies{m_histograms[index]};
+        QJsonObject histogram;
+        histogram.insert(QStringLiteral("count"), double(latencies.count()));
+        histogram.insert(QStringLiteral("p50"), double(latencies.quantileUs(0.5)));
+        histogram.insert(QStringLiteral("p99"), double(latencies.quantileUs(0.99)));
+        summary.insert(QString::fromLatin1(summaryNames[index]), histogram);
+    }
+    return summary;
+}
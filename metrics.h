@@ -0,0 +1,152 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QByteArray>
+#include <QJsonObject>
+
+#include <atomic>
+
+/**
+ * A latency histogram with fixed buckets
+ *
+ * Recording a value is a handful of relaxed atomic increments, so it can be
+ * done from any thread (including the GPIO worker) without taking a lock.
+ */
+class LatencyHistogram
+{
+public:
+    // The upper bounds of the buckets, in microseconds, with one more bucket for anything above
+    static constexpr int BucketCount{17};
+    static constexpr quint64 BucketBoundsUs[BucketCount]{
+        5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000
+    };
+
+    /**
+     * Record a single latency
+     * @param latencyNs The latency in nanoseconds
+     */
+    void record(quint64 latencyNs) {
+        const quint64 latencyUs{latencyNs / 1000};
+        int bucket{0};
+        while (bucket < BucketCount && latencyUs > BucketBoundsUs[bucket]) {
+            ++bucket;
+        }
+        m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        m_sumNs.fetch_add(latencyNs, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+    }
+    quint64 count() const {
+        return m_count.load(std::memory_order_relaxed);
+    }
+    quint64 sumNs() const {
+        return m_sumNs.load(std::memory_order_relaxed);
+    }
+    /**
+     * The number of latencies recorded in a single bucket (not cumulative)
+     * @param bucket The bucket, where BucketCount is the one for everything above the last bound
+     */
+    quint64 bucketCount(int bucket) const {
+        return m_buckets[bucket].load(std::memory_order_relaxed);
+    }
+    /**
+     * An estimate of a quantile, as the upper bound of the bucket it falls in
+     * @param quantile The quantile to estimate, between 0 and 1
+     * @return The estimate in microseconds, or -1 if there is nothing recorded
+     *         (or the quantile is beyond the last bucket)
+     */
+    qint64 quantileUs(double quantile) const;
+private:
+    std::atomic<quint64> m_buckets[BucketCount + 1]{};
+    std::atomic<quint64> m_sumNs{0};
+    std::atomic<quint64> m_count{0};
+};
+
+/**
+ * The counters and latency histograms for the hot paths of the service
+ *
+ * There is a single instance for the whole process, which is written to from
+ * wherever the events happen, and read by the exporters.
+ */
+class Metrics
+{
+public:
+    enum Counter {
+        MessagesReceived = 0,
+        UnroutedMessages,
+        DuplicateCommands,
+        RateLimitedCommands,
+        RedundantCommands,
+        SetStateFailures,
+        PulsesScheduled,
+        PulsesCompleted,
+        StatesPublished,
+        PublishFailures,
+        Reconnects,
+        ControlCommands,
+        ExpiredCommands,
+        SuppressedTransitions,
+        CounterCount
+    };
+    enum Histogram {
+        // From a command arriving from the broker to the relay being energised
+        CommandToRelay = 0,
+        // From the edge on an input line to its state being published
+        EdgeToPublish,
+        // How late the relay pulse worker woke up for the release of a relay
+        WakeupJitter,
+        // How far the achieved width of a relay pulse was from the requested one
+        PulseWidthError,
+        // From the sender of a command stamping it to it arriving (MQTT 5 only, and only as good as the clocks agree)
+        CommandTransit,
+        HistogramCount
+    };
+
+    static Metrics &instance();
+
+    void increment(Counter counter, quint64 amount = 1) {
+        m_counters[counter].fetch_add(amount, std::memory_order_relaxed);
+    }
+    quint64 counter(Counter counter) const {
+        return m_counters[counter].load(std::memory_order_relaxed);
+    }
+    void record(Histogram histogram, quint64 latencyNs) {
+        m_histograms[histogram].record(latencyNs);
+    }
+    const LatencyHistogram &histogram(Histogram histogram) const {
+        return m_histograms[histogram];
+    }
+
+    /**
+     * All the metrics in the Prometheus text exposition format
+     */
+    QByteArray prometheusText() const;
+    /**
+     * A short summary of the metrics, with the counters and the median and
+     * 99th percentile of each histogram (in microseconds)
+     */
+    QJsonObject summary() const;
+private:
+    Metrics() = default;
+    std::atomic<quint64> m_counters[CounterCount]{};
+    LatencyHistogram m_histograms[HistogramCount];
+};
+
+#endif//METRICS_H
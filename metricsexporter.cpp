@@ -0,0 +1,125 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "metricsexporter.h"
+#include "logging.h"
+#include "metrics.h"
+
+#include <QDebug>
+#include <QHostAddress>
+#include <QSaveFile>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+
+class MetricsExporterPrivate {
+public:
+    MetricsExporterPrivate() {}
+    Config *config{nullptr};
+    QTcpServer *server{nullptr};
+    QTimer *fileTimer{nullptr};
+
+    void writeFile() {
+        QSaveFile file(config->metricsFile());
+        if (!file.open(QIODevice::WriteOnly) || file.write(Metrics::instance().prometheusText()) < 0 || !file.commit()) {
+            qCWarning(RELAYBOARD_METRICS) << "Failed to write the metrics to" << config->metricsFile() << ":" << file.errorString();
+        }
+    }
+    static void handleRequest(QTcpSocket *socket) {
+        if (socket->property("answered").toBool()) {
+            socket->readAll();
+            return;
+        }
+        // All we need is the request line, and anything more than that is none of our business
+        if (!socket->canReadLine()) {
+            if (socket->bytesAvailable() > 4096) {
+                socket->abort();
+            }
+            return;
+        }
+        const QList<QByteArray> request{socket->readLine(4096).trimmed().split(' ')};
+        QByteArray status{"200 OK"};
+        QByteArray body;
+        if (request.count() < 2 || request.at(0) != "GET") {
+            status = "405 Method Not Allowed";
+        } else if (request.at(1) != "/metrics") {
+            status = "404 Not Found";
+        } else {
+            body = Metrics::instance().prometheusText();
+        }
+        socket->write("HTTP/1.0 " + status + "\r\n"
+                      "Content-Type: text/plain; version=0.0.4\r\n"
+                      "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+                      "Connection: close\r\n\r\n");
+        socket->write(body);
+        socket->setProperty("answered", true);
+        socket->disconnectFromHost();
+    }
+};
+
+MetricsExporter::MetricsExporter(Config *config, QObject *parent)
+    : QObject(parent)
+    , d(new MetricsExporterPrivate)
+{
+    d->config = config;
+}
+
+MetricsExporter::~MetricsExporter()
+{
+    stop();
+}
+
+void MetricsExporter::start()
+{
+    if (d->config->metricsPort() > 0 && !d->server) {
+        d->server = new QTcpServer(this);
+        connect(d->server, &QTcpServer::newConnection, this, [this](){
+            while (QTcpSocket *socket = d->server->nextPendingConnection()) {
+                connect(socket, &QTcpSocket::readyRead, socket, [socket](){ MetricsExporterPrivate::handleRequest(socket); });
+                connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+                // Do not let a client which never sends a request hang on to the connection
+                QTimer::singleShot(5000, socket, &QTcpSocket::abort);
+            }
+        });
+        if (d->server->listen(QHostAddress{d->config->metricsAddress()}, quint16(d->config->metricsPort()))) {
+            qCInfo(RELAYBOARD_METRICS) << "Serving metrics on" << d->config->metricsAddress() << d->config->metricsPort();
+        } else {
+            qCWarning(RELAYBOARD_METRICS) << "Failed to serve metrics on" << d->config->metricsAddress() << d->config->metricsPort() << ":" << d->server->errorString();
+        }
+    }
+    if (!d->config->metricsFile().isEmpty() && !d->fileTimer) {
+        d->fileTimer = new QTimer(this);
+        connect(d->fileTimer, &QTimer::timeout, this, [this](){ d->writeFile(); });
+        d->fileTimer->start(qMax(1000, d->config->metricsInterval()));
+        d->writeFile();
+    }
+}
+
+void MetricsExporter::stop()
+{
+    if (d->server) {
+        d->server->close();
+        d->server->deleteLater();
+        d->server = nullptr;
+    }
+    if (d->fileTimer) {
+        d->fileTimer->stop();
+        d->fileTimer->deleteLater();
+        d->fileTimer = nullptr;
+    }
+}
@@ -0,0 +1,49 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef METRICSEXPORTER_H
+#define METRICSEXPORTER_H
+
+#include <QObject>
+#include <memory>
+
+#include "config.h"
+
+class MetricsExporterPrivate;
+/**
+ * Makes the metrics available to Prometheus
+ *
+ * Depending on the configuration, this serves the metrics over HTTP (on
+ * /metrics, as Prometheus expects to scrape them), and writes them to a text
+ * file at regular intervals, for the node exporter's textfile collector to
+ * pick up. The file is replaced atomically, so it is never seen half written.
+ */
+class MetricsExporter : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MetricsExporter(Config *config, QObject *parent = nullptr);
+    ~MetricsExporter() override;
+
+    Q_SLOT void start();
+    Q_SLOT void stop();
+private:
+    std::unique_ptr<MetricsExporterPrivate> d;
+};
+
+#endif//METRICSEXPORTER_H
@@ -17,28 +17,31 @@
 */
 
 #include "mqttclient.h"
+#include "commandadmission.h"
+#include "eventjournal.h"
+#include "logging.h"
+#include "metrics.h"
+#include "monotonicclock.h"
+#include "pulsecounter.h"
+#include "servicenotifier.h"
+#include "statecontroller.h"
+#include "statefile.h"
+#include "statuspublishtable.h"
+#include "topicrouter.h"
 
+#include <QDateTime>
 #include <QDebug>
+#include <QtEndian>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRandomGenerator>
+#include <QSet>
+#include <QTimer>
 
-class Subscription {
-public:
-    Subscription(MqttClient *q, InputHandler::RelayChannel channel, QMqttSubscription *subscription)
-        : q(q)
-        , channel(channel)
-        , subscription(subscription)
-    {
-        QObject::connect(subscription, &QMqttSubscription::messageReceived, q, [channel,subscription,q](const QMqttMessage &msg){
-            qDebug() << "Received message" << msg.payload() << "for topic" << subscription->topic().filter();
-            q->inputHandler()->pulseRelay(channel);
-        });
-        QObject::connect(subscription, &QMqttSubscription::stateChanged, q, [this](){});
-        QObject::connect(subscription, &QMqttSubscription::qosChanged, q, [this](){});
-        qDebug() << "Subscribed to" << subscription->topic().filter() << "with the parent" << q;
-    }
-    MqttClient* q;
-    InputHandler::RelayChannel channel;
-    QMqttSubscription *subscription;
-};
+#ifdef HAVE_MQTT5
+// How many topic aliases the broker may use for the commands it sends us
+static constexpr quint16 InboundTopicAliases{256};
+#endif
 
 class MqttClientPrivate {
 public:
@@ -50,26 +53,585 @@ public:
     InputHandler *inputHandler{nullptr};;
 
     QMqttClient *client{nullptr};
-    QList<Subscription> subscriptions;
+    QList<QMqttSubscription*> subscriptions;
+    // The filters we have asked the broker for, so a reload knows what to change
+    QStringList subscribedFilters;
+    // The subscriptions whose messages we are already dispatching, which
+    // survive a reconnect if the client hands the same one back to us
+    QSet<QMqttSubscription*> dispatchingSubscriptions;
+    CommandAdmission admission;
+    // What the admission was last set up with, as setting it up again forgets
+    // the command IDs and refills the rate limits
+    int admissionIdWindow{-1};
+    double admissionRate{-1};
+    int admissionBurst{-1};
+    StateController *stateController{nullptr};
+    QHash<QString, SceneDefinition> scenes;
+    TopicRouter router;
+    StatusPublishTable statusTable;
+    // Identifies the status topics, so what the state file says was published can be trusted
+    quint32 statusTopicsHash{0};
+
+    // Reconnecting after losing the broker
+    QTimer *reconnectTimer{nullptr};
+    int reconnectAttempt{0};
+    bool hasConnected{false};
+    bool hasPublished{false};
+    // The channels whose state has changed since we last published. Only the
+    // latest state of each channel matters, and that is always in the state
+    // table, so this is all the queue we need, both for coalescing changes
+    // which happen close together and for holding on to them while we are
+    // disconnected, and it can never outgrow the channels.
+    quint64 pendingChannels{0};
+    // What the broker was last told, so changes which cancel out are not published
+    quint64 publishedStates{0};
+    quint64 publishedKnown{0};
+    QTimer *batchTimer{nullptr};
+    static constexpr int PublishRetryMs{250};
+    QMqttTopicName aggregateTopic;
+    // Set when the aggregate state needs publishing, even if no channel has changed
+    bool aggregateDirty{false};
+    QTimer *statsTimer{nullptr};
+    QTimer *counterTimer{nullptr};
+#ifdef HAVE_MQTT5
+    // The topic aliases for the status and aggregate topics, which are set up
+    // once connected, as that is when we find out how many the broker allows
+    QMqttPublishProperties statusProperties[ChannelDefinition::MaxChannels];
+    QMqttPublishProperties aggregateProperties;
+    /**
+     * The ID of a command which pulsed a channel's relay, which goes out with its next state
+     */
+    struct PendingCommand {
+        // The pulse the command scheduled, or 0 if there is no command waiting
+        quint64 pulseId{0};
+        QByteArray id;
+    };
+    PendingCommand pendingCommands[ChannelDefinition::MaxChannels];
+#endif
 
-    void handleSubscription(QMqttSubscription *sub, int channelNumber) {
+    bool usingMqtt5() const {
+#ifdef HAVE_MQTT5
+        return client && client->protocolVersion() == QMqttClient::MQTT_5_0;
+#else
+        return false;
+#endif
+    }
+
+    void buildRouter() {
+        router.clear();
+        QStringList statusTopics;
+        for (int channel = 0; channel < inputHandler->channelCount(); ++channel) {
+            router.addRoute(inputHandler->channel(channel).toggleTopic, channel, TopicRouter::ToggleCommand);
+            router.addRoute(inputHandler->channel(channel).setTopic, channel, TopicRouter::SetCommand);
+            statusTopics << inputHandler->channel(channel).statusTopic;
+        }
+        router.addRoute(config->batchTopic(), -1, TopicRouter::BatchCommand);
+        router.addReservedTopics(statusTopics);
+    }
+    void handleSubscription(QMqttSubscription *sub) {
         if (sub) {
-            subscriptions << Subscription(q, inputHandler->channelByNumber(channelNumber), sub);
+            if (!subscriptions.contains(sub)) {
+                subscriptions << sub;
+            }
+            // The packet identifier and the redelivery flag only come through
+            // the subscription, so that is where messages are dispatched from,
+            // making sure each one is only ever connected once
+            if (!dispatchingSubscriptions.contains(sub)) {
+                dispatchingSubscriptions << sub;
+                QObject::connect(sub, &QMqttSubscription::messageReceived, q, [this](const QMqttMessage &message){
+                    handleMessage(message);
+                });
+                QObject::connect(sub, &QObject::destroyed, q, [this, sub](){
+                    dispatchingSubscriptions.remove(sub);
+                });
+            }
+            qCDebug(RELAYBOARD_MQTT) << "Subscribed to" << sub->topic().filter();
         } else {
-            qWarning() << "Could not subscribe! Is the connection valid?";
+            qCWarning(RELAYBOARD_MQTT) << "Could not subscribe! Is the connection valid?";
+        }
+    }
+    void handleMessage(const QMqttMessage &message) {
+        Metrics::instance().increment(Metrics::MessagesReceived);
+        const TopicRouter::Route route{router.route(message.topic().name())};
+        if (!route.isValid()) {
+            // The wildcard filters can match topics which are not ours
+            Metrics::instance().increment(Metrics::UnroutedMessages);
+            return;
+        }
+        qCDebug(RELAYBOARD_MQTT) << "Received message" << message.payload() << "for topic" << message.topic().name();
+        QByteArray commandId;
+        qint64 ageMs{-1};
+#ifdef HAVE_MQTT5
+        if (usingMqtt5()) {
+            readCommandProperties(message, commandId, ageMs);
+        }
+#endif
+        const CommandAdmission::Verdict verdict{admission.admit(route.channel, message.id(), message.duplicate(), message.payload(), monotonicNowNs(), commandId, ageMs)};
+        // Batches are not for any one channel, and end up with a subject of 0xffff
+        EventJournal::instance().record(verdict == CommandAdmission::Accepted ? EventJournal::CommandReceived : EventJournal::CommandRejected,
+                                        route.channel, verdict == CommandAdmission::Accepted ? quint32(route.command) : quint32(verdict), message.id());
+        switch (verdict) {
+            case CommandAdmission::Accepted:
+                break;
+            case CommandAdmission::DuplicateDelivery:
+            case CommandAdmission::DuplicateCommand:
+                Metrics::instance().increment(Metrics::DuplicateCommands);
+                qCDebug(RELAYBOARD_MQTT) << "Ignoring a duplicate command for channel" << route.channel + 1;
+                return;
+            case CommandAdmission::RateLimited:
+                Metrics::instance().increment(Metrics::RateLimitedCommands);
+                qCDebug(RELAYBOARD_MQTT) << "Ignoring a command for channel" << route.channel + 1 << "which is over the rate limit";
+                return;
+            case CommandAdmission::Expired:
+                Metrics::instance().increment(Metrics::ExpiredCommands);
+                qCDebug(RELAYBOARD_MQTT) << "Ignoring a command for channel" << route.channel + 1 << "which was sent" << ageMs << "ms ago";
+                return;
+        }
+        quint64 pulseId{0};
+        switch (route.command) {
+            case TopicRouter::ToggleCommand:
+                pulseId = inputHandler->pulseRelay(route.channel);
+                break;
+            case TopicRouter::SetCommand:
+                pulseId = handleSetCommand(route.channel, message.payload());
+                break;
+            case TopicRouter::BatchCommand:
+                handleBatchCommand(message.payload());
+                break;
+        }
+#ifdef HAVE_MQTT5
+        // Only a command which actually pulsed the relay is what the next state is down to
+        if (!commandId.isEmpty() && route.channel > -1 && pulseId != 0) {
+            pendingCommands[route.channel] = PendingCommand{pulseId, commandId};
+        }
+#else
+        Q_UNUSED(pulseId)
+#endif
+    }
+#ifdef HAVE_MQTT5
+    /**
+     * Pick the command ID and the time it was sent out of the user properties of a command
+     */
+    static void readCommandProperties(const QMqttMessage &message, QByteArray &commandId, qint64 &ageMs) {
+        const QMqttUserProperties userProperties{message.publishProperties().userProperties()};
+        for (const QMqttStringPair &property : userProperties) {
+            if (property.name() == QLatin1String("id")) {
+                commandId = property.value().toUtf8();
+            } else if (property.name() == QLatin1String("timestamp")) {
+                bool isNumber{false};
+                const qint64 sentAtMs{property.value().toLongLong(&isNumber)};
+                if (isNumber) {
+                    // The sender's clock may be a little ahead of ours
+                    ageMs = qMax(qint64(0), QDateTime::currentMSecsSinceEpoch() - sentAtMs);
+                    Metrics::instance().record(Metrics::CommandTransit, quint64(ageMs) * 1000000ULL);
+                }
+            }
+        }
+    }
+    /**
+     * Give the status and aggregate topics aliases, as far as the broker allows
+     */
+    void buildTopicAliases() {
+        const quint16 aliasLimit{usingMqtt5() ? client->serverConnectionProperties().maximumTopicAlias() : quint16(0)};
+        int aliases{0};
+        for (int channel = 0; channel < ChannelDefinition::MaxChannels; ++channel) {
+            statusProperties[channel] = QMqttPublishProperties{};
+            if (channel < aliasLimit && statusTable.topic(channel).isValid()) {
+                statusProperties[channel].setTopicAlias(quint16(channel + 1));
+                ++aliases;
+            }
+        }
+        aggregateProperties = QMqttPublishProperties{};
+        if (inputHandler->channelCount() < aliasLimit && aggregateTopic.isValid()) {
+            aggregateProperties.setTopicAlias(quint16(inputHandler->channelCount() + 1));
+            ++aliases;
+        }
+        if (usingMqtt5()) {
+            qCDebug(RELAYBOARD_MQTT) << "Using" << aliases << "of the" << aliasLimit << "topic aliases the broker allows";
+        }
+    }
+#endif
+    /**
+     * Publish the state of a channel, with a topic alias and the ID of the command
+     * which changed it when using MQTT 5
+     * @return The message ID, or -1 if the state could not be published
+     */
+    qint32 publishState(int channel, const QMqttTopicName &topic, bool on) {
+#ifdef HAVE_MQTT5
+        if (usingMqtt5()) {
+            QMqttPublishProperties properties{statusProperties[channel]};
+            if (pendingCommands[channel].pulseId != 0) {
+                // Lets whoever sent the command see how long it took to take effect
+                QMqttUserProperties userProperties;
+                userProperties.append(QMqttStringPair(QStringLiteral("commandId"), QString::fromUtf8(pendingCommands[channel].id)));
+                properties.setUserProperties(userProperties);
+                pendingCommands[channel] = PendingCommand{};
+            }
+            return client->publish(topic, properties, StatusPublishTable::payload(on), 0, true);
+        }
+#endif
+        return client->publish(topic, StatusPublishTable::payload(on), 0, true);
+    }
+    void publishAggregate(const ChannelStateSnapshot &snapshot) {
+#ifdef HAVE_MQTT5
+        if (usingMqtt5()) {
+            client->publish(aggregateTopic, aggregateProperties, aggregatePayload(snapshot), 0, true);
+            return;
+        }
+#endif
+        client->publish(aggregateTopic, aggregatePayload(snapshot), 0, true);
+    }
+    bool addScene(const QString &name, SceneDefinition &changes) const {
+        const auto scene = scenes.constFind(name);
+        if (scene == scenes.constEnd()) {
+            publishError(-1, QStringLiteral("there is no scene called %1").arg(name));
+            return false;
         }
+        changes.on |= scene->on;
+        changes.off |= scene->off;
+        changes.toggle |= scene->toggle;
+        return true;
     }
-    void handleInputChannelStateChange(InputHandler::InputChannel channel, const QString& updatedState) {
-        static const QMetaEnum theEnum = QMetaEnum::fromType<InputHandler::InputChannel>();
-        if (channel != InputHandler::InputChannelInvalid) {
-            QString theKey{QString::fromLatin1(theEnum.valueToKey(channel))};
-            theKey = theKey.remove(0, 12);
-            int channelNumber = theKey.toInt();
-            if (channelNumber > 0 && channelNumber <= config->statusTopics().count()) {
-                const QString topicToUpdate{config->statusTopics().value(channelNumber - 1)};
-                client->publish(topicToUpdate, updatedState.toLatin1(), 0, true);
-                qDebug() << "Published" << updatedState << "to" << topicToUpdate;
+    void handleBatchCommand(const QByteArray &payload) {
+        // The binary form is an opcode byte followed by up to three little
+        // endian 64 bit masks (on, off and toggle, with bit n for channel n + 1),
+        // read straight out of the payload
+        static constexpr char BinaryMasksOpcode{0x01};
+        SceneDefinition changes;
+        const char *data{payload.constData()};
+        if (payload.size() >= 9 && data[0] == BinaryMasksOpcode) {
+            changes.on = qFromLittleEndian<quint64>(data + 1);
+            if (payload.size() >= 17) {
+                changes.off = qFromLittleEndian<quint64>(data + 9);
+            }
+            if (payload.size() >= 25) {
+                changes.toggle = qFromLittleEndian<quint64>(data + 17);
+            }
+        } else if (payload.startsWith('{')) {
+            // Maps channel numbers to on, off or toggle, and may name a scene as well
+            const QJsonObject command{QJsonDocument::fromJson(payload).object()};
+            for (auto it = command.constBegin(); it != command.constEnd(); ++it) {
+                if (it.key() == QLatin1String("id")) {
+                    continue;
+                }
+                if (it.key() == QLatin1String("scene")) {
+                    if (!addScene(it.value().toString(), changes)) {
+                        return;
+                    }
+                    continue;
+                }
+                bool isNumber{false};
+                const int channel{it.key().toInt(&isNumber) - 1};
+                const QString action{it.value().toString().toLower()};
+                if (!isNumber || channel < 0 || channel >= inputHandler->channelCount()) {
+                    publishError(-1, QStringLiteral("there is no channel %1").arg(it.key()));
+                    return;
+                }
+                const quint64 bit{quint64(1) << channel};
+                if (action == QLatin1String("on")) {
+                    changes.on |= bit;
+                } else if (action == QLatin1String("off")) {
+                    changes.off |= bit;
+                } else if (action == QLatin1String("toggle")) {
+                    changes.toggle |= bit;
+                } else {
+                    publishError(channel, QStringLiteral("%1 is not something a channel can do").arg(it.value().toString()));
+                    return;
+                }
             }
+        } else if (!addScene(QString::fromUtf8(payload.trimmed()), changes)) {
+            return;
+        }
+        const int channelCount{inputHandler->channelCount()};
+        const quint64 channels{channelCount >= 64 ? ~quint64(0) : (quint64(1) << channelCount) - 1};
+        // The batch as a whole was admitted without a channel to charge, so each
+        // channel it changes is charged here, and those over their limit are left out
+        const quint64 requested{(changes.on | changes.off | changes.toggle) & channels};
+        const quint64 allowed{admission.admitChannels(requested, monotonicNowNs())};
+        if (allowed != requested) {
+            Metrics::instance().increment(Metrics::RateLimitedCommands, quint64(__builtin_popcountll(requested & ~allowed)));
+            qCDebug(RELAYBOARD_MQTT) << "Leaving out the channels of a batch which are over the rate limit:" << QByteArray::number(requested & ~allowed, 2);
+        }
+        stateController->setStates(changes.on & allowed, changes.off & allowed, changes.toggle & allowed);
+    }
+    /**
+     * @return The identifier of the pulse scheduled to set the channel, or 0 if none was
+     */
+    quint64 handleSetCommand(int channel, const QByteArray &payload) {
+        // Either a plain on or off, or a JSON object with the state (and likely an ID)
+        QByteArray state{payload.trimmed().toLower()};
+        if (state.startsWith('{')) {
+            state = QJsonDocument::fromJson(payload).object().value(QStringLiteral("state")).toString().toLower().toLatin1();
+        }
+        if (state == "on" || state == "off") {
+            return stateController->setState(channel, state == "on");
+        }
+        publishError(channel, QStringLiteral("the payload must be on or off"));
+        return 0;
+    }
+    void publishError(int channel, const QString &reason) const {
+        qCWarning(RELAYBOARD_MQTT) << "Could not carry out a command:" << reason;
+        if (isConnected() && !config->errorTopic().isEmpty()) {
+            QJsonObject error;
+            // Batch commands which could not be understood are not for any one channel
+            if (channel > -1) {
+                error.insert(QStringLiteral("channel"), channel + 1);
+            }
+            error.insert(QStringLiteral("error"), reason);
+            client->publish(QMqttTopicName{config->errorTopic()}, QJsonDocument(error).toJson(QJsonDocument::Compact), 1);
+        }
+    }
+    void buildStatusTable() {
+        statusTable.clear();
+        QStringList statusTopics;
+        for (int channel = 0; channel < inputHandler->channelCount(); ++channel) {
+            statusTable.setTopic(channel, inputHandler->channel(channel).statusTopic);
+            statusTopics << inputHandler->channel(channel).statusTopic;
+        }
+        statusTopicsHash = qHash(statusTopics.join(QLatin1Char('\n')));
+    }
+    bool isConnected() const {
+        return client && client->state() == QMqttClient::Connected;
+    }
+    void handleInputChannelStateChange(int channel) {
+        pendingChannels |= quint64(1) << channel;
+        if (!isConnected()) {
+            return;
+        }
+        // Changes arriving within the batch window of the first one all go out together
+        if (config->publishBatchWindow() > 0) {
+            if (!batchTimer->isActive()) {
+                batchTimer->start(config->publishBatchWindow());
+            }
+        } else {
+            flushPendingChannels();
+        }
+    }
+    void flushPendingChannels() {
+        if ((!pendingChannels && !aggregateDirty) || !isConnected()) {
+            return;
+        }
+        batchTimer->stop();
+        // Everything needed was worked out when we connected, so publishing the
+        // individual states must stay free of allocations
+        ChannelStateSnapshot snapshot;
+        inputHandler->channelStates().snapshot(snapshot, inputHandler->channelCount());
+        const quint64 now{monotonicNowNs()};
+        const quint64 pending{pendingChannels};
+        pendingChannels = 0;
+        int published{0};
+        const quint64 delivered{statusTable.publishChanged(snapshot, pending, publishedStates, publishedKnown,
+                                                           [this, &snapshot, now, &published](int channel, const QMqttTopicName &topic, bool on){
+            if (publishState(channel, topic, on) < 0) {
+                Metrics::instance().increment(Metrics::PublishFailures);
+                pendingChannels |= quint64(1) << channel;
+                return false;
+            }
+            ++published;
+            EventJournal::instance().record(EventJournal::StatePublished, channel, on, 0, now);
+            // Channels which have never seen an edge are only publishing their initial state
+            const quint64 lastEdgeNs{snapshot.channels[channel].lastEdgeNs};
+            if (lastEdgeNs > 0 && lastEdgeNs <= now) {
+                Metrics::instance().record(Metrics::EdgeToPublish, now - lastEdgeNs);
+            }
+            return true;
+        })};
+        inputHandler->stateFile()->setPublished(publishedStates, publishedKnown, statusTopicsHash);
+        if ((delivered || aggregateDirty) && aggregateTopic.isValid()) {
+            publishAggregate(snapshot);
+        }
+        aggregateDirty = false;
+        if (published > 0) {
+            Metrics::instance().increment(Metrics::StatesPublished, quint64(published));
+            qCDebug(RELAYBOARD_MQTT) << "Published the states of" << published << "channels";
+        }
+        if (pendingChannels) {
+            // The client could not take some of them just now, so have another go shortly
+            batchTimer->start(qMax(PublishRetryMs, config->publishBatchWindow()));
+        }
+        if (!hasPublished) {
+            hasPublished = true;
+            ServiceNotifier::markStartup("states published");
+        }
+    }
+    QByteArray aggregatePayload(const ChannelStateSnapshot &snapshot) const {
+        if (config->aggregateFormat() == QLatin1String("json")) {
+            // Keyed by the channel number, leaving out any channel whose state we do not know
+            QJsonObject states;
+            for (int channel = 0; channel < inputHandler->channelCount(); ++channel) {
+                if (snapshot.isKnown(channel)) {
+                    states.insert(QString::number(channel + 1), InputHandler::stateName(snapshot.isOn(channel)));
+                }
+            }
+            return QJsonDocument(states).toJson(QJsonDocument::Compact);
+        }
+        // Bit n of the hexadecimal number is set if channel n + 1 is on
+        return QByteArray::number(snapshot.states & snapshot.knownStates, 16);
+    }
+    void scheduleReconnect() {
+        // Exponential backoff, with the actual delay picked at random from the
+        // upper half of the range, so a broker restart does not get every
+        // client coming back at the same moment
+        const int minimumDelay{qMax(1, config->mqttReconnectDelay())};
+        const int maximumDelay{qMax(minimumDelay, config->mqttMaxReconnectDelay())};
+        const int ceiling{int(qMin(qint64(maximumDelay), qint64(minimumDelay) << qMin(reconnectAttempt, 20)))};
+        const int delay{ceiling / 2 + QRandomGenerator::global()->bounded(ceiling / 2 + 1)};
+        ++reconnectAttempt;
+        Metrics::instance().increment(Metrics::Reconnects);
+        qCDebug(RELAYBOARD_MQTT) << "Reconnecting to the MQTT broker in" << delay << "ms (attempt" << reconnectAttempt << ")";
+        reconnectTimer->start(delay);
+    }
+    void handleConnected() {
+        reconnectAttempt = 0;
+        buildRouter();
+        subscribedFilters = router.subscriptionFilters();
+        for (const QString &filter : qAsConst(subscribedFilters)) {
+            handleSubscription(client->subscribe(filter, 1));
+        }
+        qCInfo(RELAYBOARD_MQTT) << "Routing" << router.routeCount() << "command topics through" << subscriptions.count() << "subscriptions";
+        buildStatusTable();
+        aggregateTopic = QMqttTopicName{config->aggregateTopic()};
+#ifdef HAVE_MQTT5
+        buildTopicAliases();
+#endif
+        if (!hasConnected) {
+            // The first time round, the broker gets everything we know, as a
+            // retained state may have been lost or changed by somebody else
+            // while we were away. If asked to, only what differs from what it
+            // was last told, according to the state file, is published instead
+            const StateFile *stateFile{inputHandler->stateFile()};
+            if (config->publishChangedStatesOnly() && stateFile->isRestored() && stateFile->statusTopicsHash() == statusTopicsHash) {
+                publishedStates = stateFile->publishedStates();
+                publishedKnown = stateFile->publishedKnown();
+                qCDebug(RELAYBOARD_MQTT) << "Updating MQTT states which changed since they were last published";
+            } else {
+                qCDebug(RELAYBOARD_MQTT) << "Updating MQTT states with the currently best known values";
+            }
+            pendingChannels = ~quint64(0);
+            aggregateDirty = true;
+            hasConnected = true;
+            ServiceNotifier::markStartup("connected to the broker");
+        }
+        flushPendingChannels();
+        if (!config->statsTopic().isEmpty()) {
+            statsTimer->start(qMax(1000, config->metricsInterval()));
+        }
+        startCounterTimer();
+        publishCounters();
+    }
+    void applyConfig() {
+        // A reload which leaves these alone must not let a repeated command or
+        // a burst past the limit through
+        if (config->commandIdWindow() != admissionIdWindow) {
+            admissionIdWindow = config->commandIdWindow();
+            admission.setCommandIdWindow(admissionIdWindow);
+        }
+        if (!qFuzzyCompare(config->commandRate() + 1, admissionRate + 1) || config->commandBurst() != admissionBurst) {
+            admissionRate = config->commandRate();
+            admissionBurst = config->commandBurst();
+            admission.setRateLimit(admissionRate, admissionBurst);
+        }
+        admission.setMaxAge(config->commandMaxAge());
+        scenes = config->scenes();
+        if (client && (client->hostname() != config->mqttHost() || client->port() != config->mqttPort()
+                || client->username() != config->mqttUsername() || client->clientId() != config->mqttClientId()
+                || usingMqtt5() != config->mqtt5())) {
+            qCWarning(RELAYBOARD_MQTT) << "The broker connection settings have changed, which will only take effect once the service is restarted";
+        }
+
+        // Channels whose status topic has moved get their state published to the new one
+        quint64 movedChannels{0};
+        for (int channel = 0; channel < inputHandler->channelCount(); ++channel) {
+            if (statusTable.topic(channel).name() != inputHandler->channel(channel).statusTopic) {
+                movedChannels |= quint64(1) << channel;
+            }
+        }
+        const QMqttTopicName updatedAggregateTopic{config->aggregateTopic()};
+        aggregateDirty = aggregateDirty || updatedAggregateTopic.name() != aggregateTopic.name();
+        aggregateTopic = updatedAggregateTopic;
+        pendingChannels |= movedChannels;
+        publishedKnown &= ~movedChannels;
+        // Messages are dispatched on this thread, so nothing can arrive while the tables are being swapped
+        buildRouter();
+        buildStatusTable();
+#ifdef HAVE_MQTT5
+        buildTopicAliases();
+#endif
+
+        if (!isConnected()) {
+            // Connecting subscribes to everything afresh anyway
+            return;
+        }
+        const QStringList filters{router.subscriptionFilters()};
+        int removed{0};
+        int added{0};
+        for (const QString &filter : qAsConst(subscribedFilters)) {
+            if (!filters.contains(filter)) {
+                client->unsubscribe(QMqttTopicFilter{filter});
+                for (auto it = subscriptions.begin(); it != subscriptions.end();) {
+                    if ((*it)->topic().filter() == filter) {
+                        it = subscriptions.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+                ++removed;
+            }
+        }
+        for (const QString &filter : filters) {
+            if (!subscribedFilters.contains(filter)) {
+                handleSubscription(client->subscribe(filter, 1));
+                ++added;
+            }
+        }
+        subscribedFilters = filters;
+        qCInfo(RELAYBOARD_MQTT) << "Applied the reloaded configuration, adding" << added << "and removing" << removed << "subscriptions";
+        flushPendingChannels();
+        if (config->statsTopic().isEmpty()) {
+            statsTimer->stop();
+        } else {
+            statsTimer->start(qMax(1000, config->metricsInterval()));
+        }
+        startCounterTimer();
+    }
+    void startCounterTimer() {
+        if (inputHandler->pulseCounter().countingChannels() && isConnected()) {
+            counterTimer->start(qMax(1, config->counterInterval()) * 1000);
+        } else {
+            counterTimer->stop();
+        }
+    }
+    void publishCounters() {
+        // The counters go out on their channels' status topics, as they have no on or off state to publish there
+        const PulseCounter &counter{inputHandler->pulseCounter()};
+        if (!isConnected() || !counter.countingChannels()) {
+            return;
+        }
+        const quint64 now{monotonicNowNs()};
+        const QList<int> windows{counter.rateWindows()};
+        for (quint64 remaining = counter.countingChannels(); remaining; remaining &= remaining - 1) {
+            const int channel{__builtin_ctzll(remaining)};
+            const QMqttTopicName &topic{statusTable.topic(channel)};
+            if (!topic.isValid()) {
+                continue;
+            }
+            QJsonObject rates;
+            for (int window : windows) {
+                rates.insert(QString::number(window), counter.rate(channel, window, now));
+            }
+            QJsonObject payload;
+            payload.insert(QStringLiteral("total"), qint64(counter.total(channel)));
+            payload.insert(QStringLiteral("missed"), qint64(counter.missed(channel)));
+            payload.insert(QStringLiteral("intervalMs"), double(counter.lastIntervalNs(channel)) / 1000000.0);
+            payload.insert(QStringLiteral("rates"), rates);
+            if (client->publish(topic, QJsonDocument(payload).toJson(QJsonDocument::Compact), 0, true) < 0) {
+                Metrics::instance().increment(Metrics::PublishFailures);
+            }
+        }
+    }
+    void publishStats() {
+        if (isConnected()) {
+            client->publish(QMqttTopicName{config->statsTopic()}, QJsonDocument(Metrics::instance().summary()).toJson(QJsonDocument::Compact));
         }
     }
 };
@@ -80,6 +642,37 @@ MqttClient::MqttClient(Config *config, InputHandler *parent)
 {
     d->config = config;
     d->inputHandler = parent;
+    d->reconnectTimer = new QTimer(this);
+    d->reconnectTimer->setSingleShot(true);
+    connect(d->reconnectTimer, &QTimer::timeout, this, [this](){
+        if (d->client) {
+            d->client->connectToHost();
+        }
+    });
+    // This is connected exactly once, whatever happens to the connection to the
+    // broker, and changes which happen while disconnected are queued up
+    connect(d->inputHandler, &InputHandler::inputChannelStateChanged, this, [this](int channel){
+        d->handleInputChannelStateChange(channel);
+    });
+    d->batchTimer = new QTimer(this);
+    d->batchTimer->setSingleShot(true);
+    d->batchTimer->setTimerType(Qt::PreciseTimer);
+    connect(d->batchTimer, &QTimer::timeout, this, [this](){ d->flushPendingChannels(); });
+    d->stateController = new StateController(config, d->inputHandler, this);
+    d->scenes = config->scenes();
+    connect(d->stateController, &StateController::setStateFailed, this, [this](int channel, bool on, const QString &reason){
+#ifdef HAVE_MQTT5
+        // The channel is not going to change, so the command's ID must not go out with whatever changes it next
+        if (channel > -1 && channel < ChannelDefinition::MaxChannels) {
+            d->pendingCommands[channel] = MqttClientPrivate::PendingCommand{};
+        }
+#endif
+        d->publishError(channel, QStringLiteral("could not set the channel %1: %2").arg(InputHandler::stateName(on)).arg(reason));
+    });
+    d->statsTimer = new QTimer(this);
+    connect(d->statsTimer, &QTimer::timeout, this, [this](){ d->publishStats(); });
+    d->counterTimer = new QTimer(this);
+    connect(d->counterTimer, &QTimer::timeout, this, [this](){ d->publishCounters(); });
 }
 
 MqttClient::~MqttClient()
@@ -89,6 +682,12 @@ MqttClient::~MqttClient()
 
 void MqttClient::start()
 {
+    if (d->client) {
+        return;
+    }
+    d->admission.setCommandIdWindow(d->config->commandIdWindow());
+    d->admission.setRateLimit(d->config->commandRate(), d->config->commandBurst());
+    d->admission.setMaxAge(d->config->commandMaxAge());
     d->client = new QMqttClient(this);
     d->client->setHostname(d->config->mqttHost());
     d->client->setPort(d->config->mqttPort());
@@ -96,36 +695,43 @@ void MqttClient::start()
         d->client->setUsername(d->config->mqttUsername());
         d->client->setPassword(d->config->mqttPassword());
     }
+    // A persistent session means the broker holds on to our subscriptions, and
+    // any QoS 1 toggles sent to us, while we are away
+    d->client->setClientId(d->config->mqttClientId());
+    d->client->setCleanSession(false);
+    if (d->config->mqtt5()) {
+#ifdef HAVE_MQTT5
+        // MQTT 5 sessions only outlive the connection for as long as we ask
+        d->client->setProtocolVersion(QMqttClient::MQTT_5_0);
+        QMqttConnectionProperties properties;
+        properties.setSessionExpiryInterval(quint32(qMax(0, d->config->mqttSessionExpiry())));
+        properties.setMaximumTopicAlias(InboundTopicAliases);
+        d->client->setConnectionProperties(properties);
+#else
+        qCWarning(RELAYBOARD_MQTT) << "MQTT 5 needs QtMqtt 5.12 or later, which this was not built with, so using MQTT 3.1.1 instead";
+#endif
+    }
+    connect(d->client, &QMqttClient::errorChanged, this, [](QMqttClient::ClientError error){
+        if (error != QMqttClient::NoError) {
+            qCWarning(RELAYBOARD_MQTT) << "The MQTT connection reported an error:" << error;
+        }
+    });
     connect(d->client, &QMqttClient::stateChanged, this, [this](QMqttClient::ClientState state){
         switch(state) {
             case QMqttClient::Disconnected:
-                qWarning() << "Forcibly disconnected from the MQTT broker";
-                stop();
+                qCWarning(RELAYBOARD_MQTT) << "Disconnected from the MQTT broker";
+                EventJournal::instance().record(EventJournal::ConnectionChanged, 0, false);
+                Q_EMIT connectedChanged(false);
+                d->subscriptions.clear();
+                d->scheduleReconnect();
                 break;
             case QMqttClient::Connecting:
-                qDebug() << "Connecting to MQTT broker...";
+                qCDebug(RELAYBOARD_MQTT) << "Connecting to MQTT broker...";
                 break;
             case QMqttClient::Connected:
-                int channelNumber{1};
-                for (const QString &topic : d->config->toggleTopics()) {
-                    d->handleSubscription(d->client->subscribe(topic, 1), channelNumber);
-                    ++channelNumber;
-                }
-                connect(d->inputHandler, &InputHandler::inputChannelStateChanged,
-                        this, [this](InputHandler::InputChannel channel, const QString& updatedState){
-                            d->handleInputChannelStateChange(channel, updatedState);
-                        });
-                qDebug() << "Updating MQTT states with the currently best known values";
-                static const QMetaEnum theEnum = QMetaEnum::fromType<InputHandler::InputChannel>();
-                const QStringList recentStates{d->inputHandler->mostRecentChannelStates()};
-                // Start at 1, because 0 is invalid and we aren't interested in that here
-                for (int i = 1; i < theEnum.keyCount(); ++i) {
-                    bool ok{false};
-                    int value = theEnum.keyToValue(theEnum.key(i), &ok);
-                    if (ok) {
-                        d->handleInputChannelStateChange(InputHandler::InputChannel(value), recentStates.value(i - 1));
-                    }
-                }
+                EventJournal::instance().record(EventJournal::ConnectionChanged, 0, true);
+                d->handleConnected();
+                Q_EMIT connectedChanged(true);
                 break;
         }
     });
@@ -134,9 +740,25 @@ void MqttClient::start()
 
 void MqttClient::stop()
 {
-    d->client->deleteLater();
-    d->client = nullptr;
+    d->reconnectTimer->stop();
+    d->batchTimer->stop();
+    d->statsTimer->stop();
+    d->counterTimer->stop();
+    d->reconnectAttempt = 0;
+    if (d->client) {
+        // Make sure losing the connection here does not set off a reconnect
+        d->client->disconnect(this);
+        d->client->disconnectFromHost();
+        d->client->deleteLater();
+        d->client = nullptr;
+    }
     d->subscriptions.clear();
+    d->dispatchingSubscriptions.clear();
+}
+
+void MqttClient::reloadConfig()
+{
+    d->applyConfig();
 }
 
 void MqttClient::restart()
@@ -149,3 +771,8 @@ InputHandler *MqttClient::inputHandler() const
 {
     return d->inputHandler;
 }
+
+StateController *MqttClient::stateController() const
+{
+    return d->stateController;
+}
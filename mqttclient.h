@@ -26,6 +26,7 @@
 #include "inputhandler.h"
 
 class MqttClientPrivate;
+class StateController;
 class MqttClient : public QObject
 {
     Q_OBJECT
@@ -36,8 +37,24 @@ public:
     Q_SLOT void start();
     Q_SLOT void stop();
     Q_SLOT void restart();
+    /**
+     * Pick up the changes from a reloaded configuration, without disturbing
+     * the connection to the broker. Subscriptions are only changed where the
+     * command topics have, and states are published to any new status topics.
+     */
+    Q_SLOT void reloadConfig();
 
     InputHandler *inputHandler() const;
+    /**
+     * The controller which carries out the set and batch commands
+     */
+    StateController *stateController() const;
+
+    /**
+     * Emitted when the connection to the broker is made or lost
+     * @param connected Whether we are now connected to the broker
+     */
+    Q_SIGNAL void connectedChanged(bool connected);
 private:
     std::unique_ptr<MqttClientPrivate> d;
 };
@@ -0,0 +1,149 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "pulsecounter.h"
+
+PulseCounter::PulseCounter() = default;
+
+void PulseCounter::setRateWindows(const QList<int> &windowsS)
+{
+    m_rateWindows.clear();
+    m_ringSize = 1;
+    for (int window : windowsS) {
+        window = qBound(1, window, MaxRateWindow);
+        if (!m_rateWindows.contains(window)) {
+            m_rateWindows << window;
+            m_ringSize = qMax(m_ringSize, window);
+        }
+    }
+    for (quint64 remaining = m_counting; remaining; remaining &= remaining - 1) {
+        Counter &counter{m_counters[__builtin_ctzll(remaining)]};
+        counter.counts.fill(0, m_ringSize);
+        counter.seconds.fill(0, m_ringSize);
+    }
+}
+
+QList<int> PulseCounter::rateWindows() const
+{
+    return m_rateWindows;
+}
+
+void PulseCounter::setChannel(int channel, const ChannelDefinition &definition)
+{
+    if (channel < 0 || channel >= ChannelDefinition::MaxChannels) {
+        return;
+    }
+    Counter &counter{m_counters[channel]};
+    const quint64 bit{quint64(1) << channel};
+    if (definition.inputMode != ChannelDefinition::CounterInput || definition.inputLine < 0) {
+        m_counting &= ~bit;
+        counter.counts.clear();
+        counter.seconds.clear();
+        return;
+    }
+    counter.edge = definition.counterEdge;
+    counter.holdoffNs = quint64(qMax(0, definition.counterHoldoff)) * 1000000ULL;
+    if (!(m_counting & bit)) {
+        m_counting |= bit;
+        counter.counts.fill(0, m_ringSize);
+        counter.seconds.fill(0, m_ringSize);
+    }
+}
+
+bool PulseCounter::isCounting(int channel) const
+{
+    return channel > -1 && channel < ChannelDefinition::MaxChannels && (m_counting & (quint64(1) << channel));
+}
+
+bool PulseCounter::handleEdge(int channel, bool level, quint64 timestampNs)
+{
+    if (!isCounting(channel)) {
+        return false;
+    }
+    Counter &counter{m_counters[channel]};
+    if ((counter.edge == ChannelDefinition::FallingEdge && level) || (counter.edge == ChannelDefinition::RisingEdge && !level)) {
+        return false;
+    }
+    if (counter.lastCountedNs > 0) {
+        // Edges come in order from the kernel, but the first ones after a restart may not
+        const quint64 intervalNs{timestampNs > counter.lastCountedNs ? timestampNs - counter.lastCountedNs : 0};
+        if (intervalNs < counter.holdoffNs) {
+            return false;
+        }
+        counter.lastIntervalNs = intervalNs;
+    }
+    counter.lastCountedNs = timestampNs;
+    ++counter.total;
+    const quint64 second{timestampNs / 1000000000ULL};
+    const int slot{int(second % quint64(m_ringSize))};
+    if (counter.seconds[slot] != second) {
+        counter.seconds[slot] = second;
+        counter.counts[slot] = 0;
+    }
+    ++counter.counts[slot];
+    return true;
+}
+
+void PulseCounter::addMissed(int channel, quint64 edges)
+{
+    if (isCounting(channel)) {
+        m_counters[channel].missed += edges;
+    }
+}
+
+quint64 PulseCounter::total(int channel) const
+{
+    return isCounting(channel) ? m_counters[channel].total : 0;
+}
+
+void PulseCounter::setTotal(int channel, quint64 total)
+{
+    if (isCounting(channel)) {
+        m_counters[channel].total = total;
+    }
+}
+
+quint64 PulseCounter::missed(int channel) const
+{
+    return isCounting(channel) ? m_counters[channel].missed : 0;
+}
+
+quint64 PulseCounter::lastIntervalNs(int channel) const
+{
+    return isCounting(channel) ? m_counters[channel].lastIntervalNs : 0;
+}
+
+double PulseCounter::rate(int channel, int windowS, quint64 nowNs) const
+{
+    if (!isCounting(channel) || windowS < 1) {
+        return 0;
+    }
+    const Counter &counter{m_counters[channel]};
+    const quint64 nowSecond{nowNs / 1000000000ULL};
+    // The window covers the current second, so far, and the ones before it
+    const quint64 windowSeconds{quint64(qMin(windowS, m_ringSize))};
+    quint64 count{0};
+    for (int slot = 0; slot < m_ringSize; ++slot) {
+        const quint64 second{counter.seconds.at(slot)};
+        if (second <= nowSecond && second + windowSeconds > nowSecond) {
+            count += counter.counts.at(slot);
+        }
+    }
+    return double(count) / double(windowSeconds);
+}
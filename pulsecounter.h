@@ -0,0 +1,119 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef PULSECOUNTER_H
+#define PULSECOUNTER_H
+
+#include <QList>
+#include <QVector>
+
+#include "channeldefinition.h"
+
+/**
+ * Counts the pulses on the counter inputs, such as the S0 outputs of energy and water meters
+ *
+ * Every edge the kernel reports is seen here, with the kernel's timestamp, so
+ * no pulse is lost however short it is or however busy the service is. The
+ * totals are 64 bit, and the rates are worked out over sliding windows with a
+ * resolution of a second, from a ring of per-second counts which is as long as
+ * the longest window. Nothing here allocates once the channels are set up.
+ */
+class PulseCounter
+{
+public:
+    // The longest window a rate can be worked out over, in seconds
+    static constexpr int MaxRateWindow{3600};
+
+    PulseCounter();
+
+    /**
+     * Set the windows the rates are worked out over, which forgets the
+     * per-second counts (but not the totals)
+     * @param windowsS The windows in seconds, each between 1 and MaxRateWindow
+     */
+    void setRateWindows(const QList<int> &windowsS);
+    QList<int> rateWindows() const;
+    /**
+     * Start or stop counting the pulses on a channel's input, keeping its total
+     * @param channel The zero-based index of the channel
+     * @param definition The channel, whose input mode, counter edge and holdoff are used
+     */
+    void setChannel(int channel, const ChannelDefinition &definition);
+    bool isCounting(int channel) const;
+    /**
+     * The channels being counted, with bit n for the channel at index n
+     */
+    quint64 countingChannels() const {
+        return m_counting;
+    }
+
+    /**
+     * Handle an edge on a counter input
+     * @param channel The zero-based index of the channel
+     * @param level The level the line went to
+     * @param timestampNs The CLOCK_MONOTONIC time of the edge
+     * @return True if the edge was counted
+     */
+    bool handleEdge(int channel, bool level, quint64 timestampNs);
+    /**
+     * Note that edges on a counter input were lost before they got here
+     */
+    void addMissed(int channel, quint64 edges);
+
+    quint64 total(int channel) const;
+    /**
+     * Carry on from a total counted earlier, such as in a previous run
+     */
+    void setTotal(int channel, quint64 total);
+    /**
+     * How many edges were lost on a channel's input since the service started
+     */
+    quint64 missed(int channel) const;
+    /**
+     * The time between the last two counted pulses, in nanoseconds, or 0 if
+     * there have not been two yet
+     */
+    quint64 lastIntervalNs(int channel) const;
+    /**
+     * The rate of pulses over a window ending now
+     * @param channel The zero-based index of the channel
+     * @param windowS The length of the window in seconds
+     * @param nowNs The current CLOCK_MONOTONIC time
+     * @return The pulses per second
+     */
+    double rate(int channel, int windowS, quint64 nowNs) const;
+private:
+    struct Counter {
+        ChannelDefinition::CounterEdge edge{ChannelDefinition::FallingEdge};
+        quint64 holdoffNs{0};
+        quint64 total{0};
+        quint64 missed{0};
+        quint64 lastCountedNs{0};
+        quint64 lastIntervalNs{0};
+        // The count for each second, and which second each slot holds
+        QVector<quint32> counts;
+        QVector<quint64> seconds;
+    };
+    Counter m_counters[ChannelDefinition::MaxChannels];
+    quint64 m_counting{0};
+    QList<int> m_rateWindows;
+    int m_ringSize{1};
+};
+
+#endif//PULSECOUNTER_H
@@ -0,0 +1,423 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "relaypulsescheduler.h"
+#include "eventjournal.h"
+#include "gpiobackend.h"
+#include "logging.h"
+#include "metrics.h"
+#include "monotonicclock.h"
+
+#include <QDebug>
+#include <QThread>
+#include <algorithm>
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <queue>
+#include <vector>
+
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+// In real-time mode, the worker stops listening for new work this long before
+// an edge is due, and sleeps straight through to the deadline instead
+static constexpr quint64 PreciseWaitNs{1000000};
+
+/**
+ * A single edge of a pulse, either energising or releasing a relay
+ */
+struct PulseEdge {
+    quint64 deadlineNs;
+    quint64 pulseId;
+    int output;
+    bool energise;
+    // The requested width of the pulse, which energising edges use to schedule
+    // the matching release, and releasing ones to check how close it came
+    quint64 pulseWidthNs;
+    quint64 restNs;
+    // When the pulse was asked for, to measure how long it took to get going
+    quint64 requestedNs;
+};
+
+// Orders the edges so the priority queue hands out the earliest deadline first
+struct LaterEdge {
+    bool operator()(const PulseEdge &first, const PulseEdge &second) const {
+        if (first.deadlineNs != second.deadlineNs) {
+            return first.deadlineNs > second.deadlineNs;
+        }
+        return first.pulseId > second.pulseId;
+    }
+};
+
+class PulseWorkerThread : public QThread
+{
+public:
+    PulseWorkerThread(RelayPulseSchedulerPrivate *d, QObject *parent = nullptr)
+        : QThread(parent)
+        , d(d)
+    {}
+    void run() override;
+private:
+    RelayPulseSchedulerPrivate *d;
+};
+
+class RelayPulseSchedulerPrivate {
+public:
+    RelayPulseSchedulerPrivate(RelayPulseScheduler *q)
+        : q(q)
+    {
+        timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (timerFd < 0 || wakeFd < 0) {
+            qCWarning(RELAYBOARD_GPIO) << "Failed to create the timers for the relay pulse scheduler:" << strerror(errno);
+        }
+    }
+    ~RelayPulseSchedulerPrivate() {
+        if (timerFd > -1) {
+            close(timerFd);
+        }
+        if (wakeFd > -1) {
+            close(wakeFd);
+        }
+    }
+    RelayPulseScheduler *q;
+    QList<GpioBackend*> banks;
+    PulseWorkerThread *worker{nullptr};
+    int timerFd{-1};
+    int wakeFd{-1};
+    std::atomic<bool> shouldAbort{false};
+    std::atomic<int> maxEnergised{0};
+    std::atomic<quint64> heartbeatNs{0};
+    std::atomic<int> realtimePriority{0};
+
+    // Only touched by the worker (or once the worker has stopped)
+    // Energising edges held back by the inrush limit, in the order they became due
+    std::deque<PulseEdge> waitingEdges;
+    // When each output has finished resting after its most recent pulse
+    quint64 outputRestingUntil[RelayPulseScheduler::output(GpioBankDefinition::MaxBanks, 0)]{};
+    // The energised relays, one mask per bank
+    quint64 energisedMasks[GpioBankDefinition::MaxBanks]{};
+    int energisedCount{0};
+    // When each energised relay was energised, to measure the width its pulse
+    // actually got (an output only ever has the one pulse energised at a time)
+    quint64 energisedAt[RelayPulseScheduler::output(GpioBankDefinition::MaxBanks, 0)]{};
+
+    // Everything below is protected by the mutex
+    std::mutex mutex;
+    std::priority_queue<PulseEdge, std::vector<PulseEdge>, LaterEdge> edges;
+    // When each output is next free to be pulsed again
+    quint64 outputAvailableAt[RelayPulseScheduler::output(GpioBankDefinition::MaxBanks, 0)]{};
+    quint64 nextPulseId{1};
+
+    void wakeWorker() {
+        const uint64_t one{1};
+        if (write(wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            qCWarning(RELAYBOARD_GPIO) << "Failed to wake up the relay pulse worker:" << strerror(errno);
+        }
+    }
+    void armTimer(quint64 deadlineNs) {
+        itimerspec spec;
+        memset(&spec, 0, sizeof(spec));
+        // An all-zero value disarms the timer, which is what we want when idle
+        if (deadlineNs > 0) {
+            spec.it_value.tv_sec = time_t(deadlineNs / 1000000000ULL);
+            spec.it_value.tv_nsec = long(deadlineNs % 1000000000ULL);
+        }
+        timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+    }
+    void applyRealtimePriority(int priority) {
+        // Called from the worker itself, so it is the worker which changes scheduling
+        sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = priority;
+        const int error{pthread_setschedparam(pthread_self(), priority > 0 ? SCHED_FIFO : SCHED_OTHER, &param)};
+        if (error != 0) {
+            qCWarning(RELAYBOARD_GPIO) << "Failed to change the scheduling of the relay pulse worker:" << strerror(error);
+        }
+        if (priority > 0) {
+            // A page fault in the middle of a pulse would stretch it just the same as being preempted
+            if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+                qCWarning(RELAYBOARD_GPIO) << "Failed to lock the memory of the service:" << strerror(errno);
+            }
+            prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+            if (error == 0) {
+                qCInfo(RELAYBOARD_GPIO) << "Timing relay pulses at real-time priority" << priority;
+            }
+        } else {
+            munlockall();
+        }
+    }
+    static void sleepUntil(quint64 deadlineNs) {
+        timespec deadline;
+        deadline.tv_sec = time_t(deadlineNs / 1000000000ULL);
+        deadline.tv_nsec = long(deadlineNs % 1000000000ULL);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR) {}
+    }
+    static void drain(int fd) {
+        uint64_t value{0};
+        while (read(fd, &value, sizeof(value)) > 0) {}
+    }
+};
+
+void PulseWorkerThread::run()
+{
+    pollfd fds[2];
+    fds[0].fd = d->timerFd;
+    fds[0].events = POLLIN;
+    fds[1].fd = d->wakeFd;
+    fds[1].events = POLLIN;
+    std::vector<PulseEdge> dueEdges;
+    dueEdges.reserve(64);
+    std::vector<PulseEdge> completedEdges;
+    completedEdges.reserve(64);
+    std::vector<PulseEdge> energisedPulses;
+    energisedPulses.reserve(64);
+    int appliedPriority{0};
+    while (!d->shouldAbort) {
+        const int realtimePriority{d->realtimePriority.load(std::memory_order_relaxed)};
+        if (realtimePriority != appliedPriority) {
+            d->applyRealtimePriority(realtimePriority);
+            appliedPriority = realtimePriority;
+        }
+        quint64 nextDeadline{0};
+        // Every edge which is due gets collected into a single write per bank, where
+        // the set bits of levels are released relays, and the clear ones energised
+        quint64 masks[GpioBankDefinition::MaxBanks]{};
+        quint64 levels[GpioBankDefinition::MaxBanks]{};
+        dueEdges.clear();
+        completedEdges.clear();
+        energisedPulses.clear();
+        {
+            std::lock_guard<std::mutex> lock(d->mutex);
+            const quint64 now{monotonicNowNs()};
+            d->heartbeatNs.store(now, std::memory_order_relaxed);
+            while (!d->edges.empty() && d->edges.top().deadlineNs <= now) {
+                dueEdges.push_back(d->edges.top());
+                d->edges.pop();
+            }
+            // Release first, so the freed up slots can be used by this round's pulses
+            for (const PulseEdge &edge : dueEdges) {
+                if (!edge.energise) {
+                    const int bank{edge.output / GpioBankDefinition::MaxLines};
+                    const quint64 bit{quint64(1) << (edge.output % GpioBankDefinition::MaxLines)};
+                    masks[bank] |= bit;
+                    levels[bank] |= bit;
+                    d->energisedMasks[bank] &= ~bit;
+                    --d->energisedCount;
+                    d->outputRestingUntil[edge.output] = now + edge.restNs;
+                    completedEdges.push_back(edge);
+                    Metrics::instance().increment(Metrics::PulsesCompleted);
+                    Metrics::instance().record(Metrics::WakeupJitter, now - edge.deadlineNs);
+                }
+            }
+            for (const PulseEdge &edge : dueEdges) {
+                if (edge.energise) {
+                    d->waitingEdges.push_back(edge);
+                }
+            }
+            const int maxEnergised{d->maxEnergised};
+            for (auto it = d->waitingEdges.begin(); it != d->waitingEdges.end();) {
+                PulseEdge edge{*it};
+                const int bank{edge.output / GpioBankDefinition::MaxLines};
+                const quint64 bit{quint64(1) << (edge.output % GpioBankDefinition::MaxLines)};
+                if (d->outputRestingUntil[edge.output] > now && !(d->energisedMasks[bank] & bit)) {
+                    // The relay is resting after an earlier pulse which was held back
+                    // by the inrush limit, so requeue this one for once it is done
+                    edge.deadlineNs = d->outputRestingUntil[edge.output];
+                    d->edges.push(edge);
+                    it = d->waitingEdges.erase(it);
+                } else if ((d->energisedMasks[bank] & bit) || (maxEnergised > 0 && d->energisedCount >= maxEnergised)) {
+                    // Leave it waiting for the relay (or one of the others) to be released
+                    ++it;
+                } else {
+                    masks[bank] |= bit;
+                    d->energisedMasks[bank] |= bit;
+                    ++d->energisedCount;
+                    d->edges.push(PulseEdge{now + edge.pulseWidthNs, edge.pulseId, edge.output, false, edge.pulseWidthNs, edge.restNs, edge.requestedNs});
+                    energisedPulses.push_back(edge);
+                    Metrics::instance().record(Metrics::CommandToRelay, now - edge.requestedNs);
+                    it = d->waitingEdges.erase(it);
+                }
+            }
+            if (!d->edges.empty()) {
+                nextDeadline = d->edges.top().deadlineNs;
+            }
+        }
+        // The relays are active low, so energising them means pulling the line low,
+        // and every relay on a bank changing in this round does so in the same write
+        for (int bank = 0; bank < d->banks.count(); ++bank) {
+            if (masks[bank]) {
+                d->banks.at(bank)->writeOutputs(levels[bank], masks[bank]);
+            }
+        }
+        // The width a relay actually got runs from one write to the other
+        const quint64 writtenNs{monotonicNowNs()};
+        for (const PulseEdge &edge : energisedPulses) {
+            d->energisedAt[edge.output] = writtenNs;
+            EventJournal::instance().record(EventJournal::RelayEnergised, edge.output, 0, edge.pulseId, writtenNs);
+        }
+        for (const PulseEdge &edge : completedEdges) {
+            EventJournal::instance().record(EventJournal::RelayReleased, edge.output, 0, edge.pulseId, writtenNs);
+            const quint64 energisedNs{d->energisedAt[edge.output]};
+            d->energisedAt[edge.output] = 0;
+            if (energisedNs > 0) {
+                const quint64 widthNs{writtenNs - energisedNs};
+                Metrics::instance().record(Metrics::PulseWidthError, widthNs > edge.pulseWidthNs ? widthNs - edge.pulseWidthNs : edge.pulseWidthNs - widthNs);
+            }
+            Q_EMIT d->q->pulseCompleted(edge.output, edge.pulseId);
+        }
+        if (appliedPriority > 0 && nextDeadline > 0) {
+            // Nothing arriving in the last moment before an edge could go out
+            // any sooner than the edge itself, so there is no need to listen for it
+            if (nextDeadline <= monotonicNowNs() + PreciseWaitNs) {
+                RelayPulseSchedulerPrivate::sleepUntil(nextDeadline);
+                continue;
+            }
+            d->armTimer(nextDeadline - PreciseWaitNs);
+        } else {
+            d->armTimer(nextDeadline);
+        }
+        poll(fds, 2, -1);
+        RelayPulseSchedulerPrivate::drain(d->timerFd);
+        RelayPulseSchedulerPrivate::drain(d->wakeFd);
+    }
+}
+
+RelayPulseScheduler::RelayPulseScheduler(const QList<GpioBackend*> &banks, QObject *parent)
+    : QObject(parent)
+    , d(new RelayPulseSchedulerPrivate(this))
+{
+    d->banks = banks.mid(0, GpioBankDefinition::MaxBanks);
+    d->worker = new PulseWorkerThread(d.get(), this);
+    d->worker->setObjectName(QStringLiteral("RelayPulseWorker"));
+}
+
+RelayPulseScheduler::~RelayPulseScheduler()
+{
+    stop();
+}
+
+void RelayPulseScheduler::start()
+{
+    d->shouldAbort = false;
+    d->worker->start();
+}
+
+void RelayPulseScheduler::stop()
+{
+    if (d->worker->isRunning()) {
+        d->shouldAbort = true;
+        d->wakeWorker();
+        d->worker->wait();
+        const LatencyHistogram &jitter{Metrics::instance().histogram(Metrics::WakeupJitter)};
+        const LatencyHistogram &widthError{Metrics::instance().histogram(Metrics::PulseWidthError)};
+        if (jitter.count() > 0) {
+            qCInfo(RELAYBOARD_GPIO) << "Relay timing over" << jitter.count() << "pulses: wakeup jitter p50" << jitter.quantileUs(0.5)
+                << "us, p99" << jitter.quantileUs(0.99) << "us, pulse width error p50" << widthError.quantileUs(0.5) << "us, p99" << widthError.quantileUs(0.99) << "us";
+        }
+    }
+    // Make sure nothing is left energised once we are no longer running
+    std::lock_guard<std::mutex> lock(d->mutex);
+    for (int bank = 0; bank < d->banks.count(); ++bank) {
+        if (d->energisedMasks[bank]) {
+            d->banks.at(bank)->writeOutputs(d->energisedMasks[bank], d->energisedMasks[bank]);
+            d->energisedMasks[bank] = 0;
+        }
+    }
+    d->edges = decltype(d->edges)();
+    d->waitingEdges.clear();
+    std::fill(std::begin(d->energisedAt), std::end(d->energisedAt), quint64(0));
+    std::fill(std::begin(d->outputAvailableAt), std::end(d->outputAvailableAt), quint64(0));
+    std::fill(std::begin(d->outputRestingUntil), std::end(d->outputRestingUntil), quint64(0));
+    d->energisedCount = 0;
+}
+
+void RelayPulseScheduler::setMaxEnergised(int maxEnergised)
+{
+    d->maxEnergised = qMax(0, maxEnergised);
+    d->wakeWorker();
+}
+
+int RelayPulseScheduler::maxEnergised() const
+{
+    return d->maxEnergised;
+}
+
+void RelayPulseScheduler::setRealtimePriority(int priority)
+{
+    d->realtimePriority = qBound(0, priority, 99);
+    d->wakeWorker();
+}
+
+int RelayPulseScheduler::realtimePriority() const
+{
+    return d->realtimePriority;
+}
+
+quint64 RelayPulseScheduler::heartbeatNs() const
+{
+    return d->heartbeatNs.load(std::memory_order_relaxed);
+}
+
+void RelayPulseScheduler::ping()
+{
+    d->wakeWorker();
+}
+
+quint64 RelayPulseScheduler::schedulePulse(int output, int pulseWidthMs, int restMs)
+{
+    return schedulePulses(QList<Pulse>{Pulse{output, pulseWidthMs, restMs}});
+}
+
+quint64 RelayPulseScheduler::schedulePulses(const QList<RelayPulseScheduler::Pulse> &pulses)
+{
+    quint64 firstPulseId{0};
+    {
+        std::lock_guard<std::mutex> lock(d->mutex);
+        const quint64 now{monotonicNowNs()};
+        for (const Pulse &pulse : pulses) {
+            if (pulse.output < 0 || pulse.output >= output(d->banks.count(), 0)) {
+                qCWarning(RELAYBOARD_GPIO) << "Not scheduling a pulse on output" << pulse.output << "which is outside the configured GPIO banks";
+                continue;
+            }
+            const quint64 pulseWidthNs{quint64(qMax(0, pulse.pulseWidthMs)) * 1000000ULL};
+            const quint64 restNs{quint64(qMax(0, pulse.restMs)) * 1000000ULL};
+            const quint64 pulseId{d->nextPulseId++};
+            if (firstPulseId == 0) {
+                firstPulseId = pulseId;
+            }
+            // Outputs which are free all get the same deadline, so they end up in the same write
+            const quint64 start{qMax(now, d->outputAvailableAt[pulse.output])};
+            d->edges.push(PulseEdge{start, pulseId, pulse.output, true, pulseWidthNs, restNs, now});
+            Metrics::instance().increment(Metrics::PulsesScheduled);
+            d->outputAvailableAt[pulse.output] = start + pulseWidthNs + restNs;
+        }
+    }
+    d->wakeWorker();
+    return firstPulseId;
+}
@@ -0,0 +1,145 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RELAYPULSESCHEDULER_H
+#define RELAYPULSESCHEDULER_H
+
+#include <QObject>
+#include <memory>
+
+#include "channeldefinition.h"
+
+class GpioBackend;
+class RelayPulseSchedulerPrivate;
+/**
+ * Performs relay pulses on a dedicated GPIO worker thread
+ *
+ * Scheduling a pulse puts the two edges of that pulse (energising the relay,
+ * and then releasing it again) into a deadline-ordered queue and returns
+ * immediately. The worker sleeps on a timerfd armed for the earliest pending
+ * deadline, so the calling thread (usually the event loop) never blocks on
+ * relay timing, and pulses on different relays overlap freely.
+ *
+ * Pulses on the same relay are queued up behind each other, with a rest
+ * period between them, so a latching relay gets to see every pulse.
+ *
+ * Relays are identified by an output number, made up of the GPIO bank and the
+ * line within it (see output()), and all the edges which are due at the same
+ * time are written to each bank's backend in one go, so switching a group of
+ * relays happens simultaneously (or, across several banks, one bank after the
+ * other with nothing in between).
+ * To protect the supply driving the relay coils, the number of relays which
+ * are energised at the same time can be limited, in which case any pulses
+ * beyond that limit wait for one of the others to be released.
+ *
+ * How late the worker wakes up for each release, and how far the achieved
+ * pulse widths are from the requested ones, are recorded in Metrics.
+ */
+class RelayPulseScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    /**
+     * @param banks The backends the relays are written through, one per GPIO bank
+     * @param parent The parent object
+     */
+    explicit RelayPulseScheduler(const QList<GpioBackend*> &banks, QObject *parent = nullptr);
+    ~RelayPulseScheduler() override;
+
+    /**
+     * A single relay to pulse, and for how long
+     */
+    struct Pulse {
+        int output;
+        int pulseWidthMs;
+        int restMs;
+    };
+    /**
+     * The output number for a line on one of the GPIO banks
+     * @param bank The position of the bank in the list given to the constructor
+     * @param line The line within the bank
+     */
+    static constexpr int output(int bank, int line) {
+        return bank * GpioBankDefinition::MaxLines + line;
+    }
+
+    /**
+     * Start the worker thread. Pulses scheduled before this are held until it runs.
+     */
+    void start();
+    /**
+     * Stop the worker thread, releasing any relay which is currently energised
+     */
+    void stop();
+
+    /**
+     * Schedule a pulse on the given output. This is safe to call from any thread.
+     * @param output The output the relay is connected to
+     * @param pulseWidthMs How long the relay should be energised for
+     * @param restMs How long to wait after the pulse before pulsing the same relay again
+     * @return An identifier for the pulse, which will be passed to pulseCompleted
+     */
+    quint64 schedulePulse(int output, int pulseWidthMs = 50, int restMs = 50);
+    /**
+     * Schedule a number of pulses, all starting at the same time (subject to
+     * the energised relay limit). This is safe to call from any thread.
+     * @param pulses The relays to pulse
+     * @return The identifier of the first pulse, with the rest following on consecutively
+     */
+    quint64 schedulePulses(const QList<RelayPulseScheduler::Pulse> &pulses);
+
+    /**
+     * Set the maximum number of relays which can be energised at the same time
+     * @param maxEnergised The maximum number of energised relays, or 0 for no limit
+     */
+    void setMaxEnergised(int maxEnergised);
+    int maxEnergised() const;
+    /**
+     * Run the worker as a real-time thread, for pulse widths which do not
+     * depend on whatever else is running. The worker then runs with the
+     * SCHED_FIFO policy, the memory of the process is locked, and the last
+     * moment before each edge is waited out with an absolute clock_nanosleep,
+     * rather than on the timer which new pulses can interrupt.
+     * @param priority The SCHED_FIFO priority (1 to 99), or 0 to run as a normal thread
+     */
+    void setRealtimePriority(int priority);
+    int realtimePriority() const;
+
+    /**
+     * When the worker thread last went round its loop, which it does whenever
+     * it has something to do, or has been pinged
+     * @return The CLOCK_MONOTONIC time in nanoseconds, or 0 if it has not run yet
+     */
+    quint64 heartbeatNs() const;
+    /**
+     * Wake up the worker thread, so it updates its heartbeat
+     */
+    void ping();
+
+    /**
+     * Emitted from the worker thread once a pulse has been completed (that
+     * is, once the relay has been released again)
+     * @param output The output which was pulsed
+     * @param pulseId The identifier returned when the pulse was scheduled
+     */
+    Q_SIGNAL void pulseCompleted(int output, quint64 pulseId);
+private:
+    std::unique_ptr<RelayPulseSchedulerPrivate> d;
+};
+
+#endif//RELAYPULSESCHEDULER_H
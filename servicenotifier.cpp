@@ -0,0 +1,144 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "servicenotifier.h"
+#include "inputhandler.h"
+#include "logging.h"
+#include "monotonicclock.h"
+
+#include <QTimer>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Taken while the process is being set up, before main() runs, so the
+// startup timings include everything Qt does before we get going
+static const quint64 processStartNs{monotonicNowNs()};
+
+class ServiceNotifierPrivate {
+public:
+    ServiceNotifierPrivate() {
+        const QByteArray socketPath{qgetenv("NOTIFY_SOCKET")};
+        if (socketPath.isEmpty() || (socketPath.at(0) != '/' && socketPath.at(0) != '@') || socketPath.size() >= int(sizeof(address.sun_path))) {
+            return;
+        }
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        memcpy(address.sun_path, socketPath.constData(), size_t(socketPath.size()));
+        // An @ at the start means the socket is in the abstract namespace
+        if (address.sun_path[0] == '@') {
+            address.sun_path[0] = '\0';
+        }
+        addressLength = socklen_t(offsetof(sockaddr_un, sun_path) + size_t(socketPath.size()));
+        socketFd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (socketFd < 0) {
+            qCWarning(RELAYBOARD_CONFIG) << "Failed to create the socket for talking to systemd:" << strerror(errno);
+        }
+        // The watchdog is only meant for us if systemd says so (or does not say who it is for)
+        bool ok{false};
+        const qint64 watchdogUs{qEnvironmentVariable("WATCHDOG_USEC").toLongLong(&ok)};
+        const QString watchdogPid{qEnvironmentVariable("WATCHDOG_PID")};
+        if (ok && watchdogUs > 0 && (watchdogPid.isEmpty() || watchdogPid.toLongLong() == getpid())) {
+            watchdogIntervalMs = int(qMax(qint64(1), watchdogUs / 2000));
+        }
+    }
+    ~ServiceNotifierPrivate() {
+        if (socketFd > -1) {
+            close(socketFd);
+        }
+    }
+    InputHandler *inputHandler{nullptr};
+    int socketFd{-1};
+    sockaddr_un address;
+    socklen_t addressLength{0};
+    // Half the watchdog timeout, or 0 if there is no watchdog
+    int watchdogIntervalMs{0};
+    QTimer *watchdogTimer{nullptr};
+    // When the GPIO worker was last asked to check in
+    quint64 lastPingNs{0};
+    bool workerStalled{false};
+
+    void send(const QByteArray &message) {
+        if (socketFd < 0) {
+            return;
+        }
+        if (sendto(socketFd, message.constData(), size_t(message.size()), MSG_NOSIGNAL, reinterpret_cast<const sockaddr*>(&address), addressLength) < 0) {
+            qCWarning(RELAYBOARD_CONFIG) << "Failed to notify systemd:" << strerror(errno);
+        }
+    }
+    void handleWatchdogTimeout() {
+        // The timer firing shows the event loop is alive, and the worker having
+        // checked in since the last ping shows it is not stuck either
+        const quint64 heartbeatNs{inputHandler->gpioWorkerHeartbeatNs()};
+        if (lastPingNs == 0 || heartbeatNs >= lastPingNs) {
+            if (workerStalled) {
+                qCInfo(RELAYBOARD_GPIO) << "The GPIO worker is responding again";
+                workerStalled = false;
+            }
+            send(QByteArrayLiteral("WATCHDOG=1"));
+        } else if (!workerStalled) {
+            qCWarning(RELAYBOARD_GPIO) << "The GPIO worker has stopped responding, so systemd is no longer being told we are alive";
+            workerStalled = true;
+        }
+        lastPingNs = monotonicNowNs();
+        inputHandler->pingGpioWorker();
+    }
+};
+
+ServiceNotifier::ServiceNotifier(InputHandler *inputHandler, QObject *parent)
+    : QObject(parent)
+    , d(new ServiceNotifierPrivate)
+{
+    d->inputHandler = inputHandler;
+    d->watchdogTimer = new QTimer(this);
+    connect(d->watchdogTimer, &QTimer::timeout, this, [this](){ d->handleWatchdogTimeout(); });
+}
+
+ServiceNotifier::~ServiceNotifier() = default;
+
+void ServiceNotifier::notifyReady()
+{
+    d->send(QByteArrayLiteral("READY=1\nSTATUS=Ready"));
+    markStartup("ready");
+    if (d->socketFd > -1 && d->watchdogIntervalMs > 0) {
+        qCDebug(RELAYBOARD_CONFIG) << "Notifying the systemd watchdog every" << d->watchdogIntervalMs << "ms";
+        d->handleWatchdogTimeout();
+        d->watchdogTimer->start(d->watchdogIntervalMs);
+    }
+}
+
+void ServiceNotifier::setStatus(const QString &status)
+{
+    d->send(QByteArrayLiteral("STATUS=") + status.toUtf8());
+}
+
+void ServiceNotifier::notifyStopping()
+{
+    d->watchdogTimer->stop();
+    d->send(QByteArrayLiteral("STOPPING=1"));
+}
+
+void ServiceNotifier::markStartup(const char *milestone)
+{
+    const quint64 elapsedUs{(monotonicNowNs() - processStartNs) / 1000};
+    qCInfo(RELAYBOARD_METRICS) << "Startup:" << milestone << "after" << double(elapsedUs) / 1000.0 << "ms";
+}
@@ -0,0 +1,66 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SERVICENOTIFIER_H
+#define SERVICENOTIFIER_H
+
+#include <QObject>
+#include <memory>
+
+class InputHandler;
+class ServiceNotifierPrivate;
+/**
+ * Keeps systemd up to date with how the service is doing
+ *
+ * This speaks the sd_notify protocol directly (it is a single datagram to the
+ * socket systemd hands us), so there is nothing extra to link against, and
+ * when not started by systemd, it does nothing at all. Once the service is
+ * ready, systemd is told so, and if the unit has a watchdog, it is kept happy
+ * for as long as both the event loop and the GPIO worker are responsive.
+ */
+class ServiceNotifier : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ServiceNotifier(InputHandler *inputHandler, QObject *parent = nullptr);
+    ~ServiceNotifier() override;
+
+    /**
+     * Tell systemd the service is ready, and start the watchdog heartbeat
+     */
+    Q_SLOT void notifyReady();
+    /**
+     * Set the status line systemd shows for the service
+     * @param status A short description of what the service is doing
+     */
+    Q_SLOT void setStatus(const QString &status);
+    /**
+     * Tell systemd the service is on its way down
+     */
+    Q_SLOT void notifyStopping();
+
+    /**
+     * Log how long it took from the process starting to reaching a milestone
+     * @param milestone A short description of what was reached
+     */
+    static void markStartup(const char *milestone);
+private:
+    std::unique_ptr<ServiceNotifierPrivate> d;
+};
+
+#endif//SERVICENOTIFIER_H
@@ -0,0 +1,90 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "shutdownwatcher.h"
+#include "logging.h"
+
+#include <QCoreApplication>
+#include <QSocketNotifier>
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+// As with SIGHUP in ConfigWatcher, the handler only pokes the event loop through a socket
+int shutdownFds[2]{-1, -1};
+
+void handleShutdownSignal(int signalNumber)
+{
+    const char poke{static_cast<char>(signalNumber)};
+    const int savedErrno{errno};
+    if (write(shutdownFds[0], &poke, sizeof(poke)) < 0) {
+        // Nothing useful can be done about it from in here
+    }
+    errno = savedErrno;
+}
+}
+
+class ShutdownWatcherPrivate {
+public:
+    ShutdownWatcherPrivate() {}
+    QSocketNotifier *notifier{nullptr};
+};
+
+ShutdownWatcher::ShutdownWatcher(QObject *parent)
+    : QObject(parent)
+    , d(new ShutdownWatcherPrivate)
+{
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0, shutdownFds) == 0) {
+        d->notifier = new QSocketNotifier(shutdownFds[1], QSocketNotifier::Read, this);
+        connect(d->notifier, &QSocketNotifier::activated, this, [](){
+            char poke[16];
+            ssize_t received{0};
+            int signalNumber{0};
+            while ((received = read(shutdownFds[1], poke, sizeof(poke))) > 0) {
+                signalNumber = poke[received - 1];
+            }
+            qCInfo(RELAYBOARD_CONTROL) << "Received" << strsignal(signalNumber) << "- shutting down";
+            QCoreApplication::quit();
+        });
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = handleShutdownSignal;
+        sigemptyset(&action.sa_mask);
+        // Back to the default after the first one, so a second signal kills a shutdown which hangs
+        action.sa_flags = SA_RESTART | SA_RESETHAND;
+        sigaction(SIGTERM, &action, nullptr);
+        sigaction(SIGINT, &action, nullptr);
+    } else {
+        qCWarning(RELAYBOARD_CONTROL) << "Failed to set up shutting down cleanly on SIGTERM and SIGINT:" << strerror(errno);
+    }
+}
+
+ShutdownWatcher::~ShutdownWatcher()
+{
+    if (d->notifier) {
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGINT, SIG_DFL);
+        close(shutdownFds[0]);
+        close(shutdownFds[1]);
+        shutdownFds[0] = shutdownFds[1] = -1;
+    }
+}
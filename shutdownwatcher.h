@@ -0,0 +1,46 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SHUTDOWNWATCHER_H
+#define SHUTDOWNWATCHER_H
+
+#include <QObject>
+#include <memory>
+
+class ShutdownWatcherPrivate;
+/**
+ * Quits the application's event loop on SIGTERM and SIGINT
+ *
+ * Without this, systemctl stop (or ctrl+c) would kill the service outright,
+ * and none of the cleanup which happens after the event loop returns would
+ * get to run: the relays would not be released, the state file and counter
+ * totals would not be synced, the log ring would not be flushed, and the
+ * service manager would not be told the service is stopping. A second signal
+ * while shutting down kills the service as usual, in case something hangs.
+ */
+class ShutdownWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ShutdownWatcher(QObject *parent = nullptr);
+    ~ShutdownWatcher() override;
+private:
+    std::unique_ptr<ShutdownWatcherPrivate> d;
+};
+
+#endif//SHUTDOWNWATCHER_H
@@ -0,0 +1,163 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "simulatedgpiobackend.h"
+#include "config.h"
+#include "logging.h"
+#include "monotonicclock.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QHash>
+#include <QTimer>
+
+#include <atomic>
+
+class SimulatedGpioBackendPrivate {
+public:
+    SimulatedGpioBackendPrivate() {}
+    int relayDelay{20};
+    int bounceCount{0};
+    int bounceInterval{1};
+    QString noiseScript;
+
+    // Written by the GPIO worker, so kept atomic
+    std::atomic<quint64> outputLevels{~quint64(0)};
+    // Everything below only lives on the backend's own thread
+    QList<int> outputLines;
+    QList<int> inputLines;
+    QHash<int, bool> inputLevels;
+    QHash<int, int> pulseCounts;
+
+    void loadNoiseScript(SimulatedGpioBackend *q) {
+        QFile script(noiseScript);
+        if (!script.open(QIODevice::ReadOnly)) {
+            qCWarning(RELAYBOARD_GPIO) << "Could not open the simulated input noise script" << noiseScript;
+            return;
+        }
+        // Each line of the script is "<milliseconds after startup> <input line> <level>",
+        // and anything after a # is a comment
+        int eventCount{0};
+        while (!script.atEnd()) {
+            QByteArray line = script.readLine();
+            const int commentStart = line.indexOf('#');
+            if (commentStart > -1) {
+                line.truncate(commentStart);
+            }
+            const QList<QByteArray> parts = line.simplified().split(' ');
+            if (parts.count() != 3) {
+                continue;
+            }
+            bool timeOk{false}, lineOk{false}, levelOk{false};
+            const int time = parts.at(0).toInt(&timeOk);
+            const int inputLine = parts.at(1).toInt(&lineOk);
+            const int level = parts.at(2).toInt(&levelOk);
+            if (timeOk && lineOk && levelOk) {
+                QTimer::singleShot(time, Qt::PreciseTimer, q, [q, inputLine, level](){ q->setInputLevel(inputLine, level != 0); });
+                ++eventCount;
+            }
+        }
+        qCDebug(RELAYBOARD_GPIO) << "Scheduled" << eventCount << "simulated input events from" << noiseScript;
+    }
+
+    void relayEnergised(SimulatedGpioBackend *q, int outputLine) {
+        pulseCounts[outputLine] = pulseCounts.value(outputLine) + 1;
+        const int inputLine = inputLines.value(outputLines.indexOf(outputLine), -1);
+        if (inputLine < 0) {
+            return;
+        }
+        // The latching relay flips its state, and the contact may bounce a few
+        // times before it settles on the new level
+        const bool newLevel{!inputLevels.value(inputLine, true)};
+        QTimer::singleShot(relayDelay, Qt::PreciseTimer, q, [q, inputLine, newLevel](){ q->setInputLevel(inputLine, newLevel); });
+        for (int bounce = 1; bounce <= bounceCount * 2; ++bounce) {
+            const bool bounceLevel{(bounce % 2) ? !newLevel : newLevel};
+            QTimer::singleShot(relayDelay + bounce * bounceInterval, Qt::PreciseTimer, q, [q, inputLine, bounceLevel](){ q->setInputLevel(inputLine, bounceLevel); });
+        }
+    }
+};
+
+SimulatedGpioBackend::SimulatedGpioBackend(Config *config, QObject *parent)
+    : GpioBackend(parent)
+    , d(new SimulatedGpioBackendPrivate)
+{
+    d->relayDelay = config->simulatedRelayDelay();
+    d->bounceCount = config->simulatedBounceCount();
+    d->bounceInterval = config->simulatedBounceInterval();
+    d->noiseScript = config->simulatedNoiseScript();
+}
+
+SimulatedGpioBackend::~SimulatedGpioBackend() = default;
+
+bool SimulatedGpioBackend::initialize(const QList<int> &outputLines, const QList<int> &inputLines)
+{
+    d->outputLines = outputLines;
+    d->inputLines = inputLines;
+    // The inputs are pulled up, so with the relays all open they read high
+    for (int line : inputLines) {
+        d->inputLevels[line] = true;
+    }
+    if (!d->noiseScript.isEmpty()) {
+        d->loadNoiseScript(this);
+    }
+    qCDebug(RELAYBOARD_GPIO) << "Simulating a relay board with" << outputLines.count() << "relays and" << inputLines.count() << "inputs";
+    return true;
+}
+
+void SimulatedGpioBackend::writeOutputs(quint64 levels, quint64 mask)
+{
+    quint64 previous{d->outputLevels.load()};
+    quint64 updated{0};
+    do {
+        updated = (previous & ~mask) | (levels & mask);
+    } while (!d->outputLevels.compare_exchange_weak(previous, updated));
+    // The relays are active low, so it is the falling edges which energise them
+    const quint64 energised{previous & ~updated};
+    if (energised) {
+        QMetaObject::invokeMethod(this, [this, energised](){
+            for (int line = 0; line < 64; ++line) {
+                if (energised & (quint64(1) << line)) {
+                    d->relayEnergised(this, line);
+                }
+            }
+        }, Qt::QueuedConnection);
+    }
+}
+
+bool SimulatedGpioBackend::inputLevel(int line) const
+{
+    return d->inputLevels.value(line, true);
+}
+
+quint64 SimulatedGpioBackend::outputLevels() const
+{
+    return d->outputLevels.load();
+}
+
+int SimulatedGpioBackend::pulseCount(int line) const
+{
+    return d->pulseCounts.value(line);
+}
+
+void SimulatedGpioBackend::setInputLevel(int line, bool level)
+{
+    if (d->inputLevels.contains(line) && d->inputLevels.value(line) != level) {
+        d->inputLevels[line] = level;
+        Q_EMIT inputChanged(line, level, monotonicNowNs());
+    }
+}
@@ -0,0 +1,66 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SIMULATEDGPIOBACKEND_H
+#define SIMULATEDGPIOBACKEND_H
+
+#include "gpiobackend.h"
+
+#include <memory>
+
+class SimulatedGpioBackendPrivate;
+/**
+ * An in-memory relay board, for running the service without any hardware
+ *
+ * The simulation models the latching relays the board is used with: each
+ * output line is paired with the input line in the same position, and
+ * energising the output toggles the state of that input after a configurable
+ * delay, optionally with some contact bounce. On top of that, a script of
+ * input changes can be played back, to simulate noise on the inputs.
+ */
+class SimulatedGpioBackend : public GpioBackend
+{
+    Q_OBJECT
+public:
+    explicit SimulatedGpioBackend(Config *config, QObject *parent = nullptr);
+    ~SimulatedGpioBackend() override;
+
+    bool initialize(const QList<int> &outputLines, const QList<int> &inputLines) override;
+    void writeOutputs(quint64 levels, quint64 mask) override;
+    bool inputLevel(int line) const override;
+
+    /**
+     * The current levels of all the output lines, one bit per line offset
+     */
+    quint64 outputLevels() const;
+    /**
+     * How many times each output has been energised since startup
+     * @param line The output line to check
+     */
+    int pulseCount(int line) const;
+    /**
+     * Change the level of an input line, as though it had been changed externally
+     * @param line The input line to change
+     * @param level The new level for the line
+     */
+    Q_SLOT void setInputLevel(int line, bool level);
+private:
+    std::unique_ptr<SimulatedGpioBackendPrivate> d;
+};
+
+#endif//SIMULATEDGPIOBACKEND_H
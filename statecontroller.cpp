@@ -0,0 +1,224 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "statecontroller.h"
+#include "config.h"
+#include "inputhandler.h"
+#include "logging.h"
+#include "metrics.h"
+
+#include <QTimer>
+
+class StateControllerPrivate {
+public:
+    StateControllerPrivate(StateController *q)
+        : q(q)
+    {}
+    StateController *q;
+    Config *config{nullptr};
+    InputHandler *inputHandler{nullptr};
+
+    /**
+     * A channel on its way to a requested state
+     */
+    struct PendingState {
+        bool active{false};
+        bool target{false};
+        int attempts{0};
+        // The pulse which is still to complete, or 0 once it has
+        quint64 pulseId{0};
+        QTimer *verifyTimer{nullptr};
+    };
+    PendingState pending[ChannelDefinition::MaxChannels];
+
+    bool isOn(int channel) const {
+        return inputHandler->channelStates().isOn(channel);
+    }
+    void finish(int channel) {
+        PendingState &state = pending[channel];
+        state.active = false;
+        state.pulseId = 0;
+        if (state.verifyTimer) {
+            state.verifyTimer->stop();
+        }
+    }
+    void fail(int channel, bool on, const QString &reason) {
+        finish(channel);
+        Metrics::instance().increment(Metrics::SetStateFailures);
+        qCWarning(RELAYBOARD_GPIO) << "Could not set channel" << channel + 1 << "to" << InputHandler::stateName(on) << "-" << reason;
+        Q_EMIT q->setStateFailed(channel, on, reason);
+    }
+    void pulse(int channel) {
+        PendingState &state = pending[channel];
+        ++state.attempts;
+        state.pulseId = inputHandler->pulseRelay(channel);
+        if (state.pulseId == 0) {
+            fail(channel, state.target, QStringLiteral("the relay could not be pulsed"));
+        }
+    }
+    /**
+     * Get a channel ready to be set to a state
+     * @return True if the relay needs pulsing, in which case the channel is now pending
+     */
+    bool needsPulse(int channel, bool on) {
+        if (channel < 0 || channel >= inputHandler->channelCount()) {
+            return false;
+        }
+        const ChannelDefinition &definition = inputHandler->channel(channel);
+        if (definition.relayLine < 0 || definition.inputLine < 0) {
+            Q_EMIT q->setStateFailed(channel, on, QStringLiteral("the channel needs both a relay and an input to be set to a state"));
+            return false;
+        }
+        if (!inputHandler->channelStates().isKnown(channel)) {
+            Q_EMIT q->setStateFailed(channel, on, QStringLiteral("the state of the channel is not known yet"));
+            return false;
+        }
+        PendingState &state = pending[channel];
+        if (state.active) {
+            // Already on the way somewhere, so just change where, and let the
+            // verification take care of pulsing it again if need be
+            if (state.target != on) {
+                state.target = on;
+                state.attempts = 0;
+            }
+            return false;
+        }
+        if (isOn(channel) == on) {
+            Metrics::instance().increment(Metrics::RedundantCommands);
+            qCDebug(RELAYBOARD_GPIO) << "Channel" << channel + 1 << "is already" << InputHandler::stateName(on);
+            return false;
+        }
+        state.active = true;
+        state.target = on;
+        return true;
+    }
+    void handlePulseCompleted(int channel, quint64 pulseId) {
+        if (channel < 0 || channel >= ChannelDefinition::MaxChannels) {
+            return;
+        }
+        PendingState &state = pending[channel];
+        if (!state.active || state.pulseId != pulseId) {
+            return;
+        }
+        state.pulseId = 0;
+        // The input may well have followed while the relay was still energised
+        if (isOn(channel) == state.target) {
+            finish(channel);
+            return;
+        }
+        if (!state.verifyTimer) {
+            state.verifyTimer = new QTimer(q);
+            state.verifyTimer->setSingleShot(true);
+            QObject::connect(state.verifyTimer, &QTimer::timeout, q, [this, channel](){ handleVerifyTimeout(channel); });
+        }
+        state.verifyTimer->start(config->setVerifyTimeout());
+    }
+    void handleStateChanged(int channel) {
+        if (channel < 0 || channel >= ChannelDefinition::MaxChannels) {
+            return;
+        }
+        const PendingState &state = pending[channel];
+        // While the pulse is still going, its completion does the checking
+        if (state.active && state.pulseId == 0 && isOn(channel) == state.target) {
+            qCDebug(RELAYBOARD_GPIO) << "Channel" << channel + 1 << "is now" << InputHandler::stateName(state.target);
+            finish(channel);
+        }
+    }
+    void handleVerifyTimeout(int channel) {
+        PendingState &state = pending[channel];
+        if (!state.active) {
+            return;
+        }
+        if (isOn(channel) == state.target) {
+            finish(channel);
+        } else if (state.attempts <= config->setRetries()) {
+            qCDebug(RELAYBOARD_GPIO) << "Channel" << channel + 1 << "did not change, pulsing it again";
+            pulse(channel);
+        } else {
+            fail(channel, state.target, QStringLiteral("the input did not change after %1 pulses").arg(state.attempts));
+        }
+    }
+};
+
+StateController::StateController(Config *config, InputHandler *inputHandler, QObject *parent)
+    : QObject(parent)
+    , d(new StateControllerPrivate(this))
+{
+    d->config = config;
+    d->inputHandler = inputHandler;
+    connect(inputHandler, &InputHandler::relayPulseCompleted, this, [this](int channel, quint64 pulseId){
+        d->handlePulseCompleted(channel, pulseId);
+    });
+    connect(inputHandler, &InputHandler::inputChannelStateChanged, this, [this](int channel){
+        d->handleStateChanged(channel);
+    });
+}
+
+StateController::~StateController() = default;
+
+quint64 StateController::setState(int channel, bool on)
+{
+    if (!d->needsPulse(channel, on)) {
+        return 0;
+    }
+    d->pending[channel].attempts = 0;
+    d->pulse(channel);
+    // A pulse which could not be scheduled has already failed the channel, and left this at 0
+    return d->pending[channel].pulseId;
+}
+
+void StateController::setStates(quint64 on, quint64 off, quint64 toggle)
+{
+    const quint64 conflicting{on & off};
+    for (quint64 remaining = conflicting; remaining; remaining &= remaining - 1) {
+        const int channel{__builtin_ctzll(remaining)};
+        Q_EMIT setStateFailed(channel, true, QStringLiteral("the channel was asked to be both on and off"));
+    }
+    on &= ~conflicting;
+    off &= ~conflicting;
+    // Everything which needs pulsing goes into the same group, so the relays all switch together
+    QList<int> channels;
+    int setCount{0};
+    for (quint64 remaining = on | off; remaining; remaining &= remaining - 1) {
+        const int channel{__builtin_ctzll(remaining)};
+        if (d->needsPulse(channel, on & (quint64(1) << channel))) {
+            channels << channel;
+            ++setCount;
+        }
+    }
+    for (quint64 remaining = toggle & ~(on | off); remaining; remaining &= remaining - 1) {
+        const int channel{__builtin_ctzll(remaining)};
+        if (channel < d->inputHandler->channelCount() && d->inputHandler->channel(channel).relayLine > -1) {
+            channels << channel;
+        }
+    }
+    if (channels.isEmpty()) {
+        return;
+    }
+    // Every channel in the list has a relay, so the pulse identifiers follow on from the first one
+    const quint64 firstPulseId{d->inputHandler->pulseRelays(channels)};
+    for (int index = 0; index < setCount; ++index) {
+        const int channel{channels.at(index)};
+        StateControllerPrivate::PendingState &state = d->pending[channel];
+        state.attempts = 1;
+        state.pulseId = firstPulseId ? firstPulseId + quint64(index) : 0;
+        if (state.pulseId == 0) {
+            d->fail(channel, state.target, QStringLiteral("the relay could not be pulsed"));
+        }
+    }
+}
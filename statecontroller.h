@@ -0,0 +1,75 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STATECONTROLLER_H
+#define STATECONTROLLER_H
+
+#include <QObject>
+#include <memory>
+
+class Config;
+class InputHandler;
+class StateControllerPrivate;
+/**
+ * Sets channels to a given state, using the input to check the relay did as it was told
+ *
+ * A latching relay only knows how to change state, so setting it to a state
+ * means comparing what we want with what the channel's input says it is, and
+ * pulsing the relay only if the two differ. Once the pulse is done, the input
+ * is given a little while to report the new state, and if it does not, the
+ * relay is pulsed again, up to a limited number of times, before giving up.
+ */
+class StateController : public QObject
+{
+    Q_OBJECT
+public:
+    StateController(Config *config, InputHandler *inputHandler, QObject *parent = nullptr);
+    ~StateController() override;
+
+    /**
+     * Set a channel to the given state. Asking for the state the channel is
+     * already in does nothing, and asking again while the channel is on its
+     * way to a state just changes where it is going.
+     * @param channel The zero-based index of the channel
+     * @param on Whether the channel should be on or off
+     * @return The identifier of the pulse which was scheduled to get the channel
+     *         there, or 0 if the relay is not being pulsed
+     */
+    Q_SLOT quint64 setState(int channel, bool on);
+    /**
+     * Set and toggle a group of channels at once. All the relays which need
+     * pulsing are pulsed as a single group, and the channels being set are
+     * then checked just as with setState.
+     * @param on The channels to switch on, with bit n for the channel at index n
+     * @param off The channels to switch off
+     * @param toggle The channels to toggle, regardless of their state
+     */
+    Q_SLOT void setStates(quint64 on, quint64 off, quint64 toggle);
+
+    /**
+     * Emitted when a channel could not be set to the requested state
+     * @param channel The channel which was being set
+     * @param on The state it was meant to end up in
+     * @param reason A description of what went wrong
+     */
+    Q_SIGNAL void setStateFailed(int channel, bool on, const QString &reason);
+private:
+    std::unique_ptr<StateControllerPrivate> d;
+};
+
+#endif//STATECONTROLLER_H
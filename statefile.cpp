@@ -0,0 +1,215 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "statefile.h"
+#include "channeldefinition.h"
+#include "logging.h"
+
+#include <QDateTime>
+#include <QFile>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * The layout of the file, which is only ever written by the service itself
+ */
+struct StateFileData {
+    static constexpr quint32 Magic{0x46534252}; // "RBSF"
+    static constexpr quint32 Version{2};
+    quint32 magic;
+    quint32 version;
+    // Over everything which follows it
+    quint32 checksum;
+    quint32 statusTopicsHash;
+    qint64 savedAtMs;
+    quint64 states;
+    quint64 knownStates;
+    quint64 publishedStates;
+    quint64 publishedKnown;
+    quint64 pulseCounts[ChannelDefinition::MaxChannels];
+    quint64 counterTotals[ChannelDefinition::MaxChannels];
+};
+
+class StateFilePrivate {
+public:
+    StateFilePrivate() {}
+    ~StateFilePrivate() {
+        if (data) {
+            msync(data, sizeof(StateFileData), MS_SYNC);
+            munmap(data, sizeof(StateFileData));
+        }
+    }
+    StateFileData *data{nullptr};
+    bool restored{false};
+
+    static quint32 checksum(const StateFileData *data) {
+        // FNV-1a, which is plenty for spotting a file that was only partly written
+        const unsigned char *bytes{reinterpret_cast<const unsigned char*>(data) + offsetof(StateFileData, statusTopicsHash)};
+        const size_t length{sizeof(StateFileData) - offsetof(StateFileData, statusTopicsHash)};
+        quint32 hash{2166136261u};
+        for (size_t index = 0; index < length; ++index) {
+            hash = (hash ^ bytes[index]) * 16777619u;
+        }
+        return hash;
+    }
+    void save() {
+        data->savedAtMs = QDateTime::currentMSecsSinceEpoch();
+        data->checksum = checksum(data);
+        // Only asks for the page to be written out, it does not wait for it
+        msync(data, sizeof(StateFileData), MS_ASYNC);
+    }
+};
+
+StateFile::StateFile(const QString &fileName)
+    : d(new StateFilePrivate)
+{
+    if (fileName.isEmpty()) {
+        return;
+    }
+    const int fd{open(QFile::encodeName(fileName).constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0644)};
+    if (fd < 0) {
+        qCWarning(RELAYBOARD_CONFIG) << "Failed to open the state file" << fileName << ":" << strerror(errno);
+        return;
+    }
+    struct stat fileStat;
+    const bool rightSize{fstat(fd, &fileStat) == 0 && fileStat.st_size == off_t(sizeof(StateFileData))};
+    if (!rightSize && ftruncate(fd, off_t(sizeof(StateFileData))) < 0) {
+        qCWarning(RELAYBOARD_CONFIG) << "Failed to size the state file" << fileName << ":" << strerror(errno);
+        close(fd);
+        return;
+    }
+    void *mapping{mmap(nullptr, sizeof(StateFileData), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)};
+    // The mapping holds on to the file by itself
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        qCWarning(RELAYBOARD_CONFIG) << "Failed to map the state file" << fileName << ":" << strerror(errno);
+        return;
+    }
+    d->data = static_cast<StateFileData*>(mapping);
+    d->restored = rightSize && d->data->magic == StateFileData::Magic && d->data->version == StateFileData::Version
+        && d->data->checksum == StateFilePrivate::checksum(d->data);
+    if (!d->restored) {
+        if (rightSize) {
+            qCWarning(RELAYBOARD_CONFIG) << "The state file" << fileName << "is not valid, starting afresh";
+        }
+        memset(d->data, 0, sizeof(StateFileData));
+        d->data->magic = StateFileData::Magic;
+        d->data->version = StateFileData::Version;
+        d->save();
+    }
+}
+
+StateFile::~StateFile() = default;
+
+bool StateFile::isOpen() const
+{
+    return d->data;
+}
+
+bool StateFile::isRestored() const
+{
+    return d->restored;
+}
+
+qint64 StateFile::savedAtMs() const
+{
+    return d->data ? d->data->savedAtMs : 0;
+}
+
+quint64 StateFile::states() const
+{
+    return d->data ? d->data->states : 0;
+}
+
+quint64 StateFile::knownStates() const
+{
+    return d->data ? d->data->knownStates : 0;
+}
+
+void StateFile::setStates(quint64 states, quint64 knownStates)
+{
+    if (d->data && (d->data->states != states || d->data->knownStates != knownStates)) {
+        d->data->states = states;
+        d->data->knownStates = knownStates;
+        d->save();
+    }
+}
+
+quint64 StateFile::publishedStates() const
+{
+    return d->data ? d->data->publishedStates : 0;
+}
+
+quint64 StateFile::publishedKnown() const
+{
+    return d->data ? d->data->publishedKnown : 0;
+}
+
+quint32 StateFile::statusTopicsHash() const
+{
+    return d->data ? d->data->statusTopicsHash : 0;
+}
+
+void StateFile::setPublished(quint64 states, quint64 known, quint32 statusTopicsHash)
+{
+    if (d->data && (d->data->publishedStates != states || d->data->publishedKnown != known || d->data->statusTopicsHash != statusTopicsHash)) {
+        d->data->publishedStates = states;
+        d->data->publishedKnown = known;
+        d->data->statusTopicsHash = statusTopicsHash;
+        d->save();
+    }
+}
+
+quint64 StateFile::pulseCount(int channel) const
+{
+    if (!d->data || channel < 0 || channel >= ChannelDefinition::MaxChannels) {
+        return 0;
+    }
+    return d->data->pulseCounts[channel];
+}
+
+void StateFile::addPulse(int channel)
+{
+    if (d->data && channel > -1 && channel < ChannelDefinition::MaxChannels) {
+        ++d->data->pulseCounts[channel];
+        d->save();
+    }
+}
+
+quint64 StateFile::counterTotal(int channel) const
+{
+    if (!d->data || channel < 0 || channel >= ChannelDefinition::MaxChannels) {
+        return 0;
+    }
+    return d->data->counterTotals[channel];
+}
+
+void StateFile::setCounterTotal(int channel, quint64 total)
+{
+    if (d->data && channel > -1 && channel < ChannelDefinition::MaxChannels && d->data->counterTotals[channel] != total) {
+        d->data->counterTotals[channel] = total;
+        d->save();
+    }
+}
@@ -0,0 +1,122 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef STATEFILE_H
+#define STATEFILE_H
+
+#include <QString>
+#include <memory>
+
+class StateFilePrivate;
+/**
+ * The last known state of the channels, kept in a small memory-mapped file
+ *
+ * Updating the file is just a handful of stores into the mapping (the kernel
+ * writes it out in its own time), so it can be kept up to date with every
+ * change without slowing anything down. When the service starts, whatever
+ * was in the file from the previous run is available straight away, along
+ * with the lifetime pulse counts of the relays and the totals of the counter
+ * inputs. The contents carry a
+ * checksum, so a file which was only partly written out before losing power
+ * is ignored rather than trusted.
+ *
+ * This is only meant to be used from a single thread.
+ */
+class StateFile
+{
+public:
+    /**
+     * @param fileName The file to keep the state in, or an empty string to keep it nowhere
+     */
+    explicit StateFile(const QString &fileName);
+    ~StateFile();
+
+    /**
+     * Whether the file could be opened and mapped (if not, nothing is kept)
+     */
+    bool isOpen() const;
+    /**
+     * Whether the file held a valid state from a previous run
+     */
+    bool isRestored() const;
+    /**
+     * When the state was last saved, in milliseconds since the epoch
+     */
+    qint64 savedAtMs() const;
+
+    /**
+     * The channel states, with bit n set if channel n is on
+     */
+    quint64 states() const;
+    /**
+     * Which channels the states are known for
+     */
+    quint64 knownStates() const;
+    /**
+     * Record the current states of the channels
+     * @param states The channel states, with bit n set if channel n is on
+     * @param knownStates Which channels the states are known for
+     */
+    void setStates(quint64 states, quint64 knownStates);
+
+    /**
+     * The states which were last published to the broker
+     */
+    quint64 publishedStates() const;
+    /**
+     * Which channels have had their state published to the broker
+     */
+    quint64 publishedKnown() const;
+    /**
+     * A hash of the status topics the states were published to, so a change
+     * of topics can be told apart from the states being on the broker already
+     */
+    quint32 statusTopicsHash() const;
+    /**
+     * Record what was last published to the broker
+     */
+    void setPublished(quint64 states, quint64 known, quint32 statusTopicsHash);
+
+    /**
+     * How many times a channel's relay has been pulsed, over all runs of the service
+     * @param channel The zero-based index of the channel
+     */
+    quint64 pulseCount(int channel) const;
+    /**
+     * Count a pulse of a channel's relay
+     * @param channel The zero-based index of the channel
+     */
+    void addPulse(int channel);
+
+    /**
+     * The total number of pulses counted on a channel's counter input, over all runs of the service
+     * @param channel The zero-based index of the channel
+     */
+    quint64 counterTotal(int channel) const;
+    /**
+     * Record the total counted on a channel's counter input
+     * @param channel The zero-based index of the channel
+     * @param total The total number of pulses counted
+     */
+    void setCounterTotal(int channel, quint64 total);
+private:
+    std::unique_ptr<StateFilePrivate> d;
+};
+
+#endif//STATEFILE_H
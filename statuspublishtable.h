@@ -0,0 +1,107 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STATUSPUBLISHTABLE_H
+#define STATUSPUBLISHTABLE_H
+
+#include <QByteArray>
+#include <QMqttTopicName>
+
+#include "channeldefinition.h"
+#include "channelstatetable.h"
+
+/**
+ * The status topic for every channel, ready to be published to
+ *
+ * The topics are built once, when we connect, and kept as QMqttTopicName
+ * instances, and the payloads are shared, so publishing a state change is
+ * an array lookup and a couple of reference count bumps, with nothing
+ * allocated or converted along the way.
+ */
+class StatusPublishTable
+{
+public:
+    static constexpr int MaxChannels{ChannelDefinition::MaxChannels};
+
+    StatusPublishTable() = default;
+
+    void clear() {
+        for (QMqttTopicName &topic : m_topics) {
+            topic = QMqttTopicName{};
+        }
+    }
+    /**
+     * Set the topic the state of a channel is published to
+     * @param channel The zero-based position of the channel
+     * @param topic The status topic for the channel
+     */
+    void setTopic(int channel, const QString &topic) {
+        if (channel > -1 && channel < MaxChannels) {
+            m_topics[channel] = QMqttTopicName{topic};
+        }
+    }
+    /**
+     * The topic the state of a channel is published to
+     * @param channel The zero-based position of the channel
+     * @return The topic, which is invalid if the channel has no status topic
+     */
+    const QMqttTopicName &topic(int channel) const {
+        static const QMqttTopicName noTopic;
+        return (channel > -1 && channel < MaxChannels) ? m_topics[channel] : noTopic;
+    }
+    /**
+     * The payload published for a state
+     * @param on Whether to fetch the payload for the on or the off state
+     * @return "on" or "off"
+     */
+    static const QByteArray &payload(bool on) {
+        static const QByteArray onPayload{QByteArrayLiteral("on")};
+        static const QByteArray offPayload{QByteArrayLiteral("off")};
+        return on ? onPayload : offPayload;
+    }
+    /**
+     * Publish the state of each pending channel which differs from what the
+     * broker was last told, and keep track of what it has now been told
+     * @param snapshot The current channel states
+     * @param pending The channels which may have changed
+     * @param publishedStates The states last published, updated for the channels which went out
+     * @param publishedKnown The channels whose state has been published, updated likewise
+     * @param publish Called with the channel, its topic and its state, returning
+     *                whether the state went out (a channel without a status topic
+     *                has nothing to publish, and counts as having gone out)
+     * @return The channels whose state went out
+     */
+    template<typename Publish>
+    quint64 publishChanged(const ChannelStateSnapshot &snapshot, quint64 pending, quint64 &publishedStates, quint64 &publishedKnown, Publish publish) const {
+        const quint64 changed{pending & snapshot.knownStates & ((snapshot.states ^ publishedStates) | ~publishedKnown)};
+        quint64 delivered{changed};
+        for (quint64 remaining = changed; remaining; remaining &= remaining - 1) {
+            const int channel{__builtin_ctzll(remaining)};
+            if (m_topics[channel].isValid() && !publish(channel, m_topics[channel], snapshot.isOn(channel))) {
+                delivered &= ~(quint64(1) << channel);
+            }
+        }
+        publishedStates = (publishedStates & ~delivered) | (snapshot.states & delivered);
+        publishedKnown |= delivered;
+        return delivered;
+    }
+private:
+    QMqttTopicName m_topics[MaxChannels];
+};
+
+#endif//STATUSPUBLISHTABLE_H
@@ -0,0 +1,121 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "commandadmission.h"
+
+#include <QtTest>
+
+/**
+ * Checks which commands CommandAdmission lets through: redeliveries, repeated
+ * command IDs, the per-channel rate limit (for single channels and batches)
+ * and the maximum age
+ */
+class CommandAdmissionTest : public QObject
+{
+    Q_OBJECT
+private:
+    // Well clear of 0, which the admission treats as never having seen anything
+    static constexpr quint64 StartNs{1000ULL * 1000000000ULL};
+    static constexpr quint64 MsNs{1000000ULL};
+
+private Q_SLOTS:
+    void redelivery() {
+        CommandAdmission admission;
+        QCOMPARE(admission.admit(0, 7, false, QByteArrayLiteral("toggle"), StartNs), CommandAdmission::Accepted);
+        QCOMPARE(admission.admit(0, 7, true, QByteArrayLiteral("toggle"), StartNs + MsNs), CommandAdmission::DuplicateDelivery);
+        // Without the redelivery flag, a reused packet identifier is a new message
+        QCOMPARE(admission.admit(0, 7, false, QByteArrayLiteral("toggle"), StartNs + 2 * MsNs), CommandAdmission::Accepted);
+        // QoS 0 messages have no packet identifier to go by
+        QCOMPARE(admission.admit(0, 0, true, QByteArrayLiteral("toggle"), StartNs + 3 * MsNs), CommandAdmission::Accepted);
+        // And a redelivery long after the packet was seen is not matched against it
+        QCOMPARE(admission.admit(0, 7, true, QByteArrayLiteral("toggle"), StartNs + 61000 * MsNs), CommandAdmission::Accepted);
+    }
+
+    void commandIds() {
+        CommandAdmission admission;
+        const QByteArray command{QByteArrayLiteral("{\"id\":\"kitchen-1\"}")};
+        // Nothing is looked for until there is a window
+        QCOMPARE(admission.admit(0, 0, false, command, StartNs), CommandAdmission::Accepted);
+        QCOMPARE(admission.admit(0, 0, false, command, StartNs), CommandAdmission::Accepted);
+        admission.setCommandIdWindow(1000);
+        QCOMPARE(admission.admit(0, 0, false, command, StartNs), CommandAdmission::Accepted);
+        QCOMPARE(admission.admit(0, 0, false, command, StartNs + 500 * MsNs), CommandAdmission::DuplicateCommand);
+        // The ID is what matters, not the channel
+        QCOMPARE(admission.admit(1, 0, false, command, StartNs + 600 * MsNs), CommandAdmission::DuplicateCommand);
+        QCOMPARE(admission.admit(0, 0, false, command, StartNs + 1500 * MsNs), CommandAdmission::Accepted);
+        // An ID given alongside the payload (as an MQTT 5 user property) counts the same
+        QCOMPARE(admission.admit(0, 0, false, QByteArrayLiteral("toggle"), StartNs, QByteArrayLiteral("kitchen-2")), CommandAdmission::Accepted);
+        QCOMPARE(admission.admit(0, 0, false, QByteArrayLiteral("toggle"), StartNs + MsNs, QByteArrayLiteral("kitchen-2")), CommandAdmission::DuplicateCommand);
+        // Commands without an ID are never duplicates of each other
+        QCOMPARE(admission.admit(0, 0, false, QByteArrayLiteral("toggle"), StartNs), CommandAdmission::Accepted);
+        QCOMPARE(admission.admit(0, 0, false, QByteArrayLiteral("toggle"), StartNs), CommandAdmission::Accepted);
+    }
+
+    void rateLimit() {
+        CommandAdmission admission;
+        admission.setRateLimit(1, 2);
+        QCOMPARE(admission.admit(0, 0, false, QByteArrayLiteral("toggle"), StartNs), CommandAdmission::Accepted);
+        QCOMPARE(admission.admit(0, 0, false, QByteArrayLiteral("toggle"), StartNs), CommandAdmission::Accepted);
+        QCOMPARE(admission.admit(0, 0, false, QByteArrayLiteral("toggle"), StartNs), CommandAdmission::RateLimited);
+        // Every channel has an allowance of its own
+        QCOMPARE(admission.admit(1, 0, false, QByteArrayLiteral("toggle"), StartNs), CommandAdmission::Accepted);
+        // One command's worth comes back every second
+        QCOMPARE(admission.admit(0, 0, false, QByteArrayLiteral("toggle"), StartNs + 1500 * MsNs), CommandAdmission::Accepted);
+        QCOMPARE(admission.admit(0, 0, false, QByteArrayLiteral("toggle"), StartNs + 1500 * MsNs), CommandAdmission::RateLimited);
+        // Turning the limit off lets everything through
+        admission.setRateLimit(0, 2);
+        QCOMPARE(admission.admit(0, 0, false, QByteArrayLiteral("toggle"), StartNs + 1500 * MsNs), CommandAdmission::Accepted);
+    }
+
+    void rateLimitedIdCanBeResent() {
+        CommandAdmission admission;
+        admission.setCommandIdWindow(10000);
+        admission.setRateLimit(1, 1);
+        QCOMPARE(admission.admit(0, 0, false, QByteArrayLiteral("{\"id\":\"a\"}"), StartNs), CommandAdmission::Accepted);
+        QCOMPARE(admission.admit(0, 0, false, QByteArrayLiteral("{\"id\":\"b\"}"), StartNs), CommandAdmission::RateLimited);
+        QCOMPARE(admission.admit(0, 0, false, QByteArrayLiteral("{\"id\":\"b\"}"), StartNs + 1500 * MsNs), CommandAdmission::Accepted);
+    }
+
+    void batchRateLimit() {
+        CommandAdmission admission;
+        const quint64 channels{0b1011};
+        QCOMPARE(admission.admitChannels(channels, StartNs), channels);
+        admission.setRateLimit(1, 1);
+        QCOMPARE(admission.admitChannels(channels, StartNs), channels);
+        // Each channel the batch changed was charged
+        QCOMPARE(admission.admitChannels(channels, StartNs), quint64(0));
+        QCOMPARE(admission.admit(1, 0, false, QByteArrayLiteral("toggle"), StartNs), CommandAdmission::RateLimited);
+        // Only the channels over their limit are left out
+        QCOMPARE(admission.admitChannels(0b0110, StartNs), quint64(0b0100));
+        QCOMPARE(admission.admitChannels(channels, StartNs + 1500 * MsNs), channels);
+    }
+
+    void maxAge() {
+        CommandAdmission admission;
+        QCOMPARE(admission.admit(0, 0, false, QByteArrayLiteral("toggle"), StartNs, QByteArray{}, 60000), CommandAdmission::Accepted);
+        admission.setMaxAge(1000);
+        QCOMPARE(admission.admit(0, 0, false, QByteArrayLiteral("toggle"), StartNs, QByteArray{}, 5000), CommandAdmission::Expired);
+        QCOMPARE(admission.admit(0, 0, false, QByteArrayLiteral("toggle"), StartNs, QByteArray{}, 500), CommandAdmission::Accepted);
+        // A command which does not say when it was sent cannot be too old
+        QCOMPARE(admission.admit(0, 0, false, QByteArrayLiteral("toggle"), StartNs), CommandAdmission::Accepted);
+    }
+};
+
+QTEST_GUILESS_MAIN(CommandAdmissionTest)
+
+#include "commandadmissiontest.moc"
@@ -0,0 +1,143 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "brokerstandin.h"
+#include "config.h"
+#include "inputhandler.h"
+#include "metrics.h"
+#include "mqttclient.h"
+
+#include <QLoggingCategory>
+#include <QTemporaryDir>
+#include <QtMqtt>
+#include <QtTest>
+
+/**
+ * Runs the whole service against a broker stand-in and the simulated relay
+ * board, and checks that commands sent to the broker end up switching the
+ * relays, with the channels' new states coming back through the broker
+ */
+class EndToEndTest : public QObject
+{
+    Q_OBJECT
+private:
+    static constexpr int ChannelCount{8};
+    QTemporaryDir directory;
+    BrokerStandIn broker;
+    Config *config{nullptr};
+    InputHandler *inputHandler{nullptr};
+    MqttClient *mqttClient{nullptr};
+    QMqttClient *harness{nullptr};
+    // The most recent state published for each status topic
+    QHash<QString, QByteArray> states;
+
+    static QString topic(int channel, const QString &endpoint) {
+        return QStringLiteral("test/light-%1/%2").arg(channel + 1).arg(endpoint);
+    }
+    QByteArray state(int channel) const {
+        return states.value(topic(channel, QStringLiteral("status")));
+    }
+    static QByteArray opposite(const QByteArray &state) {
+        return state == "on" ? QByteArrayLiteral("off") : QByteArrayLiteral("on");
+    }
+    void send(const QString &topic, const QByteArray &payload) {
+        QVERIFY(harness->publish(QMqttTopicName{topic}, payload, 1) > -1);
+    }
+
+private Q_SLOTS:
+    void initTestCase() {
+        QLoggingCategory::setFilterRules(QStringLiteral("relayboard.*.debug=false"));
+        QVERIFY(directory.isValid());
+        QVERIFY(broker.listen());
+        const QString configFile{directory.filePath(QStringLiteral("relayboard-control.rc"))};
+        QFile file(configFile);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        QByteArray contents{"[General]\nmqttHost=127.0.0.1\nmqttPort=" + QByteArray::number(broker.port()) + "\n"
+                            "mqttClientId=relayboard-test\ngpioBackend=simulated\n"
+                            "debounceMode=none\npublishBatchWindow=0\ncommandRate=0\npulseWidth=1\nrestTime=1\n"
+                            "batchTopic=test/batch\nstateFile=\ncontrolSocket=\njournalFile=\n"
+                            "[Simulation]\nrelayDelay=0\n"
+                            "[Topics]\ntopicBase=test\n"};
+        for (int channel = 0; channel < ChannelCount; ++channel) {
+            contents += "topic-" + QByteArray::number(channel + 1) + "=light-" + QByteArray::number(channel + 1) + '\n';
+        }
+        QVERIFY(file.write(contents) == contents.size());
+        file.close();
+
+        config = new Config(configFile, this);
+        QVERIFY(config->isValid());
+        inputHandler = new InputHandler(config, this);
+        QVERIFY(inputHandler->isReady());
+        mqttClient = new MqttClient(config, inputHandler);
+        mqttClient->start();
+
+        harness = new QMqttClient(this);
+        harness->setHostname(QStringLiteral("127.0.0.1"));
+        harness->setPort(broker.port());
+        connect(harness, &QMqttClient::messageReceived, this, [this](const QByteArray &message, const QMqttTopicName &topic){
+            states.insert(topic.name(), message);
+        });
+        harness->connectToHost();
+        QTRY_COMPARE(harness->state(), QMqttClient::Connected);
+        QVERIFY(harness->subscribe(QMqttTopicFilter{QStringLiteral("test/+/status")}, 0));
+        // Every channel's state is published once the service has connected
+        QTRY_COMPARE(states.count(), ChannelCount);
+    }
+
+    void cleanupTestCase() {
+        mqttClient->stop();
+        harness->disconnectFromHost();
+    }
+
+    void toggle() {
+        for (int channel = 0; channel < ChannelCount; ++channel) {
+            const QByteArray before{state(channel)};
+            QVERIFY(before == "on" || before == "off");
+            send(topic(channel, QStringLiteral("toggle")), QByteArrayLiteral("toggle"));
+            QTRY_COMPARE(state(channel), opposite(before));
+        }
+    }
+
+    void set() {
+        const QByteArray target{opposite(state(0))};
+        send(topic(0, QStringLiteral("set")), target);
+        QTRY_COMPARE(state(0), target);
+        // The state can come back while the relay is still energised, and the
+        // channel is only done once the pulse is, so give that time to happen
+        QTest::qWait(100);
+        // Asking for the state the channel is already in leaves the relay alone
+        const quint64 redundantBefore{Metrics::instance().counter(Metrics::RedundantCommands)};
+        send(topic(0, QStringLiteral("set")), QByteArrayLiteral("{\"state\":\"") + target + QByteArrayLiteral("\"}"));
+        QTRY_COMPARE(Metrics::instance().counter(Metrics::RedundantCommands), redundantBefore + 1);
+        QCOMPARE(state(0), target);
+    }
+
+    void batch() {
+        const QByteArray first{opposite(state(0))};
+        const QByteArray second{opposite(state(1))};
+        const QByteArray third{state(2)};
+        send(QStringLiteral("test/batch"), QByteArrayLiteral("{\"1\":\"") + first + QByteArrayLiteral("\",\"2\":\"") + second + QByteArrayLiteral("\",\"3\":\"toggle\"}"));
+        QTRY_COMPARE(state(0), first);
+        QTRY_COMPARE(state(1), second);
+        QTRY_COMPARE(state(2), opposite(third));
+    }
+};
+
+QTEST_GUILESS_MAIN(EndToEndTest)
+
+#include "endtoendtest.moc"
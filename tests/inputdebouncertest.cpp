@@ -0,0 +1,153 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "inputdebouncer.h"
+#include "monotonicclock.h"
+
+#include <QSignalSpy>
+#include <QtTest>
+
+/**
+ * Feeds bouncing and glitching edges through each of InputDebouncer's modes,
+ * and checks that only real changes come out the other end
+ */
+class InputDebouncerTest : public QObject
+{
+    Q_OBJECT
+private:
+    static constexpr int Line{3};
+    static constexpr quint64 MsNs{1000000ULL};
+
+private Q_SLOTS:
+    void modeFromName() {
+        bool ok{false};
+        QCOMPARE(InputDebouncer::modeFromName(QStringLiteral("stable"), &ok), InputDebouncer::StableTime);
+        QVERIFY(ok);
+        QCOMPARE(InputDebouncer::modeFromName(QStringLiteral("Integrator"), &ok), InputDebouncer::Integrator);
+        QVERIFY(ok);
+        QCOMPARE(InputDebouncer::modeFromName(QStringLiteral("majority"), &ok), InputDebouncer::MajorityVote);
+        QVERIFY(ok);
+        QCOMPARE(InputDebouncer::modeFromName(QStringLiteral("none"), &ok), InputDebouncer::NoDebounce);
+        QVERIFY(ok);
+        QCOMPARE(InputDebouncer::modeFromName(QStringLiteral("sometimes"), &ok), InputDebouncer::NoDebounce);
+        QVERIFY(!ok);
+    }
+
+    void noDebounce() {
+        InputDebouncer debouncer;
+        debouncer.setLevel(Line, true);
+        QSignalSpy spy(&debouncer, &InputDebouncer::levelChanged);
+        const quint64 now{monotonicNowNs()};
+        debouncer.handleEdge(Line, false, now);
+        QCOMPARE(spy.count(), 1);
+        QCOMPARE(spy.at(0).at(0).toInt(), Line);
+        QCOMPARE(spy.at(0).at(1).toBool(), false);
+        QCOMPARE(spy.at(0).at(2).toULongLong(), now);
+        // An edge to the level the line is already at is not a change
+        debouncer.handleEdge(Line, false, now + MsNs);
+        QCOMPARE(spy.count(), 1);
+    }
+
+    void stableTimeBounce() {
+        InputDebouncer debouncer;
+        debouncer.setMode(InputDebouncer::StableTime);
+        debouncer.setWindowMs(20);
+        debouncer.setLevel(Line, true);
+        QSignalSpy spy(&debouncer, &InputDebouncer::levelChanged);
+        const quint64 now{monotonicNowNs()};
+        debouncer.handleEdge(Line, false, now);
+        debouncer.handleEdge(Line, true, now);
+        debouncer.handleEdge(Line, false, now);
+        QCOMPARE(spy.count(), 0);
+        QTRY_COMPARE(spy.count(), 1);
+        QCOMPARE(spy.at(0).at(1).toBool(), false);
+        QCOMPARE(spy.at(0).at(2).toULongLong(), now);
+        QCOMPARE(debouncer.suppressedCount(Line), quint32(2));
+    }
+
+    void stableTimeGlitch() {
+        InputDebouncer debouncer;
+        debouncer.setMode(InputDebouncer::StableTime);
+        debouncer.setWindowMs(20);
+        debouncer.setLevel(Line, true);
+        QSignalSpy spy(&debouncer, &InputDebouncer::levelChanged);
+        const quint64 now{monotonicNowNs()};
+        debouncer.handleEdge(Line, false, now);
+        debouncer.handleEdge(Line, true, now);
+        // Give the window plenty of time to pass
+        QTest::qWait(60);
+        QCOMPARE(spy.count(), 0);
+        QCOMPARE(debouncer.suppressedCount(Line), quint32(2));
+    }
+
+    void integrator() {
+        InputDebouncer debouncer;
+        debouncer.setMode(InputDebouncer::Integrator);
+        debouncer.setWindowMs(10);
+        debouncer.setSampleCount(5);
+        debouncer.setLevel(Line, true);
+        QSignalSpy spy(&debouncer, &InputDebouncer::levelChanged);
+        debouncer.handleEdge(Line, false, monotonicNowNs());
+        QTRY_COMPARE(spy.count(), 1);
+        QCOMPARE(spy.at(0).at(1).toBool(), false);
+        // A glitch shorter than a sample never moves the count off the bottom
+        debouncer.handleEdge(Line, true, monotonicNowNs());
+        debouncer.handleEdge(Line, false, monotonicNowNs());
+        QTest::qWait(60);
+        QCOMPARE(spy.count(), 1);
+        QCOMPARE(debouncer.suppressedCount(Line), quint32(2));
+    }
+
+    void majorityVote() {
+        InputDebouncer debouncer;
+        debouncer.setMode(InputDebouncer::MajorityVote);
+        debouncer.setWindowMs(9);
+        debouncer.setSampleCount(3);
+        debouncer.setLevel(Line, false);
+        QSignalSpy spy(&debouncer, &InputDebouncer::levelChanged);
+        debouncer.handleEdge(Line, true, monotonicNowNs());
+        QTRY_COMPARE(spy.count(), 1);
+        QCOMPARE(spy.at(0).at(1).toBool(), true);
+        debouncer.handleEdge(Line, false, monotonicNowNs());
+        debouncer.handleEdge(Line, true, monotonicNowNs());
+        QTest::qWait(60);
+        QCOMPARE(spy.count(), 1);
+        QCOMPARE(debouncer.suppressedCount(Line), quint32(2));
+    }
+
+    void linesAreIndependent() {
+        InputDebouncer debouncer;
+        debouncer.setMode(InputDebouncer::StableTime);
+        debouncer.setWindowMs(20);
+        debouncer.setLevel(Line, true);
+        debouncer.setLevel(Line + 1, true);
+        QSignalSpy spy(&debouncer, &InputDebouncer::levelChanged);
+        const quint64 now{monotonicNowNs()};
+        debouncer.handleEdge(Line, false, now);
+        debouncer.handleEdge(Line + 1, false, now);
+        debouncer.handleEdge(Line + 1, true, now);
+        QTRY_COMPARE(spy.count(), 1);
+        QCOMPARE(spy.at(0).at(0).toInt(), Line);
+        QCOMPARE(debouncer.suppressedCount(Line + 1), quint32(2));
+        QCOMPARE(debouncer.suppressedCount(Line), quint32(0));
+    }
+};
+
+QTEST_GUILESS_MAIN(InputDebouncerTest)
+
+#include "inputdebouncertest.moc"
@@ -0,0 +1,126 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "pulsecounter.h"
+
+#include <QtTest>
+
+/**
+ * Checks that PulseCounter counts the right edges, honours the holdoff, keeps
+ * its totals, and works out the rates over its windows
+ */
+class PulseCounterTest : public QObject
+{
+    Q_OBJECT
+private:
+    // Well into the life of the system, as CLOCK_MONOTONIC timestamps would be
+    static constexpr quint64 StartNs{1000ULL * 1000000000ULL};
+    static constexpr quint64 MsNs{1000000ULL};
+    static constexpr quint64 SecondNs{1000000000ULL};
+
+    static ChannelDefinition counterChannel(ChannelDefinition::CounterEdge edge, int holdoffMs = 0) {
+        ChannelDefinition definition;
+        definition.inputLine = 4;
+        definition.inputMode = ChannelDefinition::CounterInput;
+        definition.counterEdge = edge;
+        definition.counterHoldoff = holdoffMs;
+        return definition;
+    }
+
+private Q_SLOTS:
+    void onlyCounterInputs() {
+        PulseCounter counter;
+        ChannelDefinition stateChannel;
+        stateChannel.inputLine = 4;
+        counter.setChannel(0, stateChannel);
+        QVERIFY(!counter.isCounting(0));
+        QVERIFY(!counter.handleEdge(0, false, StartNs));
+        QCOMPARE(counter.total(0), quint64(0));
+        counter.setChannel(1, counterChannel(ChannelDefinition::FallingEdge));
+        QVERIFY(counter.isCounting(1));
+        QCOMPARE(counter.countingChannels(), quint64(0b10));
+    }
+
+    void edges() {
+        PulseCounter counter;
+        counter.setChannel(0, counterChannel(ChannelDefinition::FallingEdge));
+        counter.setChannel(1, counterChannel(ChannelDefinition::RisingEdge));
+        counter.setChannel(2, counterChannel(ChannelDefinition::BothEdges));
+        for (int pulse = 0; pulse < 10; ++pulse) {
+            const quint64 timestampNs{StartNs + quint64(pulse) * 100 * MsNs};
+            for (int channel = 0; channel < 3; ++channel) {
+                counter.handleEdge(channel, false, timestampNs);
+                counter.handleEdge(channel, true, timestampNs + 30 * MsNs);
+            }
+        }
+        QCOMPARE(counter.total(0), quint64(10));
+        QCOMPARE(counter.total(1), quint64(10));
+        QCOMPARE(counter.total(2), quint64(20));
+        QCOMPARE(counter.lastIntervalNs(0), 100 * MsNs);
+        QCOMPARE(counter.lastIntervalNs(2), 30 * MsNs);
+    }
+
+    void holdoff() {
+        // Contacts which bounce, or a noisy line, must not add to the count
+        PulseCounter counter;
+        counter.setChannel(0, counterChannel(ChannelDefinition::FallingEdge, 10));
+        QVERIFY(counter.handleEdge(0, false, StartNs));
+        QVERIFY(!counter.handleEdge(0, false, StartNs + 2 * MsNs));
+        QVERIFY(!counter.handleEdge(0, false, StartNs + 9 * MsNs));
+        QVERIFY(counter.handleEdge(0, false, StartNs + 20 * MsNs));
+        QCOMPARE(counter.total(0), quint64(2));
+        QCOMPARE(counter.lastIntervalNs(0), 20 * MsNs);
+    }
+
+    void totals() {
+        PulseCounter counter;
+        counter.setChannel(0, counterChannel(ChannelDefinition::FallingEdge));
+        // Carrying on from the total saved by a previous run
+        counter.setTotal(0, 41);
+        QVERIFY(counter.handleEdge(0, false, StartNs));
+        QCOMPARE(counter.total(0), quint64(42));
+        // Changing how the channel counts keeps its total
+        counter.setChannel(0, counterChannel(ChannelDefinition::BothEdges));
+        QCOMPARE(counter.total(0), quint64(42));
+        counter.addMissed(0, 3);
+        QCOMPARE(counter.missed(0), quint64(3));
+    }
+
+    void rates() {
+        PulseCounter counter;
+        counter.setRateWindows({60, 10});
+        QCOMPARE(counter.rateWindows(), QList<int>({60, 10}));
+        counter.setChannel(0, counterChannel(ChannelDefinition::FallingEdge));
+        // One pulse a second for 30 seconds, and then nothing
+        for (int second = 0; second < 30; ++second) {
+            QVERIFY(counter.handleEdge(0, false, StartNs + quint64(second) * SecondNs));
+        }
+        const quint64 nowNs{StartNs + 29 * SecondNs + 500 * MsNs};
+        QCOMPARE(counter.rate(0, 60, nowNs), 0.5);
+        QCOMPARE(counter.rate(0, 10, nowNs), 1.0);
+        // Once the pulses have passed out of a window, its rate drops back to nothing
+        QCOMPARE(counter.rate(0, 10, StartNs + 45 * SecondNs), 0.0);
+        QCOMPARE(counter.rate(0, 60, StartNs + 100 * SecondNs), 0.0);
+        // A channel which is not counted has no rate
+        QCOMPARE(counter.rate(1, 60, nowNs), 0.0);
+    }
+};
+
+QTEST_GUILESS_MAIN(PulseCounterTest)
+
+#include "pulsecountertest.moc"
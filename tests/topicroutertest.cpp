@@ -0,0 +1,143 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "topicrouter.h"
+
+#include <QtTest>
+
+/**
+ * Checks the subscription filters TopicRouter works out: that they are as few
+ * as the topics allow, that between them they match every routed topic, and
+ * that they never match a reserved topic
+ */
+class TopicRouterTest : public QObject
+{
+    Q_OBJECT
+private:
+    static void verifyCoverage(const TopicRouter &router, const QStringList &routedTopics, const QStringList &reservedTopics) {
+        const QStringList filters{router.subscriptionFilters()};
+        for (const QString &topic : routedTopics) {
+            bool matched{false};
+            for (const QString &filter : filters) {
+                matched = matched || TopicRouter::filterMatches(filter, topic);
+            }
+            QVERIFY2(matched, qPrintable(QStringLiteral("No filter matches %1").arg(topic)));
+        }
+        for (const QString &topic : reservedTopics) {
+            for (const QString &filter : filters) {
+                QVERIFY2(!TopicRouter::filterMatches(filter, topic), qPrintable(QStringLiteral("%1 matches the reserved topic %2").arg(filter).arg(topic)));
+            }
+        }
+    }
+
+private Q_SLOTS:
+    void filterMatches() {
+        QVERIFY(TopicRouter::filterMatches(QStringLiteral("home/+/toggle"), QStringLiteral("home/kitchen/toggle")));
+        QVERIFY(!TopicRouter::filterMatches(QStringLiteral("home/+/toggle"), QStringLiteral("home/kitchen/status")));
+        QVERIFY(!TopicRouter::filterMatches(QStringLiteral("home/+"), QStringLiteral("home/kitchen/toggle")));
+        QVERIFY(TopicRouter::filterMatches(QStringLiteral("home/#"), QStringLiteral("home/kitchen/toggle")));
+        QVERIFY(TopicRouter::filterMatches(QStringLiteral("home/kitchen/toggle"), QStringLiteral("home/kitchen/toggle")));
+    }
+
+    void singleWildcard() {
+        // The usual topicBase configuration ends up as a single subscription
+        TopicRouter router;
+        QStringList topics;
+        for (int channel = 0; channel < 8; ++channel) {
+            topics << QStringLiteral("home/light-%1/toggle").arg(channel + 1);
+            router.addRoute(topics.last(), channel, TopicRouter::ToggleCommand);
+        }
+        QCOMPARE(router.subscriptionFilters(), QStringList{QStringLiteral("home/+/toggle")});
+        verifyCoverage(router, topics, {});
+    }
+
+    void singleTopic() {
+        TopicRouter router;
+        router.addRoute(QStringLiteral("home/batch"), -1, TopicRouter::BatchCommand);
+        QCOMPARE(router.subscriptionFilters(), QStringList{QStringLiteral("home/batch")});
+    }
+
+    void differentDepths() {
+        // A + only stands in for one level, so these cannot share a filter
+        TopicRouter router;
+        router.addRoute(QStringLiteral("home/batch"), -1, TopicRouter::BatchCommand);
+        router.addRoute(QStringLiteral("home/light-1/toggle"), 0, TopicRouter::ToggleCommand);
+        router.addRoute(QStringLiteral("home/light-2/toggle"), 1, TopicRouter::ToggleCommand);
+        QCOMPARE(router.subscriptionFilters(), QStringList({QStringLiteral("home/batch"), QStringLiteral("home/+/toggle")}));
+    }
+
+    void severalVaryingLevels() {
+        // Toggle and set topics differ in two places, so they are split up by channel
+        TopicRouter router;
+        QStringList topics;
+        for (int channel = 0; channel < 2; ++channel) {
+            topics << QStringLiteral("home/light-%1/toggle").arg(channel + 1) << QStringLiteral("home/light-%1/set").arg(channel + 1);
+            router.addRoute(topics.at(topics.count() - 2), channel, TopicRouter::ToggleCommand);
+            router.addRoute(topics.last(), channel, TopicRouter::SetCommand);
+        }
+        QCOMPARE(router.subscriptionFilters(), QStringList({QStringLiteral("home/light-1/+"), QStringLiteral("home/light-2/+")}));
+        verifyCoverage(router, topics, {});
+    }
+
+    void reservedTopics() {
+        // The status topics sit right next to the commands, and must not be subscribed to
+        TopicRouter router;
+        QStringList topics;
+        QStringList statusTopics;
+        for (int channel = 0; channel < 2; ++channel) {
+            topics << QStringLiteral("home/light-%1/toggle").arg(channel + 1) << QStringLiteral("home/light-%1/set").arg(channel + 1);
+            statusTopics << QStringLiteral("home/light-%1/status").arg(channel + 1);
+            router.addRoute(topics.at(topics.count() - 2), channel, TopicRouter::ToggleCommand);
+            router.addRoute(topics.last(), channel, TopicRouter::SetCommand);
+        }
+        router.addReservedTopics(statusTopics);
+        // Which rules out a wildcard per channel, but not one per command
+        QCOMPARE(router.subscriptionFilters(), QStringList({QStringLiteral("home/+/set"), QStringLiteral("home/+/toggle")}));
+        verifyCoverage(router, topics, statusTopics);
+    }
+
+    void mixedTopics() {
+        // Channels configured one by one, with topics of all sorts of shapes
+        TopicRouter router;
+        const QStringList topics{
+            QStringLiteral("home/kitchen/light/toggle"),
+            QStringLiteral("home/kitchen/fan/toggle"),
+            QStringLiteral("home/hall/light/toggle"),
+            QStringLiteral("garden/pump/toggle"),
+            QStringLiteral("garden/pump/set"),
+            QStringLiteral("some/other/topic/toggle"),
+        };
+        const QStringList statusTopics{
+            QStringLiteral("home/kitchen/light/status"),
+            QStringLiteral("home/kitchen/fan/status"),
+            QStringLiteral("home/hall/light/status"),
+            QStringLiteral("garden/pump/status"),
+            QStringLiteral("some/other/topic/status"),
+        };
+        for (int index = 0; index < topics.count(); ++index) {
+            router.addRoute(topics.at(index), index, TopicRouter::ToggleCommand);
+        }
+        router.addReservedTopics(statusTopics);
+        QVERIFY(router.subscriptionFilters().count() < topics.count());
+        verifyCoverage(router, topics, statusTopics);
+    }
+};
+
+QTEST_GUILESS_MAIN(TopicRouterTest)
+
+#include "topicroutertest.moc"
@@ -0,0 +1,149 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "topicrouter.h"
+
+#include <QMap>
+
+static const QChar levelSeparator{'/'};
+
+void TopicRouter::clear()
+{
+    m_routes.clear();
+    m_reservedTopics.clear();
+}
+
+void TopicRouter::addRoute(const QString &topic, int channel, TopicRouter::Command command)
+{
+    if (!topic.isEmpty()) {
+        m_routes.insert(topic, Route{channel, command});
+    }
+}
+
+void TopicRouter::addReservedTopics(const QStringList &topics)
+{
+    m_reservedTopics << topics;
+}
+
+TopicRouter::Route TopicRouter::route(const QString &topic) const
+{
+    return m_routes.value(topic);
+}
+
+int TopicRouter::routeCount() const
+{
+    return m_routes.count();
+}
+
+QStringList TopicRouter::subscriptionFilters() const
+{
+    // A + only ever stands in for a single level, so only topics with the
+    // same number of levels can share a filter
+    QMap<int, QList<QStringList>> topicsByDepth;
+    QStringList topics{m_routes.keys()};
+    topics.sort();
+    for (const QString &topic : qAsConst(topics)) {
+        const QStringList levels{topic.split(levelSeparator)};
+        topicsByDepth[levels.count()] << levels;
+    }
+    QStringList filters;
+    for (const QList<QStringList> &sameDepth : qAsConst(topicsByDepth)) {
+        collectFilters(sameDepth, filters);
+    }
+    return filters;
+}
+
+void TopicRouter::collectFilters(const QList<QStringList> &topics, QStringList &filters) const
+{
+    const QStringList &first{topics.first()};
+    QList<int> varyingLevels;
+    for (int level = 0; level < first.count(); ++level) {
+        for (const QStringList &topic : topics) {
+            if (topic.at(level) != first.at(level)) {
+                varyingLevels << level;
+                break;
+            }
+        }
+    }
+    if (varyingLevels.isEmpty()) {
+        filters << first.join(levelSeparator);
+        return;
+    }
+    if (varyingLevels.count() == 1) {
+        QStringList wildcard{first};
+        wildcard[varyingLevels.first()] = QStringLiteral("+");
+        const QString filter{wildcard.join(levelSeparator)};
+        bool catchesReserved{false};
+        for (const QString &reserved : m_reservedTopics) {
+            if (filterMatches(filter, reserved)) {
+                catchesReserved = true;
+                break;
+            }
+        }
+        if (!catchesReserved) {
+            filters << filter;
+            return;
+        }
+    }
+    // Either the topics differ in more than one place, or the wildcard would
+    // catch one of the reserved topics, so split them up on one of the levels
+    // which differ, and try again for each of those groups. Which level is best
+    // depends on the topics (splitting toggle and set topics up by channel
+    // leaves wildcards which would catch the status topics next to them, while
+    // splitting them up by command does not), so every level is tried, and the
+    // split which needs the fewest filters wins
+    QStringList best;
+    for (int splitLevel : qAsConst(varyingLevels)) {
+        QStringList groupOrder;
+        QHash<QString, QList<QStringList>> groups;
+        for (const QStringList &topic : topics) {
+            const QString &key{topic.at(splitLevel)};
+            if (!groups.contains(key)) {
+                groupOrder << key;
+            }
+            groups[key] << topic;
+        }
+        QStringList candidate;
+        for (const QString &key : qAsConst(groupOrder)) {
+            collectFilters(groups.value(key), candidate);
+        }
+        if (best.isEmpty() || candidate.count() < best.count()) {
+            best = candidate;
+        }
+    }
+    filters << best;
+}
+
+bool TopicRouter::filterMatches(const QString &filter, const QString &topic)
+{
+    const QVector<QStringRef> filterLevels{filter.splitRef(levelSeparator)};
+    const QVector<QStringRef> topicLevels{topic.splitRef(levelSeparator)};
+    for (int level = 0; level < filterLevels.count(); ++level) {
+        const QStringRef &filterLevel{filterLevels.at(level)};
+        if (filterLevel == QLatin1String("#")) {
+            return true;
+        }
+        if (level >= topicLevels.count()) {
+            return false;
+        }
+        if (filterLevel != QLatin1String("+") && filterLevel != topicLevels.at(level)) {
+            return false;
+        }
+    }
+    return filterLevels.count() == topicLevels.count();
+}
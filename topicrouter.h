@@ -0,0 +1,100 @@
+/*
+* This file is a part of the relayboard-control project
+* Copyright (C) 2021  Dan Leinir Turthra Jensen <admin@leinir.dk
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TOPICROUTER_H
+#define TOPICROUTER_H
+
+#include <QHash>
+#include <QStringList>
+
+/**
+ * Maps incoming MQTT topics to the channel and command they are meant for
+ *
+ * Every command topic is put into a hash up front, so dispatching a message is
+ * a single lookup, however many channels and commands there are. Rather than
+ * subscribing to each topic on its own, the router works out a small set of
+ * wildcard filters which between them cover all the command topics (so for
+ * a configuration using topicBase, that is usually just topicBase/+/toggle),
+ * which keeps the subscription state on the broker down to a minimum.
+ */
+class TopicRouter
+{
+public:
+    enum Command {
+        ToggleCommand = 0,
+        SetCommand,
+        // Changes to several channels at once, so not for any one channel
+        BatchCommand,
+    };
+    struct Route {
+        int channel{-1};
+        Command command{ToggleCommand};
+        bool isValid() const {
+            return channel > -1 || command == BatchCommand;
+        }
+    };
+
+    TopicRouter() = default;
+
+    /**
+     * Remove all the routes and reserved topics
+     */
+    void clear();
+    /**
+     * Add a topic to the router
+     * @param topic The topic the command will be published to
+     * @param channel The zero-based index of the channel the command is for
+     * @param command The command the topic represents
+     */
+    void addRoute(const QString &topic, int channel, Command command);
+    /**
+     * Add topics which the subscription filters must never match, such as
+     * the status topics we publish to ourselves
+     * @param topics The topics to avoid
+     */
+    void addReservedTopics(const QStringList &topics);
+    /**
+     * Find the route for a topic
+     * @param topic The topic a message was received on
+     * @return The route for the topic, which is invalid if the topic is not one of ours
+     */
+    Route route(const QString &topic) const;
+    /**
+     * The number of routes in the router
+     */
+    int routeCount() const;
+
+    /**
+     * The filters to subscribe to, which between them match every routed topic
+     * @return A list of topic filters, some of which may contain a + wildcard
+     */
+    QStringList subscriptionFilters() const;
+    /**
+     * Check whether a topic would be matched by a subscription filter
+     * @param filter The filter, which may contain + and # wildcards
+     * @param topic The topic to check
+     * @return True if the filter matches the topic
+     */
+    static bool filterMatches(const QString &filter, const QString &topic);
+private:
+    void collectFilters(const QList<QStringList> &topics, QStringList &filters) const;
+    QHash<QString, Route> m_routes;
+    QStringList m_reservedTopics;
+};
+
+#endif//TOPICROUTER_H